@@ -0,0 +1,609 @@
+/******************************************************************************************
+*
+* Benchmarks of the shell
+*
+*   - micro-benchmarks of the parsing and lookup hot paths, on large synthetic inputs
+*   - end-to-end : throughput (commands/s) of a script of N commands, and latency (p50/p99)
+*     of N commands typed one by one at the prompt, for an external command and a built-in,
+*     with both launch modes
+*
+* Build and run from the root of the repository :
+*   gcc -O2 -Wall -o shell shell.c
+*   gcc -O2 -Wall -o bench/bench bench/bench.c
+*   bench/bench [-n N] [-s SHELL]
+*
+* Every result is printed on its own line as a JSON object.
+*******************************************************************************************/
+
+//The functions of the shell are benchmarked directly
+#define main shell_main
+#include "../shell.c"
+#undef main
+
+#include <time.h>
+
+/*************************************report*****************************************
+*
+* Print the result of a micro-benchmark
+*
+* ARGUMENT :
+*   - name : the name of the benchmark
+*   - iterations : the number of operations done
+*   - elapsed : the time they took, in nanoseconds
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void report(const char* name, long iterations, long long elapsed){
+
+    printf("{\"bench\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f}\n",
+           name, iterations, (double) elapsed / iterations);
+    fflush(stdout);
+}
+
+
+/*************************************bench_lex_line*****************************************
+*
+* Cut a long line mixing plain words, quotes, escapes and expansions
+*
+* ARGUMENT :
+*   - iterations : the number of times the line is cut
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_lex_line(long iterations){
+
+    char line[16384] = "echo";
+    var_set("name", "value");
+
+    for(int i = 0; i < 50; i++)
+        strcat(line, " plain \"double $name quoted\" 'single quoted' esc\\ aped $name$?");
+    strcat(line, "\n");
+
+    struct command_line cmd;
+    long long start = now_ns();
+
+    for(long i = 0; i < iterations; i++)
+        lex_line(line, &cmd, 0, 0);
+
+    report("lex_line", iterations, now_ns() - start);
+}
+
+
+/*************************************bench_program_line*****************************************
+*
+* Rebuild the words of the line of bench_lex_line from its compiled form
+*
+* ARGUMENT :
+*   - iterations : the number of times the line is rebuilt
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_program_line(long iterations){
+
+    char line[16384] = "echo";
+    var_set("name", "value");
+
+    for(int i = 0; i < 50; i++)
+        strcat(line, " plain \"double $name quoted\" 'single quoted' esc\\ aped $name$?");
+    strcat(line, "\n");
+
+    if(!program_compile(line, strlen(line)) || (program_code[0] & 0xff) != OP_LINE)
+        return;
+
+    struct command_line cmd;
+    long long start = now_ns();
+
+    for(long i = 0; i < iterations; i++)
+        program_line(program_code + 1, program_code[0] >> 8, &cmd, 0, 0);
+
+    report("program_line", iterations, now_ns() - start);
+}
+
+
+/*************************************bench_variables*****************************************
+*
+* Assign many variables then look them up
+*
+* ARGUMENT :
+*   - count : the number of variables
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_variables(long count){
+
+    char name[32];
+    char line[64];
+    struct command_line cmd;
+
+    //Assignments as typed by the user
+    long long start = now_ns();
+    for(long i = 0; i < count; i++){
+        snprintf(line, sizeof(line), "var%ld=value%ld\n", i, i);
+        lex_line(line, &cmd, 0, 0);
+        assign_variable(&cmd);
+    }
+    report("assign_variable", count, now_ns() - start);
+
+    start = now_ns();
+    for(long i = 0; i < count; i++){
+        snprintf(name, sizeof(name), "var%ld", (i * 7919) % count);
+        var_get(name);
+    }
+    report("var_get", count, now_ns() - start);
+
+    //Expansion of a variable
+    start = now_ns();
+    for(long i = 0; i < count; i++){
+        snprintf(line, sizeof(line), "echo $var%ld\n", (i * 7919) % count);
+        lex_line(line, &cmd, 0, 0);
+    }
+    report("lex_dollar", count, now_ns() - start);
+}
+
+
+/*************************************find_in_file*****************************************
+*
+* The lookup of /proc/cpuinfo the shell used before the index (getline, strstr and strtok
+* on every line), kept as the reference of bench_cpu_index
+*
+* ARGUMENT :
+*   - path : the path of the file
+*   - searched_str : the key searched
+*   - output_str : will contain the value (in line, to be freed)
+*   - number : the number of matches to skip
+*   - line : the buffer of getline, to be freed
+*
+* RETURN : true if the key has been found, false otherwise
+*
+*******************************************************************************************/
+static bool find_in_file(const char* path, const char* searched_str, char** output_str, int number, char** line){
+
+    FILE* file = fopen(path, "r");
+    if(file == NULL)
+        return false;
+
+    size_t len = 0;
+    bool result = false;
+    *line = NULL;
+
+    while(getline(line, &len, file) != -1){
+
+        if(strstr(*line, searched_str)){
+
+            if(number != 0){
+                number--;
+                continue;
+            }
+
+            *output_str = strtok(*line, ":");
+            *output_str = strtok(NULL, "");
+            memmove(*output_str, *output_str + 1, strlen(*output_str));
+            result = true;
+            break;
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+
+/*************************************bench_cpu_index*****************************************
+*
+* Index a synthetic /proc/cpuinfo of 256 CPUs with each version of proc_scan (memchr, SSE2,
+* AVX2 when supported), against the former getline/strstr lookup of the frequency of the
+* last CPU. Then get the frequency of the last CPU from the index.
+*
+* ARGUMENT :
+*   - iterations : the number of loads and of queries
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_cpu_index(long iterations){
+
+    char path[] = "/tmp/shell_bench_cpuinfoXXXXXX";
+    int fd = mkstemp(path);
+    if(fd == -1){
+        perror("Temporary file couldn't be created");
+        return;
+    }
+
+    FILE* file = fdopen(fd, "w");
+    for(int cpu = 0; cpu < 256; cpu++){
+        fprintf(file, "processor\t: %d\nvendor_id\t: GenuineIntel\ncpu family\t: 6\n"
+                      "model name\t: Intel(R) Xeon(R) CPU @ 2.20GHz\ncpu MHz\t\t: %d.000\n"
+                      "cache size\t: 56320 KB\nphysical id\t: %d\ncore id\t\t: %d\n"
+                      "flags\t\t: fpu vme de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov "
+                      "pat pse36 clflush mmx fxsr sse sse2 ss ht syscall nx pdpe1gb rdtscp lm "
+                      "constant_tsc rep_good nopl xtopology nonstop_tsc cpuid tsc_known_freq pni "
+                      "pclmulqdq ssse3 fma cx16 pcid sse4_1 sse4_2 x2apic movbe popcnt aes xsave "
+                      "avx f16c rdrand hypervisor lahf_lm abm 3dnowprefetch avx2 avx512f\n\n",
+                cpu, 2000 + cpu, cpu / 128, cpu % 128);
+    }
+    fclose(file);
+
+    double total = 0;
+    long long start = now_ns();
+
+    for(long i = 0; i < iterations; i++){
+        char* line;
+        char* mhz;
+        if(find_in_file(path, "cpu MHz", &mhz, 255, &line))
+            total += atof(mhz);
+        free(line);
+    }
+
+    report("find_in_file", iterations, now_ns() - start);
+
+    struct{
+        const char* name;
+        void (*classify)(const char* block, uint64_t* colons, uint64_t* newlines);
+        bool supported;
+    } versions[] = {
+        {"cpu_index_load_memchr", NULL, true},
+#if defined(__x86_64__) || defined(__i386__)
+        {"cpu_index_load_sse2", proc_classify_sse2, true},
+        {"cpu_index_load_avx2", proc_classify_avx2, __builtin_cpu_supports("avx2")},
+#endif
+    };
+
+    for(size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++){
+
+        if(!versions[v].supported)
+            continue;
+        proc_classify = versions[v].classify;
+        proc_classify_ready = true;
+        start = now_ns();
+
+        for(long i = 0; i < iterations; i++){
+            cpu_index_load(path);
+            total += cpu_index_get(255)->mhz;
+        }
+
+        report(versions[v].name, iterations, now_ns() - start);
+    }
+
+    unlink(path);
+    proc_classify_init();
+
+    //The index never gets stale, the queries don't read the file
+    cpu_index_ttl_ns = 1LL << 62;
+    start = now_ns();
+
+    for(long i = 0; i < iterations; i++)
+        total += cpu_index_get(255)->mhz;
+
+    report("cpu_index_get", iterations, now_ns() - start);
+    if(total < 0)
+        printf("%f\n", total);
+}
+
+
+/*************************************bench_lookup_command*****************************************
+*
+* Look a command up once it is in the hash table
+*
+* ARGUMENT :
+*   - iterations : the number of lookups
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_lookup_command(long iterations){
+
+    long long start = now_ns();
+
+    for(long i = 0; i < iterations; i++)
+        lookup_command("sh");
+
+    report("lookup_command", iterations, now_ns() - start);
+}
+
+
+/*************************************write_script*****************************************
+*
+* Write a script repeating a command
+*
+* ARGUMENT :
+*   - mode : the launch mode (spawn or fork)
+*   - command : the command
+*   - count : the number of times the command is repeated
+*
+* RETURN : the path of the script (static buffer)
+*
+*******************************************************************************************/
+static const char* write_script(const char* mode, const char* command, long count){
+
+    static char path[] = "/tmp/shell_bench_scriptXXXXXX";
+    strcpy(path + strlen(path) - 6, "XXXXXX");
+
+    int fd = mkstemp(path);
+    FILE* file = fdopen(fd, "w");
+
+    fprintf(file, "launch %s\n", mode);
+    for(long i = 0; i < count; i++)
+        fprintf(file, "%s\n", command);
+
+    fclose(file);
+    return path;
+}
+
+
+//XDG_CACHE_HOME of the shells under test
+static char cache_dir[] = "/tmp/shell_bench_cacheXXXXXX";
+
+/*************************************cache_remove*****************************************
+*
+* Remove the cache directory of the compiled scripts used by the benchmarks (atexit)
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void cache_remove(void){
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/shell", cache_dir);
+
+    DIR* stream = opendir(path);
+    struct dirent* file;
+    while(stream != NULL && (file = readdir(stream)) != NULL)
+        if(strcmp(file->d_name, ".") && strcmp(file->d_name, ".."))
+            unlinkat(dirfd(stream), file->d_name, 0);
+    if(stream != NULL)
+        closedir(stream);
+
+    rmdir(path);
+    rmdir(cache_dir);
+}
+
+
+/*************************************bench_throughput*****************************************
+*
+* Run a script of N commands and measure the number of commands per second
+*
+* ARGUMENT :
+*   - shell : the path of the shell
+*   - mode : the launch mode (spawn or fork)
+*   - name : the name of the benchmark
+*   - command : the command
+*   - count : the number of commands
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_throughput(const char* shell, const char* mode, const char* name,
+                             const char* command, long count){
+
+    const char* script = write_script(mode, command, count);
+    char* argv[] = {(char*) shell, (char*) script, NULL};
+    pid_t pid;
+    int status;
+
+    //What the commands print would mix with the results
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    long long start = now_ns();
+
+    if(posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0){
+        perror("Shell couldn't be started");
+        posix_spawn_file_actions_destroy(&actions);
+        unlink(script);
+        return;
+    }
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    posix_spawn_file_actions_destroy(&actions);
+
+    long long elapsed = now_ns() - start;
+    unlink(script);
+
+    printf("{\"bench\":\"%s\",\"mode\":\"%s\",\"commands\":%ld,\"commands_per_sec\":%.0f}\n",
+           name, mode, count, count / (elapsed / 1e9));
+    fflush(stdout);
+}
+
+
+/*************************************compare_ll*****************************************
+*
+* Compare two long long for qsort
+*
+*******************************************************************************************/
+static int compare_ll(const void* a, const void* b){
+
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+
+/*************************************read_prompt*****************************************
+*
+* Read the output of the shell until its next prompt ("> ")
+*
+* ARGUMENT :
+*   - fd : the file descriptor of the output of the shell
+*
+* RETURN : true if a prompt was read, false if the shell ended
+*
+*******************************************************************************************/
+static bool read_prompt(int fd){
+
+    static char last = 0;
+    char buffer[4096];
+
+    while(true){
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if(n <= 0)
+            return false;
+
+        for(ssize_t k = 0; k < n; k++){
+            bool prompt = (last == '>' && buffer[k] == ' ');
+            last = buffer[k];
+            if(prompt && k == n - 1)
+                return true;
+        }
+    }
+}
+
+
+/*************************************bench_latency*****************************************
+*
+* Type N commands one by one at the prompt of the shell and measure the time until the
+* next prompt
+*
+* ARGUMENT :
+*   - shell : the path of the shell
+*   - mode : the launch mode (spawn or fork)
+*   - name : the name of the benchmark
+*   - command : the command
+*   - count : the number of commands
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void bench_latency(const char* shell, const char* mode, const char* name,
+                          const char* command, long count){
+
+    long long* latencies = malloc(count * sizeof(long long));
+    if(latencies == NULL){
+        perror("Latencies couldn't be allocated");
+        return;
+    }
+
+    int to_shell[2], from_shell[2];
+    if(pipe(to_shell) == -1){
+        perror("Pipe couldn't be created");
+        free(latencies);
+        return;
+    }
+    if(pipe(from_shell) == -1){
+        perror("Pipe couldn't be created");
+        close(to_shell[0]);
+        close(to_shell[1]);
+        free(latencies);
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_shell[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_shell[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, to_shell[1]);
+    posix_spawn_file_actions_addclose(&actions, from_shell[0]);
+
+    char* argv[] = {(char*) shell, NULL};
+    pid_t pid;
+
+    int error = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(to_shell[0]);
+    close(from_shell[1]);
+
+    if(error != 0){
+        fprintf(stderr, "Shell couldn't be started: %s\n", strerror(error));
+        close(to_shell[1]);
+        close(from_shell[0]);
+        free(latencies);
+        return;
+    }
+
+    //A shell that ended makes write fail instead of killing the benchmark (it was started
+    //with the default action)
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    char line[256];
+    size_t line_length = snprintf(line, sizeof(line), "%s\n", command);
+
+    //Prompt before the launch line, then after it
+    dprintf(to_shell[1], "launch %s\n", mode);
+    read_prompt(from_shell[0]);
+    read_prompt(from_shell[0]);
+
+    //Only the commands measured count : the shell may end early
+    long measured = 0;
+    for(; measured < count; measured++){
+
+        long long start = now_ns();
+
+        if(write(to_shell[1], line, line_length) == -1 || !read_prompt(from_shell[0]))
+            break;
+
+        latencies[measured] = now_ns() - start;
+    }
+
+    close(to_shell[1]);
+    close(from_shell[0]);
+    waitpid(pid, NULL, 0);
+    signal(SIGPIPE, sigpipe);
+
+    if(measured == 0){
+        fprintf(stderr, "%s (%s): the shell ended before the first command\n", name, mode);
+        free(latencies);
+        return;
+    }
+
+    qsort(latencies, measured, sizeof(long long), compare_ll);
+
+    printf("{\"bench\":\"%s\",\"mode\":\"%s\",\"commands\":%ld,\"p50_us\":%.1f,\"p99_us\":%.1f}\n",
+           name, mode, measured, latencies[measured / 2] / 1e3, latencies[(measured * 99) / 100] / 1e3);
+    fflush(stdout);
+    free(latencies);
+}
+
+
+int main(int argc, char** argv){
+
+    long count = 2000;
+    const char* shell = "./shell";
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            count = atol(argv[++i]);
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            shell = argv[++i];
+        else{
+            fprintf(stderr, "Usage: %s [-n N] [-s SHELL]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(count <= 0){
+        fprintf(stderr, "The number of iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    //The scripts compiled by the shells under test stay out of the user's cache
+    if(mkdtemp(cache_dir) == NULL || setenv("XDG_CACHE_HOME", cache_dir, 1) == -1){
+        perror("Cache directory couldn't be created");
+        return EXIT_FAILURE;
+    }
+    atexit(cache_remove);
+
+    bench_lex_line(count * 10);
+    bench_program_line(count * 10);
+    bench_variables(count * 50);
+    bench_cpu_index(count / 10 + 1);
+    bench_lookup_command(count * 500);
+
+    const char* modes[] = {"spawn", "fork"};
+
+    for(int m = 0; m < 2; m++){
+        //true is a built-in now, the path forces the external command
+        bench_throughput(shell, modes[m], "e2e_true", "/bin/true", count);
+        bench_throughput(shell, modes[m], "e2e_builtin", "cd .", count);
+        bench_throughput(shell, modes[m], "e2e_echo", "echo x", count);
+        bench_latency(shell, modes[m], "latency_true", "/bin/true", count);
+        bench_latency(shell, modes[m], "latency_builtin", "cd .", count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/******************************************************************************************
+*
+* Client of the server mode of the shell (shell --server PATH)
+*
+* Sends command lines to the server and prints what they write on stdout and stderr, as the
+* server streams it. The lines are read from stdin, or from COMMANDS with -c. The client
+* exits with the exit value of the last line.
+*
+* Build and run from the root of the repository :
+*   gcc -O2 -Wall -o client/client client/client.c
+*   client/client PATH [-c COMMANDS]
+*
+* Every frame is a 1 byte type, a 4 byte length (host order) and the payload :
+*   - C (client) : a command line
+*   - O, E (server) : output of the command on stdout, on stderr
+*   - X (server) : the exit value of the command line (int), once all its output was sent,
+*     or the last exit value in answer to exit, before the server closes the connection
+*******************************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FRAME_HEADER 5
+#define FRAME_MAX 65536
+
+static char frame[FRAME_MAX + FRAME_HEADER];
+
+
+/*************************************read_full*****************************************
+*
+* Read exactly length bytes from the server
+*
+* ARGUMENT :
+*   - fd : the socket
+*   - buffer : where to put the bytes
+*   - length : the number of bytes
+*
+* RETURN : true if successful, false if the connection ended
+*
+*******************************************************************************************/
+static bool read_full(int fd, char* buffer, size_t length){
+
+    while(length > 0){
+
+        ssize_t n = read(fd, buffer, length);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+
+        buffer += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+
+/*************************************write_full*****************************************
+*
+* Write exactly length bytes
+*
+* ARGUMENT :
+*   - fd : the file descriptor
+*   - buffer : the bytes
+*   - length : the number of bytes
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool write_full(int fd, const char* buffer, size_t length){
+
+    while(length > 0){
+
+        ssize_t n = write(fd, buffer, length);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+
+        buffer += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+
+/*************************************run_line*****************************************
+*
+* Send a command line and print its output until its exit value comes back
+*
+* ARGUMENT :
+*   - fd : the socket
+*   - line : the command line
+*   - length : its length
+*
+* RETURN : the exit value of the line, -1 if the connection ended
+*
+*******************************************************************************************/
+static int run_line(int fd, const char* line, size_t length){
+
+    if(length > FRAME_MAX){
+        fprintf(stderr, "Line too long\n");
+        return 1;
+    }
+
+    uint32_t frame_length = length;
+    frame[0] = 'C';
+    memcpy(frame + 1, &frame_length, 4);
+    memcpy(frame + FRAME_HEADER, line, length);
+
+    if(!write_full(fd, frame, FRAME_HEADER + length))
+        return -1;
+
+    while(read_full(fd, frame, FRAME_HEADER)){
+
+        char type = frame[0];
+        memcpy(&frame_length, frame + 1, 4);
+
+        if(frame_length > FRAME_MAX || !read_full(fd, frame, frame_length))
+            return -1;
+
+        if(type == 'O')
+            write_full(STDOUT_FILENO, frame, frame_length);
+        else if(type == 'E')
+            write_full(STDERR_FILENO, frame, frame_length);
+        else if(type == 'X' && frame_length == sizeof(int)){
+            int ret;
+            memcpy(&ret, frame, sizeof(int));
+            return ret;
+        }
+    }
+
+    return -1;
+}
+
+
+/******************************************main**********************************************/
+int main(int argc, char** argv){
+
+    if(argc != 2 && !(argc == 4 && !strcmp(argv[2], "-c"))){
+        fprintf(stderr, "Usage: %s PATH [-c COMMANDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(strlen(argv[1]) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Socket path too long : %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1){
+        perror("Couldn't connect to the server");
+        return EXIT_FAILURE;
+    }
+
+    FILE* input = argc == 4 ? fmemopen(argv[3], strlen(argv[3]), "r") : stdin;
+    if(input == NULL){
+        perror("Commands couldn't be read");
+        return EXIT_FAILURE;
+    }
+
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t length;
+    int ret = 0;
+
+    while((length = getline(&line, &len, input)) != -1){
+
+        if(length > 0 && line[length - 1] == '\n')
+            line[--length] = 0;
+
+        ret = run_line(fd, line, length);
+        if(ret == -1){
+            fprintf(stderr, "Connection to the server lost\n");
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        //The server acknowledged it and closes the connection
+        if(!strcmp(line, "exit"))
+            break;
+    }
+
+    free(line);
+    close(fd);
+    return ret;
+}
@@ -5,6 +5,7 @@
 * Operating systems : Projet 2 - shell with built-in's
 *******************************************************************************************/
 
+#define _GNU_SOURCE
 #include <sys/types.h> 
 #include <sys/wait.h>
 #include <stdlib.h>
@@ -15,777 +16,10786 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-
-#define IS_COMMAND 1
-#define IS_VARIABLE 0
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define STATS_BUCKETS 512
+#define ADDR_BATCH 64
+#define XARGS_ITEM_MAX (32 * 4096) //Longest argument execve accepts (MAX_ARG_STRLEN)
+#define MAX_REDIRECTIONS 16
+#define JOBS_DONE_KEPT 64 //Ended background jobs kept for wait and jobs (see job_forget)
+//Kinds of redirection
+#define REDIR_IN 0 //N< FILE
+#define REDIR_OUT 1 //N> FILE
+#define REDIR_APPEND 2 //N>> FILE
+#define REDIR_DUP 3 //N>&M, N<&M (N>&- closes N)
+#define REDIR_HERE 4 //<<< WORD
+//Frames of the server mode (see server_run)
+#define FRAME_HEADER 5
+#define FRAME_MAX 65536
+#define FRAME_COMMAND 'C'
+#define FRAME_STDOUT 'O'
+#define FRAME_STDERR 'E'
+#define FRAME_EXIT 'X'
+#define SESSION_OUT_MAX (1 << 20)
+#define SESSION_KILL_NS 2000000000LL //SIGKILL after SIGHUP for the lines of a client gone
+//History file (see history_open)
+#define HISTORY_HEADER 10 //"#LLLLLLLL "
+#define HISTORY_TAIL_MAX 8192 //Records not indexed before the index is rebuilt
+#define HISTORY_INDEX_CHUNK (1 << 23) //Pairs (trigram, record) sorted at once
+//Completion (see path_trie_build and history_complete)
+#define TRIE_MAX_DIRS 64 //Entries of $PATH indexed, one bit each
+#define COMPLETION_SHOWN 100 //Candidates listed at most
+//Instructions of the compiled scripts (see program_compile) : opcode in the low byte,
+//operand in the upper 24 bits, strings follow the instruction padded to 4 bytes
+#define PROGRAM_VERSION 2
+#define PROGRAM_CACHE_MAX (8 << 20) //Bytes of cache files kept, the least recently used go first
+#define PROGRAM_CACHE_TOUCH 86400 //Seconds before a cache file used again gets a new mtime
+#define OP_LINE 1 //Start of a line, operand : number of words of the line after this one
+#define OP_EXIT 2 //exit : stop the script
+#define OP_RAW 3 //Line run through lex_line, string : the line
+#define OP_LITERAL 4 //String : characters appended to the word
+#define OP_VARIABLE 5 //String : name of the variable appended to the word
+#define OP_SPECIAL 6 //Operand : '?', '!' or '$'
+#define OP_ASSIGNMENT 7 //Operand : position of the '=' if the word is the first one
+#define OP_WORD 8 //End of a word, operand : the word was quoted
+#define OP_REDIRECT 9 //Operand : type | fd << 4, then the source of REDIR_DUP
+#define OP_PIPE 10 //'|'
+#define OP_BACKGROUND 11 //'&'
+#define OP_BUILTIN 12 //Operand : index of the built-in of the first word + 1, 0 if none
+#define OP_GLOB 13 //Operand : '*', '?' or '[' appended to the word as a wildcard
+//Glob expansion (see lex_glob)
+#define GLOB_CHAR 0 //Kinds of token of a compiled pattern
+#define GLOB_ANY 1 //?
+#define GLOB_STAR 2 //*
+#define GLOB_CLASS 3 //[...]
+#define GLOB_BATCH (1 << 18) //Bytes of directory entries read at once
+#define GLOB_CACHE 8 //Directories whose listing is kept
+#define GLOB_CACHE_NS 1000000000LL //For at most 1s
+#define GLOB_RACY_NS 20000000LL //Not kept if changed less than 20ms ago
 /*************************************Prototypes*********************************************/
-int split_line(char* line, char** args);
-int get_paths(char** paths);
-void remove_delimiters(char** args,int type);
-bool find_in_file(const char* path, char* searched_str, char** output_str, int number);
-int manage_dollar(char** args, int prev_return, int prev_pid);
-int check_variable(char** args);
+struct command_line;
+struct fd_moves;
+int lex_line(const char* line, struct command_line* cmd, int prev_return, int prev_pid);
+int assign_variable(struct command_line* cmd);
+void run_command_line(struct command_line* cmd, int* prev_return, int* prev_pid);
+void* arena_alloc(size_t size);
+void arena_reset(void);
+char* var_get(const char* name);
+bool var_set(const char* name, const char* value);
+void var_unset(const char* name);
+const char* path_variable(void);
+int builtin_unset(char** args);
+unsigned long hash_string(const char* str);
+const char* lookup_command(const char* name);
+void cmd_hash_remove(const char* name);
+void cmd_hash_reset(void);
+void cmd_hash_check(const char* name);
+int builtin_hash(char** args);
+int launch_command(const char* path, char** args, const struct fd_moves* moves, pid_t* pid);
+void fd_moves_init(struct fd_moves* moves, int in_fd, int out_fd);
+bool fd_moves_open(struct fd_moves* moves, struct command_line* cmd, int stage);
+void fd_moves_close(struct fd_moves* moves);
+void fd_moves_apply(const struct fd_moves* moves);
+void fd_moves_save(const struct fd_moves* moves, int* saved);
+void fd_moves_restore(const struct fd_moves* moves, int* saved);
+int builtin_launch(char** args);
+int builtin_cd(char** args);
+int builtin_sys(char** args);
+int parse_cpu_list(const char* spec, bool* selected, int nb_cpus);
+void read_cpu_freqs(const bool* selected, double* mhz, int nb_cpus);
+int sys_cpu_freq_list(const char* spec);
+bool cpu_index_load(const char* path);
+bool cpu_index_read(int fd);
+bool proc_scan(char* text, size_t length, const char* const* keys, int nb_keys,
+               bool (*found)(int key, char* value, void* data), void* data);
+struct cpu_info* cpu_index_get(int processor);
+int sys_cpu_info(const char* spec);
+int sys_watch_cpu_freq(const char* spec, long long interval_ns);
+int sys_ip_addr(const char* dev);
+int sys_ip_addr_set(const char* dev, const char* address, const char* mask);
+int sys_ip_addr_batch(const char* path);
+int builtin_cat(char** args);
+int builtin_tee(char** args);
+int builtin_echo(char** args);
+int builtin_true(char** args);
+int builtin_false(char** args);
+int builtin_pwd(char** args);
+int builtin_test(char** args);
+int builtin_printf(char** args);
+int builtin_sleep(char** args);
+int forward_fd(int in, int out);
+int forward_file(const char* path);
+void run_pipeline(struct command_line* cmd, int* prev_return, int* prev_pid);
+char* join_args(char** args);
+void block_sigchld(bool block);
+struct job* job_create(int nb_stages, char* command, bool background);
+void job_remove(struct job* job);
+void job_forget(void);
+int job_wait(struct job* job);
+struct job* find_job(const char* spec);
+void notify_jobs(void);
+int builtin_jobs(char** args);
+int builtin_wait(char** args);
+int builtin_fg(char** args);
+int builtin_parallel(char** args);
+int builtin_xargs(char** args);
+long long now_ns(void);
+void stats_record(const char* name, long long wall_ns, long long launch_ns, const struct rusage* usage);
+int builtin_stats(char** args);
+void print_time(long long wall_ns, const struct rusage* usage);
+void print_failure(char* return_nb, int* prev_return);
+void print_success(int* prev_return);
+int server_run(const char* path);
+unsigned long hash_bytes(const void* data, size_t length);
+int program_script(const char* script, int* prev_return, int* prev_pid);
+int builtin_history(char** args);
 
 
 
 /****************************************Structures*****************************************/
+//Redirection of a command of a line
+struct redirection{
+    int stage; //Number of the command in the pipeline
+    int type; //REDIR_*
+    int fd; //Redirected file descriptor
+    char* word; //File or here-string, NULL for REDIR_DUP
+    int source; //File descriptor copied by REDIR_DUP, -1 to close
+};
+//Words of a line, as cut by lex_line (the arrays are in the line arena)
+struct command_line{
+    char** args; //Words of the commands, each command ending with NULL
+    int* stages; //Index in args of the first word of each command
+    int nb_stages; //Number of commands separated by '|'
+    int nb_args; //Number of words
+    bool background; //The line ended with '&'
+    bool timed; //The line started with time
+    int assignment; //Position of the '=' in args[0] for NAME=VALUE, -1 otherwise
+    struct redirection redirections[MAX_REDIRECTIONS];
+    int nb_redirections;
+    int builtin; //Built-in of args[0] found when compiling (see OP_BUILTIN), -1 if unknown
+};
+//File descriptors to set up before running a command : source[i] becomes fd[i]
+struct fd_moves{
+    int fd[MAX_REDIRECTIONS + 3];
+    int source[MAX_REDIRECTIONS + 3]; //-1 to close fd[i]
+    int nb_moves;
+    int opened[MAX_REDIRECTIONS]; //Files opened for the redirections, closed by the shell
+    int nb_opened;
+};
+//Header of the cache file of a compiled script, followed by the path of the script padded
+//to 4 bytes and the instructions
+struct program_header{
+    char magic[4]; //"SHC1"
+    uint32_t version; //PROGRAM_VERSION
+    uint64_t content_hash; //hash_bytes of the script
+    uint64_t builtins_hash; //The built-ins are referred to by index
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t path_length;
+    uint32_t code_length; //Number of words of 4 bytes
+};
+//Cache file kept by program_prune
+struct program_entry{
+    char name[32]; //HASH.shc
+    long long mtime_ns; //Last time it was written or used
+    off_t size;
+};
+//Buffer holding the words of the current line
+static char* lex_buffer = NULL;
+static size_t lex_length = 0;
+static size_t lex_capacity = 0;
+//Position of each word in the buffer while the line is cut, -1 for the end of a command
+static long* lex_offsets = NULL;
+static size_t lex_offsets_capacity = 0;
+//Position in the buffer of each wildcard of the word being built (see lex_glob)
+static long* lex_globs = NULL;
+static size_t lex_nb_globs = 0;
+static size_t lex_globs_capacity = 0;
+
+struct glob_token{
+    unsigned char type; //GLOB_CHAR, GLOB_ANY, GLOB_STAR or GLOB_CLASS
+    unsigned char c; //The character of GLOB_CHAR
+    uint32_t class[8]; //The characters of GLOB_CLASS (bit c)
+};
+//Component of a pattern, compiled (see glob_compile)
+struct glob_pattern{
+    struct glob_token* tokens;
+    int nb_tokens;
+    size_t min_length; //Characters matched by the tokens other than '*'
+    const char* prefix; //Characters before the first wildcard
+    size_t prefix_length;
+    const char* suffix; //Characters after the last '*' if there are only characters after it
+    size_t suffix_length;
+    bool dot; //Starts with '.', hidden files can match
+};
+struct glob_entry{
+    uint32_t name; //Offset of the name in the names of the listing
+    unsigned char length;
+    unsigned char type; //d_type
+};
+//Entries of a directory read by a glob, kept for the next ones (see glob_list)
+struct glob_listing{
+    long long time_ns; //Monotonic time of the reading, 0 if the slot is free
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    char* names;
+    size_t names_length;
+    size_t names_capacity;
+    struct glob_entry* entries;
+    size_t nb_entries;
+    size_t entries_capacity;
+};
+static struct glob_listing glob_cache[GLOB_CACHE];
+static int glob_cache_next = 0;
+//Paths matching the pattern being expanded, in the arena
+static char** glob_results = NULL;
+static size_t glob_nb_results = 0;
+static size_t glob_results_capacity = 0;
+
+//Bump allocator for the data of the current line, emptied when the next line is cut. The
+//chunks are kept from one line to the next : once they are large enough, cutting and
+//running a line doesn't allocate memory anymore.
+struct arena_chunk{
+    struct arena_chunk* next;
+    size_t capacity;
+    size_t used;
+    char data[] __attribute__((aligned(16)));
+};
+static struct arena_chunk* arena_first = NULL;
+static struct arena_chunk* arena_current = NULL;
+
+//Limit of the size of a line, and of its words and their pointers, like execve (ARG_MAX)
+static size_t arg_max = 0;
+
+//Compiled script being built or run (see program_compile)
+static bool lex_compiling = false; //lex_line emits instructions instead of expanding
+static uint32_t* program_code = NULL;
+static size_t program_length = 0; //Number of words of 4 bytes
+static size_t program_capacity = 0;
+static size_t program_first_word = 0; //Position of the first argument of the line
+static size_t program_literal = 0; //Position of the last OP_LITERAL
+
 struct variable{
-    char name[256];
-    char value[256];
+    char* name; //NULL if the slot is free
+    char* value;
+};
+//Open addressing table saving the shell variables
+static struct variable* var_table = NULL;
+static size_t var_capacity = 0;
+static size_t var_count = 0;
+
+struct command_entry{
+    char* name; //Name typed by the user, NULL if the slot is free
+    char* path; //Full path resolved through $PATH
+    unsigned int hits;
+};
+//Open addressing table caching the location of the commands (like bash's hash)
+static struct command_entry* cmd_table = NULL;
+static size_t cmd_capacity = 0;
+static size_t cmd_count = 0;
+//Copy of $PATH used to fill the table, the table is flushed when $PATH changes
+static char* cmd_path_env = NULL;
+
+struct trie_node{
+    int child; //First child, -1 if none
+    int sibling; //Next child of the same parent (sorted by character), -1 if none
+    uint64_t dirs; //Entries of $PATH holding an executable with this name (bit i : entry i)
+    unsigned char c;
+};
+//Prefix tree of the executables of $PATH, node 0 is the root. Built on the first completion,
+//then kept up to date by inotify instead of reading the directories again.
+static struct trie_node* trie_nodes = NULL;
+static int trie_nb_nodes = 0;
+static int trie_capacity = 0;
+static char** trie_dirs = NULL; //Indexed entries of $PATH
+static int* trie_wds = NULL; //Watch of each entry, -1 if it couldn't be watched
+static int trie_nb_dirs = 0;
+static char* trie_path_env = NULL; //$PATH the tree was built for, NULL if not built
+static bool trie_lookups = false; //Every entry is indexed, lookup_command can rely on the tree
+static int trie_inotify = -1;
+static pid_t trie_owner = 0; //Process reading the events, the forked children don't use the tree
+
+//Candidates of a completion, the names are in the arena
+struct completion{
+    char** names;
+    size_t count;
+    size_t capacity;
+};
+
+//Print the exit code after each command (always in interactive mode, on request otherwise)
+static bool show_status = true;
+
+//Interactive mode (prompt, job notifications)
+static bool interactive = true;
+
+//One command of a job
+struct job_stage{
+    pid_t pid; //0 once reaped
+    int status; //Exit value
+    char name[64]; //Name of the command, for stats
+    long long start_ns; //Monotonic time at which the shell started the command, 0 if it failed
+    long long launch_ns; //Time spent starting it (fork/spawn + exec)
+    long long end_ns; //Monotonic time at which it was reaped
+    struct rusage usage; //Resources used, returned by wait4
+};
+
+struct job{
+    int id; //Number shown to the user, index in the job table + 1
+    struct job_stage* stages; //Commands of the pipeline
+    int nb_stages;
+    int stages_capacity; //Size of stages, a job can be reused (see job_spare)
+    int nb_running; //Commands not reaped yet
+    pid_t last_pid; //Pid of the last command ($!)
+    bool background;
+    char* command; //Command line of a background job
+    unsigned long sequence; //Creation order, fg and find_job take the most recent job
+};
+//Command of parallel running in a stage of its job, the stages are reused
+struct parallel_slot{
+    char* argument; //NULL if the slot is free
+    long index; //Number of the argument, the output is printed in this order
+    int output; //Memory file receiving the output, -1 if it couldn't be created
+};
+//Information of a CPU, the strings point into the text of /proc/cpuinfo
+struct cpu_info{
+    int processor;
+    int physical_id; //Socket, -1 if unknown
+    int core_id; //-1 if unknown
+    double mhz;
+    const char* mhz_text; //Frequency as written in the file, NULL if unknown
+    const char* model; //NULL if unknown
+    const char* flags; //NULL if unknown
+};
+//Index of /proc/cpuinfo, shared by every sys cpu query and loaded again after its TTL
+static char* cpu_text = NULL;
+static size_t cpu_text_capacity = 0;
+static struct cpu_info* cpu_infos = NULL;
+static int nb_cpu_infos = 0;
+static int cpu_infos_capacity = 0;
+static long long cpu_index_time = 0; //Monotonic time of the last load, 0 if never loaded
+static long long cpu_index_ttl_ns = 1000000000LL;
+//Finds the ':' and '\n' of 64 bytes of text, the SIMD version the CPU supports, NULL if none
+//(see proc_scan)
+static void (*proc_classify)(const char* block, uint64_t* colons, uint64_t* newlines) = NULL;
+static bool proc_classify_ready = false;
+
+//Persistent rtnetlink socket for sys ip, and the interfaces of the last dump
+static int netlink_fd = -1;
+static unsigned int netlink_seq = 0;
+static char netlink_buffer[65536] __attribute__((aligned(NLMSG_ALIGNTO)));
+static char netlink_batch[ADDR_BATCH * 128] __attribute__((aligned(NLMSG_ALIGNTO)));
+struct link_name{
+    int index;
+    char name[IF_NAMESIZE];
+};
+static struct link_name* links = NULL;
+static int nb_links = 0;
+static int links_capacity = 0;
+//First IPv4 address of an interface (index != 0), or print every address (index == 0)
+struct addr_query{
+    int index;
+    bool found;
+    struct in_addr address;
+    int prefix;
+};
+//Address to set on an interface (sys ip addr DEV IP MASK and its batch form)
+struct addr_entry{
+    int line;
+    int index;
+    char dev[IF_NAMESIZE];
+    int family;
+    unsigned char address[16];
+    int prefix;
+    int error; //errno of the first failed request, 0 if none
+};
+
+//Latency histogram and resources used by the runs of a command
+struct command_stats{
+    char* name;
+    unsigned long count;
+    long long total_us;
+    long long max_us;
+    long long launch_us; //Time spent starting the command (fork/spawn + exec)
+    long long user_us;
+    long long system_us;
+    unsigned long buckets[STATS_BUCKETS]; //See stats_bucket
+};
+//Open addressing table of the statistics of each command name
+static struct command_stats** stats_table = NULL;
+static size_t stats_capacity = 0;
+static size_t stats_count = 0;
+
+//Job table, also modified by the SIGCHLD handler : only touched with SIGCHLD blocked
+static struct job** jobs = NULL;
+static int jobs_capacity = 0;
+//Last job removed, reused by the next one to create (most lines run one job at a time)
+static struct job* job_spare = NULL;
+
+//Index of the history file (see history_index_build), followed by the offsets of the
+//records, the trigrams and their postings
+struct history_index_header{
+    char magic[4]; //"SHI1"
+    uint32_t nb_trigrams;
+    uint64_t covered; //Bytes of the history file indexed
+    uint64_t covered_hash; //hash_bytes of the last bytes indexed (4096 at most)
+    uint64_t nb_records;
+    uint64_t postings_size;
+};
+//Records containing a trigram : gaps between their numbers, in varints
+struct history_trigram{
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t postings; //Offset in the postings
 };
-//Structure saving previous variables
-static struct variable var[256];
-static int count = 0;
+//History file shared by the interactive shells, mapped, and its index
+static char* history_path = NULL;
+static int history_fd = -1;
+static char* history_map = NULL;
+static size_t history_mapped = 0;
+static size_t history_scanned = 0; //Bytes of the file cut into records
+static char* history_index_map = NULL;
+static size_t history_index_size = 0;
+static const struct history_index_header* history_index = NULL; //NULL if no valid index
+static const uint64_t* history_indexed = NULL; //Offsets of the indexed records
+static const struct history_trigram* history_trigrams = NULL;
+static const unsigned char* history_postings = NULL;
+static uint64_t* history_tail = NULL; //Offsets of the records after the indexed part
+static size_t history_nb_tail = 0;
+static size_t history_tail_capacity = 0;
+
+extern char** environ;
+//Launch external commands with posix_spawn (vfork-like, no page table copy) or with fork
+static bool use_spawn = true;
+
+//Pipe a background command kept after its line ended, forwarded until it is closed
+struct session_stray{
+    int fd; //-1 once at end of file
+    char type; //FRAME_STDOUT or FRAME_STDERR
+    unsigned int watched;
+};
+//Client of the server mode, with its own variables
+struct session{
+    int fd; //Connection, -1 once closed
+    int cwd_fd; //Working directory
+    struct variable* var_table; //Variables, swapped with the shell's table to run a command
+    size_t var_capacity;
+    size_t var_count;
+    int prev_return; //$?
+    int prev_pid; //$!
+    char* in; //Bytes received and not handled yet
+    size_t in_length;
+    size_t in_capacity;
+    char* out; //Frames not sent yet
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    struct job* job; //Command line running, NULL if none
+    int stdout_fd; //Pipes of the running command, -1 once at end of file
+    int stderr_fd;
+    unsigned int fd_watched; //Events watched by epoll for each file descriptor
+    unsigned int stdout_watched;
+    unsigned int stderr_watched;
+    struct session_stray* strays;
+    int nb_strays;
+    int strays_capacity;
+    bool closing; //No more command line is read
+    bool gone; //The client can't be reached anymore
+    pid_t hangup_group; //Process group of the line sent SIGHUP, 0 if none or once empty
+    long long hangup_ns; //When it got SIGHUP
+};
+static struct session** sessions = NULL;
+static int nb_sessions = 0;
+static int sessions_capacity = 0;
+//Session of each file descriptor (connection or pipe)
+static struct session** server_fds = NULL;
+static int server_fds_capacity = 0;
+static int server_epoll = -1;
+static char server_frame[FRAME_MAX + 1];
 
 
-/*************************************split_line*****************************************
+/*************************************arena_alloc****************************************
 *
-* Split the line line entered by the user
+* Allocate memory for the current line, freed all at once by arena_reset
 *
 * ARGUMENT :
-*   - line : a string entered by the user as a line line
+*   - size : the number of bytes
 *
-* RETURN : an array of strings reprensenting each token entered by the user
+* RETURN : the memory (aligned on 16 bytes), NULL if it couldn't be allocated
 *
 *******************************************************************************************/
-int split_line(char* line, char** args){
+void* arena_alloc(size_t size){
 
-    int nb_args = 0;
-    char* token;
-    
-    token = strtok(line, "\n");
-    token = strtok(line, " ");
+    size = (size + 15) & ~(size_t) 15;
 
-    while(token != NULL){
+    while(arena_current == NULL || arena_current->used + size > arena_current->capacity){
 
-        args[nb_args] = token;
-        nb_args++;        
-        token = strtok(NULL, " ");
-    }
+        //Next chunk kept from a previous line
+        if(arena_current != NULL && arena_current->next != NULL){
+            arena_current = arena_current->next;
+            arena_current->used = 0;
+            continue;
+        }
+
+        size_t capacity = arena_current != NULL ? arena_current->capacity * 2 : 65536;
+        if(capacity < size)
+            capacity = size;
 
-    args[nb_args] = (char*) NULL;
+        struct arena_chunk* chunk = malloc(sizeof(struct arena_chunk) + capacity);
+        if(chunk == NULL){
+            perror("Line couldn't be allocated");
+            return NULL;
+        }
+
+        chunk->next = NULL;
+        chunk->capacity = capacity;
+        chunk->used = 0;
 
-    return nb_args;
+        if(arena_current != NULL)
+            arena_current->next = chunk;
+        else
+            arena_first = chunk;
+        arena_current = chunk;
+    }
 
+    void* memory = arena_current->data + arena_current->used;
+    arena_current->used += size;
+    return memory;
 }
 
 
-/*************************************get_paths****************************************
+/*************************************arena_reset****************************************
 *
-* Split the full path into all possible paths and get the number of total paths
+* Free everything allocated for the previous line, keeping the chunks
 *
-* ARGUMENT :
-*   - paths : an array that will contain all the paths
+* ARGUMENT : /
 *
-* RETURN : the number of paths
+* RETURN : /
 *
 *******************************************************************************************/
-int get_paths(char** paths) {
+void arena_reset(void){
+
+    arena_current = arena_first;
+    if(arena_current != NULL)
+        arena_current->used = 0;
+}
 
-    char* pathstring = getenv("PATH"); //get the $PATH environment variable
-    int nb_paths = 0;
 
-    char* path = strtok(pathstring,":"); //Parse the string for a path delimited by ":"
+/*************************************get_arg_max****************************************
+*
+* Get the maximal size of a line and of the arguments of a command (ARG_MAX)
+*
+* ARGUMENT : /
+*
+* RETURN : the size in bytes
+*
+*******************************************************************************************/
+static size_t get_arg_max(void){
 
-    while(path != NULL){
-        paths[nb_paths] = path;
-        nb_paths++;
-        path = strtok(NULL,":"); //Parse the array for the next path delimited by ":"
+    if(arg_max == 0){
+        long value = sysconf(_SC_ARG_MAX);
+        arg_max = value > 0 ? (size_t) value : 131072;
     }
 
-    return nb_paths;
+    return arg_max;
 }
 
 
 
-/*************************************remove_delimiters************************************
+/*************************************var_slot*****************************************
 *
-* Convert a string with special characters to a directory/folder with whitespaces
+* Find the slot of a variable in the variable table (linear probing)
 *
 * ARGUMENT :
-*   - args : an array containing all the args of the line  entered by the user
-*   - type : IS_COMMAND or IS_VARIABLE
-* RETURN : /
+*   - name : the name of the variable
 *
-* NB: it will clear all args except args[0] and args[1], the latter containing the concatenation
-*       of all the following arguments, without delimiters
+* RETURN : the index of the slot holding the variable, or of the free slot ending the probe
 *
 *******************************************************************************************/
-void remove_delimiters(char** args, int type){
+static size_t var_slot(const char* name){
 
-    //Start at 
-    int j=type;
+    size_t mask = var_capacity - 1;
+    size_t i = hash_string(name) & mask;
 
-    char path[256];
-    strcpy(path,"");
-    char* token;
-    char delimiters[] = "\"\'\\";
+    while(var_table[i].name != NULL && strcmp(var_table[i].name, name))
+        i = (i + 1) & mask;
 
-    while(args[j] != NULL){
+    return i;
+}
 
-        //Get the first token delimited by one of the delimiters
-        token = strtok(args[j], delimiters);
 
-        while(token != NULL){
-            //Add this token to the path
-            strcat(path, token);
-            //Get the next token
-            token = strtok(NULL, delimiters);
-        }
+/*************************************var_get*****************************************
+*
+* Get the value of a shell variable
+*
+* ARGUMENT :
+*   - name : the name of the variable
+*
+* RETURN : the value (owned by the table), NULL if the variable doesn't exist
+*
+*******************************************************************************************/
+char* var_get(const char* name){
 
-        //Add a whitespace
-        strcat(path, " ");
+    if(var_count == 0)
+        return NULL;
 
-        j++;
-    }
+    return var_table[var_slot(name)].value;
+}
 
-    //Removing the last whitespace
-    path[strlen(path)-1] = 0;
 
-    //Cleaning all arguments except cmd and directory (args[0] and args[1])
-    memset(&args[2], 0, sizeof(args)-2);
-    
-    //Copy the path to the unique argument of cd
-    //if(!strcmp(args[0],"cd")){
-        strcpy(args[1], path);
+/*************************************path_variable*****************************************
+*
+* Get the $PATH the commands are searched in : the shell variable once it has been
+* assigned (PATH=... in the shell or in a session of the server), else the environment
+*
+* ARGUMENT : /
+*
+* RETURN : the value of $PATH, NULL if there is none
+*
+*******************************************************************************************/
+const char* path_variable(void){
 
-    //}
-}
+    const char* path = var_get("PATH");
 
+    return path != NULL ? path : getenv("PATH");
+}
 
 
-/*************************************find_in_file*****************************************
+/*************************************var_set*****************************************
 *
-* Find a certain string in a file 
+* Create a shell variable or replace its value
 *
 * ARGUMENT :
-*   - path : the corresponding path of the file
-*   - searched_str : the searched string in the file
-*   - output_str : the corresponding output to the searched string
-*   - number : 
+*   - name : the name of the variable
+*   - value : its new value
 *
-* RETURN : true if the string has been found, false otherwise.
+* RETURN : true if successful, false otherwise
 *
 *******************************************************************************************/
-bool find_in_file(const char* path, char* searched_str, char** output_str, int number){
+bool var_set(const char* name, const char* value){
 
-    FILE* file;
-    char* line = NULL;
-    size_t len = 0;
-    bool result = false;
+    //Keep the load factor under 1/2
+    if((var_count + 1) * 2 > var_capacity){
 
-    //Opening the file
-    file = fopen(path, "r");
-    if(file == NULL){
-        perror("File couldn't be opened");
-        printf("1");
-        return false;
-    }
+        struct variable* old_table = var_table;
+        size_t old_capacity = var_capacity;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 64;
 
-    
-    while(getline(&line, &len, file) != -1){
+        struct variable* new_table = calloc(new_capacity, sizeof(struct variable));
+        if(new_table == NULL){
+            perror("Variable table couldn't be allocated");
+            return false;
+        }
 
-        if(!strcmp(searched_str, "hostname")){
-            *output_str = line;
-            fclose(file);
-            return true;
+        var_table = new_table;
+        var_capacity = new_capacity;
+
+        for(size_t i = 0; i < old_capacity; i++){
+            if(old_table[i].name != NULL)
+                var_table[var_slot(old_table[i].name)] = old_table[i];
         }
 
-        if(strstr(line, searched_str)){
+        free(old_table);
+    }
 
-            if(number != 0){
-                number--;
-                continue;
-            }
+    size_t i = var_slot(name);
+    size_t length = strlen(value);
 
-            *output_str = strtok(line,":");
-            *output_str = strtok(NULL, "");
-            memmove(*output_str, *output_str+1, strlen(*output_str)); //Remove the whitespace after :
-            result = true;
-            break;
-        }
+    //Replace the old value with the new, in place if it fits
+    if(var_table[i].name != NULL && length <= strlen(var_table[i].value)){
+        memmove(var_table[i].value, value, length + 1);
+        return true;
+    }
 
+    char* new_value = strdup(value);
+    if(new_value == NULL)
+        return false;
+
+    if(var_table[i].name != NULL){
+        free(var_table[i].value);
+        var_table[i].value = new_value;
+        return true;
     }
 
-    fclose(file);
+    //Create new variable if it doesn't already exist
+    char* new_name = strdup(name);
+    if(new_name == NULL){
+        free(new_value);
+        return false;
+    }
+
+    var_table[i].name = new_name;
+    var_table[i].value = new_value;
+    var_count++;
 
-    return result;
+    return true;
 }
 
 
-/*************************************check_variable*****************************************
+/*************************************var_unset*****************************************
 *
-* Check if one tries to assign a variable. If so, store it.
+* Remove a shell variable. Uses backward shift deletion so that no tombstone is left in
+* the table.
 *
 * ARGUMENT :
-*   - args : arguments entered as a command
-
+*   - name : the name of the variable
 *
-* RETURN : 1 if no assignement, 0 if assignement successfull, -1 if unsuccessful
+* RETURN : /
 *
 *******************************************************************************************/
-int check_variable(char** args){
+void var_unset(const char* name){
 
-    //Get a pointer starting at the '='
-    char* ptr = strchr(args[0],'=');
+    if(var_count == 0)
+        return;
 
-    //No variable assignement
-    if(ptr == NULL){
-        return 1; 
-    }
+    size_t mask = var_capacity - 1;
+    size_t i = var_slot(name);
 
-    //Checking that '=' is surrounded by something
-    if(ptr+1 != NULL && ptr-1 != NULL) {
-            
-            char* name;
-            char* value;
+    if(var_table[i].name == NULL)
+        return;
 
-            //Value is surrouned by quotes
-            if(args[1] != NULL){
-                remove_delimiters(args,IS_VARIABLE);
-                name = strtok(args[1],"=");
-            }else{
-                name = strtok(args[0],"=");
-            }
-            
-            //Extracting the name
-            value = strtok(NULL, "");
+    free(var_table[i].name);
+    free(var_table[i].value);
+    var_table[i].name = NULL;
+    var_table[i].value = NULL;
+    var_count--;
 
-            //Check if the variable alrady exists
-            for(int j=0;j < count;j++){
-                if(!strcmp(var[j].name,name)){
-                    //Replace the old value with the new
-                    strcpy(var[j].value,value);
-                    return 0;
-                }
-            }
-            
-            //Create new variable if it doesn't already exist
-            strcpy(var[count].name,name);
-            strcpy(var[count].value,value);
-            count++;
-            return 0;
-    }
+    //Move back the following entries of the cluster that would no longer be reachable
+    size_t j = i;
+    while(true){
+        j = (j + 1) & mask;
+        if(var_table[j].name == NULL)
+            break;
 
-    //Wrong syntax
-    return -1;
+        size_t home = hash_string(var_table[j].name) & mask;
+        //Entry j may stay only if its home slot lies cyclically in ]i, j]
+        bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if(!reachable){
+            var_table[i] = var_table[j];
+            var_table[j].name = NULL;
+            var_table[j].value = NULL;
+            i = j;
+        }
+    }
 }
 
 
-/*************************************manage_dollar*****************************************
+/*************************************builtin_unset*****************************************
 *
-* Replace the dollar terms ($? and $!) by their corresponding value, i.e. :
-*   - $? : Stores the exit value of the last command that was executed.
-*   - $! : Contains the process ID of the most recently executed background pipeline
+* The unset built-in : remove shell variables
 *
 * ARGUMENT :
-*   - args : an array containing all the args of the line  entered by the user
-*   - prev_return : the previous return value of the foreground command
-*   - prev_pid : the previous pid of the background pipeline
+*   - args : an array containing all the args of the line entered by the user
 *
-* RETURN : 0 if replaced a variable, -1 if it doesn't exist, 1 otherwise
+* RETURN : 0
 *
 *******************************************************************************************/
-int manage_dollar(char** args, int prev_return, int prev_pid){
+int builtin_unset(char** args){
 
-    //Check all the arguments and replace the dollar signs by their value
-    for(int i=0; args[i] != NULL; i++){
+    for(int i = 1; args[i] != NULL; i++)
+        var_unset(args[i]);
 
-        if(!strcmp(args[i], "$?")){
-            snprintf(args[i], 256, "%d", prev_return);
-            return 0;
-        }
+    return 0;
+}
 
-        else if(!strcmp(args[i], "$!")){
 
-            if(prev_pid != 0)
-                snprintf(args[i], 256, "%d", prev_pid);
-            else
-                args[i] = NULL;
-            return 0;
-        }
-        else{
-            int cnt = 0;
-            char buffer[256] = "";
-            int k = 0;
-            
-            //For all arguments
-            for(int j = 0; j < strlen(args[i]);j++){
-                //Check if any of them contain $
-                if(args[i][j] == '$'){
-
-                    j++; //Don't take $
-
-                    //Extract the following variable name
-                    while(j < strlen(args[i])) {
-                        buffer[k++] = args[i][j++]; 
-                    }
+/*************************************hash_string*****************************************
+*
+* Compute the FNV-1a hash of a string
+*
+* ARGUMENT :
+*   - str : the string to hash
+*
+* RETURN : the hash value
+*
+*******************************************************************************************/
+unsigned long hash_string(const char* str){
 
-                    //Removing '\"'
-                    char* ptr = strchr(buffer,'\"');
-                    if(ptr != NULL) 
-                        *ptr = 0;
-                    
-                    //Check if this name exists in the database
-                    while(!strcmp(var[cnt].name,"") == false){
-                        if((!strcmp(var[cnt].name,buffer)) == true){
-                            //Replace the argument with the stored variable
-                            args[i] = var[cnt].value; 
-                            return 0; //Exit the function
-                        }
-
-                        cnt++;
-                    }
-                    //Clean arguments
-                    memset(&args[i],0,sizeof(args[i]));
-                    //The variable doesn't exist
-                    return -1;
-                }
-            }
-        }
+    unsigned long hash = 14695981039346656037UL;
+
+    while(*str){
+        hash ^= (unsigned char) *str++;
+        hash *= 1099511628211UL;
     }
-    return 1;
+
+    return hash;
 }
 
 
-/*************************************print_failure*****************************************
+/*************************************hash_bytes*****************************************
 *
-* Change the value of the previous return value to 1 when there is an error, then print 1.
+* Compute the FNV-1a hash of a buffer
 *
 * ARGUMENT :
-*   - prev_return : the previous return value
-*   - return_nb : a string corresponding to the error value
+*   - data : the buffer
+*   - length : the number of bytes
 *
-* RETURN : /
+* RETURN : the hash value
 *
 *******************************************************************************************/
-void print_failure(char* return_nb, int* prev_return){
-    *prev_return = atoi(return_nb);
-    printf("%s", return_nb);
-}
+unsigned long hash_bytes(const void* data, size_t length){
 
+    const unsigned char* bytes = data;
+    unsigned long hash = 14695981039346656037UL;
 
+    for(size_t i = 0; i < length; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211UL;
+    }
 
+    return hash;
+}
 
-/******************************************main**********************************************/
-int main(int argc, char** argv){
 
-    bool stop = false;
-    int prev_return;
-    int prev_pid;
+/*************************************cmd_hash_slot*****************************************
+*
+* Find the slot of a command in the hash table (linear probing)
+*
+* ARGUMENT :
+*   - name : the name of the command
+*
+* RETURN : the index of the slot holding the command, or of the free slot ending the probe
+*
+*******************************************************************************************/
+static size_t cmd_hash_slot(const char* name){
 
-    char line[65536]; 
-    char* args[256];
-    
-    pid_t pid;
-    int status;
-    
-    char* output_str = NULL;
+    size_t mask = cmd_capacity - 1;
+    size_t i = hash_string(name) & mask;
 
-    while(!stop){
+    while(cmd_table[i].name != NULL && strcmp(cmd_table[i].name, name))
+        i = (i + 1) & mask;
 
-        //Clear the variables
-        strcpy(line,"");
-        memset(args, 0, sizeof(args));
+    return i;
+}
 
-        //Prompt
-        printf("> ");
-        fflush(stdout);
 
-        //User wants to quit (using Ctrl+D or exit())
-        if(fgets(line,sizeof(line),stdin) == NULL || !strcmp(line,"exit\n")){
-            stop = true;
-            break;
-        }
+/*************************************cmd_hash_grow*****************************************
+*
+* Double the capacity of the hash table and reinsert every command
+*
+* ARGUMENT : /
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool cmd_hash_grow(void){
 
-        //User presses "Enter"
-        if(!strcmp(line,"\n"))
-            continue;
+    struct command_entry* old_table = cmd_table;
+    size_t old_capacity = cmd_capacity;
+    size_t new_capacity = old_capacity ? old_capacity * 2 : 64;
 
-        //User enters a line 
-        int nb_args = split_line(line, args);
+    struct command_entry* new_table = calloc(new_capacity, sizeof(struct command_entry));
+    if(new_table == NULL){
+        perror("Hash table couldn't be allocated");
+        return false;
+    }
 
-        //Check if the user enters a variable
-        int result = check_variable(args);
-        //Syntax error during assignement
-        if(result == -1){
-            print_failure("1", &prev_return);
-            continue;
-        }//We stored a variable in our database
-        else if(result == 0){
-            printf("0");
-            continue;
-        }
+    cmd_table = new_table;
+    cmd_capacity = new_capacity;
 
+    for(size_t i = 0; i < old_capacity; i++){
+        if(old_table[i].name != NULL)
+            cmd_table[cmd_hash_slot(old_table[i].name)] = old_table[i];
+    }
 
-        //Replace $!, $? or $variable by the corresponding term
-        if(manage_dollar(args,prev_return, prev_pid) == -1){
-            print_failure("1", &prev_return);
-            continue;
-        }
+    free(old_table);
+    return true;
+}
 
-        
 
+/*************************************cmd_hash_reset*****************************************
+*
+* Forget every command stored in the hash table
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void cmd_hash_reset(void){
+
+    for(size_t i = 0; i < cmd_capacity; i++){
+        free(cmd_table[i].name);
+        free(cmd_table[i].path);
+        cmd_table[i].name = NULL;
+        cmd_table[i].path = NULL;
+        cmd_table[i].hits = 0;
+    }
 
-        //The command is cd
-        if(!strcmp(args[0], "cd")){
+    cmd_count = 0;
+}
 
-            // Case 1 : cd or cd ~
-            if(args[1] == NULL || !strcmp(args[1],"~"))
-                args[1] = getenv("HOME");
 
-            //Case 2 : cd ..
-            else if(!strcmp(args[1],"..")){
+/*************************************cmd_hash_remove*****************************************
+*
+* Forget one command (e.g. its binary disappeared). Uses backward shift deletion so that
+* no tombstone is left in the table.
+*
+* ARGUMENT :
+*   - name : the name of the command
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void cmd_hash_remove(const char* name){
 
-                char* new_dir = strrchr(args[1],'/');
+    if(cmd_count == 0)
+        return;
 
-                if(new_dir != NULL)
-                    *new_dir = '\0';
-            }
+    size_t mask = cmd_capacity - 1;
+    size_t i = cmd_hash_slot(name);
 
+    if(cmd_table[i].name == NULL)
+        return;
 
-            /*Case 3 :  cd FirstDir/"My directory"/DestDir
-                        cd FirstDir/'My directory'/DestDir
-                        cd FirstDir/My\ directory/DestDir
-            */
-            if(nb_args > 2){ //Means that there is/are (a) folder(s) with whitespace
+    free(cmd_table[i].name);
+    free(cmd_table[i].path);
+    cmd_table[i].name = NULL;
+    cmd_table[i].path = NULL;
+    cmd_count--;
 
-                remove_delimiters(args,IS_COMMAND);
-            }
+    //Move back the following entries of the cluster that would no longer be reachable
+    size_t j = i;
+    while(true){
+        j = (j + 1) & mask;
+        if(cmd_table[j].name == NULL)
+            break;
 
-            int ret = chdir(args[1]);
-            if(ret == -1)
-                print_failure("-1", &prev_return);
-            else
-                printf("%d",ret);
-            continue;
-        }      
+        size_t home = hash_string(cmd_table[j].name) & mask;
+        //Entry j may stay only if its home slot lies cyclically in ]i, j]
+        bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if(!reachable){
+            cmd_table[i] = cmd_table[j];
+            cmd_table[j].name = NULL;
+            cmd_table[j].path = NULL;
+            cmd_table[j].hits = 0;
+            i = j;
+        }
+    }
+}
 
 
-        //The command is sys
-        else if(!strcmp(args[0], "sys")){
+/*************************************cmd_hash_check*****************************************
+*
+* Forget a command if its remembered binary can no longer be executed
+*
+* ARGUMENT :
+*   - name : the name of the command
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void cmd_hash_check(const char* name){
 
+    if(cmd_count == 0)
+        return;
 
-            //Gives the hostname without using a system call
-            if ((args[1]!=NULL)&&(!strcmp(args[1], "hostname"))){
+    size_t i = cmd_hash_slot(name);
 
-                if(!find_in_file("/proc/sys/kernel/hostname", "hostname", &output_str, 0)){
-                    print_failure("1", &prev_return);
-                    continue;
-                }
+    if(cmd_table[i].name != NULL && access(cmd_table[i].path, X_OK) == -1)
+        cmd_hash_remove(name);
+}
 
-                printf("%s0", output_str);
-                continue;
 
-            }
+/*************************************path_trie_child*****************************************
+*
+* Find (or add) the child of a node of the tree of $PATH
+*
+* ARGUMENT :
+*   - node : the parent
+*   - c : the character of the child
+*   - create : add the child if it doesn't exist
+*
+* RETURN : the index of the child, -1 if it doesn't exist or couldn't be allocated
+*
+*******************************************************************************************/
+static int path_trie_child(int node, unsigned char c, bool create){
 
+    int previous = -1;
+    int child = trie_nodes[node].child;
 
-            //Gives the CPU model
-            if ((args[1]!=NULL)&&(args[2]!=NULL)&&
-                (!strcmp(args[1], "cpu"))&&(!strcmp(args[2], "model"))){
+    //The children are sorted, so that the completions come in order
+    while(child != -1 && trie_nodes[child].c < c){
+        previous = child;
+        child = trie_nodes[child].sibling;
+    }
 
-                if(!find_in_file("/proc/cpuinfo", "model name", &output_str, 0)){
-                    print_failure("1", &prev_return);
-                    continue;
-                }
+    if(child != -1 && trie_nodes[child].c == c)
+        return child;
+    if(!create)
+        return -1;
 
-                printf("%s0", output_str);
-                continue;
-            }
+    if(trie_nb_nodes == trie_capacity){
 
+        int new_capacity = trie_capacity ? trie_capacity * 2 : 1024;
+        struct trie_node* new_nodes = realloc(trie_nodes, new_capacity * sizeof(struct trie_node));
+        if(new_nodes == NULL)
+            return -1;
 
-            //Gives the CPU frequency of Nth processor
-            if ((args[1]!=NULL)&&(args[2]!=NULL)&&
-                (!strcmp(args[1], "cpu"))&&(!strcmp(args[2], "freq"))&&
-                (args[3]!= NULL)&&(args[4]==NULL)){
+        trie_nodes = new_nodes;
+        trie_capacity = new_capacity;
+    }
 
-                if(!find_in_file("/proc/cpuinfo", "cpu MHz", &output_str, atoi(args[3]))){
-                    print_failure("1", &prev_return);
-                    continue;
-                }
+    int added = trie_nb_nodes++;
+    trie_nodes[added].child = -1;
+    trie_nodes[added].sibling = child;
+    trie_nodes[added].dirs = 0;
+    trie_nodes[added].c = c;
 
-                printf("%s0", output_str);
-                continue;
+    if(previous == -1)
+        trie_nodes[node].child = added;
+    else
+        trie_nodes[previous].sibling = added;
 
-            }
+    return added;
+}
 
 
-            //Set the frequency of the CPU N to X (in HZ)
-            else if ((args[1]!=NULL)&&
-                    (args[2]!=NULL)&&
-                    (!strcmp(args[1], "cpu"))&&
-                    (!strcmp(args[2], "freq"))&&
-                    (args[3]!= NULL)&&
-                    (args[4]!=NULL)){
+/*************************************path_trie_find*****************************************
+*
+* Find the node of a name in the tree of $PATH
+*
+* ARGUMENT :
+*   - name : the name
+*   - length : the length of the name
+*
+* RETURN : the index of the node, -1 if no executable name starts like this
+*
+*******************************************************************************************/
+static int path_trie_find(const char* name, size_t length){
 
-                int number = atoi(args[3]);
-                char path[256];
-                
-                //Convert frequency from Hz to kHz
-                int frequency = atoi(args[4])/1000;
-                snprintf(path,256,"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_setspeed",number);
-                
-                FILE* file = fopen(path,"w");
-                if(file == NULL){
-                    perror("File couldn't be opened");
-                    print_failure("1", &prev_return);
-                    continue;
-                }
+    int node = 0;
+    for(size_t i = 0; i < length && node != -1; i++)
+        node = path_trie_child(node, name[i], false);
 
-                fprintf(file,"%d",frequency);
-                fclose(file);
+    return node;
+}
 
-                printf("0");
-                continue;
 
-            }
+/*************************************path_trie_check*****************************************
+*
+* Update the tree of $PATH for one file of an indexed entry
+*
+* ARGUMENT :
+*   - dir : the index of the entry of $PATH
+*   - name : the name of the file
+*   - type : its d_type, DT_UNKNOWN if not known
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void path_trie_check(int dir, const char* name, unsigned char type){
 
+    char path[PATH_MAX];
+    bool executable = false;
 
-            //Get the ip and mask of the interface DEV
-            else if ((args[1] != NULL)&&
-                    (args[2] != NULL)&&
-                    (!strcmp(args[1], "ip"))&&
-                    (!strcmp(args[2], "addr"))&&
-                    (args[3] != NULL)&&
-                    (args[4] == NULL)){
+    if(type != DT_DIR && snprintf(path, sizeof(path), "%s/%s", trie_dirs[dir], name) < (int) sizeof(path)){
 
-                    char* dev = args[3];
+        //Like execve, only regular files (a symbolic link is followed)
+        struct stat st;
+        executable = (type == DT_REG || (stat(path, &st) == 0 && S_ISREG(st.st_mode))) &&
+                     access(path, X_OK) == 0;
+    }
 
-                    // Create a socket in UDP mode
-                    int socket_desc = socket(AF_INET, SOCK_DGRAM, 0);
-     
-                    //If socket couldn't be created
-                    if (socket_desc == -1){
-                        perror("Socket couldn't be created\n");
-                        print_failure("1", &prev_return);
-                        continue;
-                    }
+    int node = 0;
+    for(const char* c = name; *c != 0 && node != -1; c++)
+        node = path_trie_child(node, *c, executable);
 
-                    //Creating an interface structure
-                    struct ifreq my_ifreq; 
-                    //IPv4
-                    my_ifreq.ifr_addr.sa_family = AF_INET;
+    if(node == -1)
+        return;
 
-                    size_t length_if_name= strlen(dev);
-                    //Check that the ifr_name is big enough
-                    if (length_if_name < IFNAMSIZ){ 
+    if(executable)
+        trie_nodes[node].dirs |= 1ULL << dir;
+    else
+        trie_nodes[node].dirs &= ~(1ULL << dir);
+}
 
-                        memcpy(my_ifreq.ifr_name,dev,length_if_name);
-                        my_ifreq.ifr_name[length_if_name]=0; //End the name with terminating char
-                    }
-                    else{
-                        perror("The interface name is too long");
-                        print_failure("1", &prev_return);
-                        continue;
-                    }
 
-                    // Get the IP address, if successful, adress is in  my_ifreq.ifr_addr
-                    if(ioctl(socket_desc,SIOCGIFADDR,&my_ifreq) == -1){
+/*************************************path_trie_free*****************************************
+*
+* Forget the tree of $PATH and stop watching the directories
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void path_trie_free(void){
+
+    //The descriptor is shared with the parent in a forked child, only the owner closes it
+    if(trie_inotify != -1 && trie_owner == getpid())
+        close(trie_inotify);
+    trie_inotify = -1;
+
+    for(int i = 0; i < trie_nb_dirs; i++)
+        free(trie_dirs[i]);
+    free(trie_dirs);
+    free(trie_wds);
+    free(trie_nodes);
+    free(trie_path_env);
+
+    trie_dirs = NULL;
+    trie_wds = NULL;
+    trie_nb_dirs = 0;
+    trie_nodes = NULL;
+    trie_nb_nodes = 0;
+    trie_capacity = 0;
+    trie_path_env = NULL;
+    trie_lookups = false;
+}
+
+
+/*************************************path_trie_update*****************************************
+*
+* Apply the changes of the directories of $PATH reported by inotify since the last call.
+* The tree is built again if events were lost or a directory was removed or moved.
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void path_trie_build(void);
+static void path_trie_update(void){
+
+    if(trie_path_env == NULL || trie_owner != getpid())
+        return;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool rebuild = false;
+    ssize_t n;
+
+    while((n = read(trie_inotify, buffer, sizeof(buffer))) > 0){
+
+        for(char* p = buffer; p < buffer + n; ){
+
+            struct inotify_event* event = (struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+                rebuild = true;
+                continue;
+            }
+            if(event->len == 0)
+                continue;
+
+            //The table may remember another entry of $PATH for this name
+            cmd_hash_remove(event->name);
+
+            //The same directory may appear several times in $PATH
+            for(int i = 0; i < trie_nb_dirs; i++){
+                if(trie_wds[i] == event->wd)
+                    path_trie_check(i, event->name, DT_UNKNOWN);
+            }
+        }
+    }
+
+    if(rebuild){
+        path_trie_free();
+        path_trie_build();
+    }
+}
+
+
+/*************************************path_trie_build*****************************************
+*
+* Make sure the tree of the executables of $PATH is built for the current $PATH and up to
+* date. The directories are read only when the tree is built : they are watched with
+* inotify from then on. Relative entries are not indexed, they depend on the directory :
+* with one of them, or an entry that couldn't be watched or read, the tree only serves the
+* completion and lookup_command walks $PATH.
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void path_trie_build(void){
+
+    const char* env = path_variable();
+
+    if(trie_path_env != NULL && trie_owner == getpid() && env != NULL && !strcmp(env, trie_path_env)){
+        path_trie_update();
+        return;
+    }
+
+    path_trie_free();
+    if(env == NULL)
+        return;
+
+    trie_owner = getpid();
+    trie_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    trie_path_env = strdup(env);
+    trie_dirs = malloc(TRIE_MAX_DIRS * sizeof(char*));
+    trie_wds = malloc(TRIE_MAX_DIRS * sizeof(int));
+    trie_lookups = true;
+
+    //The root
+    trie_nb_nodes = 0;
+    trie_capacity = 1024;
+    trie_nodes = malloc(trie_capacity * sizeof(struct trie_node));
+
+    if(trie_inotify == -1 || trie_path_env == NULL || trie_dirs == NULL || trie_wds == NULL || trie_nodes == NULL){
+        perror("Completion of the commands unavailable");
+        path_trie_free();
+        return;
+    }
+
+    trie_nodes[0].child = -1;
+    trie_nodes[0].sibling = -1;
+    trie_nodes[0].dirs = 0;
+    trie_nodes[0].c = 0;
+    trie_nb_nodes = 1;
+
+    for(const char* entry = env; *entry != 0; ){
+
+        const char* end = strchrnul(entry, ':');
+        size_t entry_length = end - entry;
+
+        if(entry_length > 0 && (entry[0] != '/' || trie_nb_dirs == TRIE_MAX_DIRS))
+            trie_lookups = false;
+
+        else if(entry_length > 0 && (trie_dirs[trie_nb_dirs] = strndup(entry, entry_length)) != NULL){
+
+            int dir = trie_nb_dirs++;
+
+            //Watched first : nothing added while reading it is missed
+            trie_wds[dir] = inotify_add_watch(trie_inotify, trie_dirs[dir], IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+
+            DIR* stream = trie_wds[dir] != -1 ? opendir(trie_dirs[dir]) : NULL;
+
+            //Not followed (e.g. it doesn't exist yet) : it could hold an earlier match later
+            if(stream == NULL)
+                trie_lookups = false;
+
+            struct dirent* file;
+            while(stream != NULL && (file = readdir(stream)) != NULL)
+                path_trie_check(dir, file->d_name, file->d_type);
+            if(stream != NULL)
+                closedir(stream);
+        }
+
+        entry = *end == ':' ? end + 1 : end;
+    }
+}
+
+
+/*************************************path_trie_lookup*****************************************
+*
+* Find a command in the tree of $PATH, if it is built
+*
+* ARGUMENT :
+*   - name : the name of the command
+*   - path : receives the full path of the command (to be freed), NULL if it wasn't found
+*
+* RETURN : true if the tree found it, false if $PATH must be walked
+*
+*******************************************************************************************/
+static bool path_trie_lookup(const char* name, char** path){
+
+    *path = NULL;
+    if(trie_path_env == NULL || trie_owner != getpid())
+        return false;
+
+    //Built again on the next completion
+    const char* env = path_variable();
+    if(env == NULL || strcmp(env, trie_path_env)){
+        path_trie_free();
+        return false;
+    }
+
+    path_trie_update();
+    if(!trie_lookups)
+        return false;
+
+    //Not found : $PATH is walked anyway, a directory missing when the tree was built may
+    //have appeared since
+    int node = path_trie_find(name, strlen(name));
+    if(node == -1 || trie_nodes[node].dirs == 0)
+        return false;
+
+    //The first entry of $PATH holding it : every entry is followed, so it is the one a walk
+    //of $PATH would find
+    const char* dir = trie_dirs[__builtin_ctzll(trie_nodes[node].dirs)];
+    if(asprintf(path, "%s/%s", dir, name) == -1)
+        *path = NULL;
+
+    return true;
+}
+
+
+/*************************************resolve_command*****************************************
+*
+* Walk every directory of $PATH to find an executable called name
+*
+* ARGUMENT :
+*   - name : the name of the command
+*
+* RETURN : the full path of the command (to be freed), NULL if it wasn't found
+*
+*******************************************************************************************/
+static char* resolve_command(const char* name){
+
+    const char* env = path_variable();
+    if(env == NULL)
+        return NULL;
+
+    //Room for the longest directory of $PATH followed by the name
+    size_t name_len = strlen(name);
+    char* path = arena_alloc(strlen(env) + name_len + 2);
+    if(path == NULL)
+        return NULL;
+
+    for(const char* dir = env; *dir != 0; ){
+
+        const char* end = strchrnul(dir, ':');
+        size_t dir_len = end - dir;
+
+        //Empty entries are skipped
+        if(dir_len > 0){
+
+            memcpy(path, dir, dir_len);
+            path[dir_len] = '/';
+            memcpy(path + dir_len + 1, name, name_len + 1);
+
+            //Check if path contains the command to execute
+            if(access(path, X_OK) == 0)
+                return strdup(path);
+        }
+
+        dir = *end == ':' ? end + 1 : end;
+    }
+
+    return NULL;
+}
+
+
+/*************************************lookup_command*****************************************
+*
+* Get the full path of a command, walking $PATH only the first time the command is used.
+* The table is flushed whenever $PATH (see path_variable) differs from the one it was
+* filled with.
+*
+* ARGUMENT :
+*   - name : the name of the command (without any '/')
+*
+* RETURN : the full path of the command (owned by the table), NULL if it wasn't found
+*
+*******************************************************************************************/
+const char* lookup_command(const char* name){
+
+    const char* env = path_variable();
+
+    //$PATH changed since the table was filled
+    if(cmd_path_env == NULL || env == NULL || strcmp(cmd_path_env, env)){
+        cmd_hash_reset();
+        free(cmd_path_env);
+        cmd_path_env = strdup(env ? env : "");
+    }
+
+    if(cmd_capacity != 0){
+        size_t i = cmd_hash_slot(name);
+        if(cmd_table[i].name != NULL){
+            cmd_table[i].hits++;
+            return cmd_table[i].path;
+        }
+    }
+
+    //The tree of $PATH knows it once a completion built it
+    char* path;
+    if(!path_trie_lookup(name, &path))
+        path = resolve_command(name);
+    if(path == NULL)
+        return NULL;
+
+    //Keep the load factor under 1/2
+    if((cmd_count + 1) * 2 > cmd_capacity && !cmd_hash_grow()){
+        free(path);
+        return NULL;
+    }
+
+    char* key = strdup(name);
+    if(key == NULL){
+        free(path);
+        return NULL;
+    }
+
+    size_t i = cmd_hash_slot(name);
+    cmd_table[i].name = key;
+    cmd_table[i].path = path;
+    cmd_table[i].hits = 1;
+    cmd_count++;
+
+    return path;
+}
+
+
+/*************************************builtin_hash*****************************************
+*
+* The hash built-in :
+*   - hash : list the remembered commands
+*   - hash -r : forget every command
+*   - hash -d NAME... : forget the given commands
+*   - hash NAME... : look the given commands up and remember them
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_hash(char** args){
+
+    //List the table
+    if(args[1] == NULL){
+
+        if(cmd_count == 0){
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+
+        printf("hits\tcommand\n");
+        for(size_t i = 0; i < cmd_capacity; i++){
+            if(cmd_table[i].name != NULL)
+                printf("%4u\t%s\n", cmd_table[i].hits, cmd_table[i].path);
+        }
+        return 0;
+    }
+
+    if(!strcmp(args[1], "-r")){
+        cmd_hash_reset();
+        return 0;
+    }
+
+    if(!strcmp(args[1], "-d")){
+        for(int i = 2; args[i] != NULL; i++)
+            cmd_hash_remove(args[i]);
+        return 0;
+    }
+
+    //Pre-warm the table
+    int ret = 0;
+    for(int i = 1; args[i] != NULL; i++){
+
+        if(strchr(args[i], '/') != NULL)
+            continue;
+
+        //Search $PATH again even if the command is already known
+        cmd_hash_remove(args[i]);
+
+        if(lookup_command(args[i]) == NULL){
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            ret = 1;
+            continue;
+        }
+
+        //A pre-warm is not a use of the command
+        cmd_table[cmd_hash_slot(args[i])].hits = 0;
+    }
+
+    return ret;
+}
+
+
+/*************************************fd_moves_init*****************************************
+*
+* Start the file descriptor moves of a command with its pipes
+*
+* ARGUMENT :
+*   - moves : the moves to fill
+*   - in_fd : the file descriptor to use as standard input, -1 to keep the shell's one
+*   - out_fd : the file descriptor to use as standard output, -1 to keep the shell's one
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void fd_moves_init(struct fd_moves* moves, int in_fd, int out_fd){
+
+    moves->nb_moves = 0;
+    moves->nb_opened = 0;
+
+    if(in_fd != -1){
+        moves->fd[moves->nb_moves] = STDIN_FILENO;
+        moves->source[moves->nb_moves++] = in_fd;
+    }
+    if(out_fd != -1){
+        moves->fd[moves->nb_moves] = STDOUT_FILENO;
+        moves->source[moves->nb_moves++] = out_fd;
+    }
+}
+
+
+/*************************************fd_moves_open*****************************************
+*
+* Open the files of the redirections of a command and add the moves they need, in the
+* order of the line (2>&1 > f and > f 2>&1 differ like in sh). The files are opened with
+* O_CLOEXEC, the shell closes them once the command started.
+*
+* ARGUMENT :
+*   - moves : the moves to complete
+*   - cmd : the command line
+*   - stage : the number of the command in the pipeline
+*
+* RETURN : true if successful, false otherwise (the error is printed, nothing stays open)
+*
+*******************************************************************************************/
+bool fd_moves_open(struct fd_moves* moves, struct command_line* cmd, int stage){
+
+    for(int i = 0; i < cmd->nb_redirections; i++){
+
+        struct redirection* redirection = &cmd->redirections[i];
+        if(redirection->stage != stage)
+            continue;
+
+        int source = redirection->source;
+
+        if(redirection->type == REDIR_HERE){
+
+            //The here-string is read from a memory file, with a newline added like in bash
+            source = memfd_create("here-string", MFD_CLOEXEC);
+            size_t length = strlen(redirection->word);
+            if(source == -1 || write(source, redirection->word, length) != (ssize_t)length ||
+               write(source, "\n", 1) != 1 || lseek(source, 0, SEEK_SET) == -1){
+                perror("Here-string couldn't be created");
+                if(source != -1)
+                    close(source);
+                fd_moves_close(moves);
+                return false;
+            }
+        }
+        else if(redirection->type != REDIR_DUP){
+
+            int flags = O_CLOEXEC;
+            if(redirection->type == REDIR_IN)
+                flags |= O_RDONLY;
+            else if(redirection->type == REDIR_OUT)
+                flags |= O_WRONLY | O_CREAT | O_TRUNC;
+            else
+                flags |= O_WRONLY | O_CREAT | O_APPEND;
+
+            source = open(redirection->word, flags, 0666);
+            if(source == -1){
+                fprintf(stderr, "%s: %s\n", redirection->word, strerror(errno));
+                fd_moves_close(moves);
+                return false;
+            }
+        }
+
+        if(source != redirection->source)
+            moves->opened[moves->nb_opened++] = source;
+
+        moves->fd[moves->nb_moves] = redirection->fd;
+        moves->source[moves->nb_moves++] = source;
+    }
+
+    return true;
+}
+
+
+/*************************************fd_moves_close*****************************************
+*
+* Close the files opened for the redirections of a command
+*
+* ARGUMENT :
+*   - moves : the moves
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void fd_moves_close(struct fd_moves* moves){
+
+    for(int i = 0; i < moves->nb_opened; i++)
+        close(moves->opened[i]);
+    moves->nb_opened = 0;
+}
+
+
+/*************************************fd_moves_apply*****************************************
+*
+* Do the moves of a command in the process that runs it (forked son)
+*
+* ARGUMENT :
+*   - moves : the moves
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void fd_moves_apply(const struct fd_moves* moves){
+
+    for(int i = 0; i < moves->nb_moves; i++){
+
+        if(moves->source[i] == -1)
+            close(moves->fd[i]);
+        //dup2 does nothing in this case, the file descriptor must survive exec anyway
+        else if(moves->source[i] == moves->fd[i])
+            fcntl(moves->fd[i], F_SETFD, 0);
+        else
+            dup2(moves->source[i], moves->fd[i]);
+    }
+}
+
+
+/*************************************fd_moves_save*****************************************
+*
+* Do the moves of a built-in run by the shell itself, after saving the file descriptors
+* they replace. fd_moves_restore puts them back.
+*
+* ARGUMENT :
+*   - moves : the moves
+*   - saved : receives a copy of each replaced file descriptor, -1 if it was closed
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void fd_moves_save(const struct fd_moves* moves, int* saved){
+
+    //What the shell printed goes where it was meant to
+    fflush(stdout);
+    fflush(stderr);
+
+    for(int i = 0; i < moves->nb_moves; i++)
+        saved[i] = fcntl(moves->fd[i], F_DUPFD_CLOEXEC, 10);
+
+    fd_moves_apply(moves);
+}
+
+
+/*************************************fd_moves_restore*****************************************
+*
+* Put back the file descriptors of the shell after a built-in (see fd_moves_save)
+*
+* ARGUMENT :
+*   - moves : the moves
+*   - saved : the copies made by fd_moves_save
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void fd_moves_restore(const struct fd_moves* moves, int* saved){
+
+    fflush(stdout);
+    fflush(stderr);
+
+    //In reverse order, a file descriptor moved twice gets its first copy back
+    for(int i = moves->nb_moves - 1; i >= 0; i--){
+
+        if(saved[i] == -1)
+            close(moves->fd[i]);
+        else{
+            dup2(saved[i], moves->fd[i]);
+            close(saved[i]);
+        }
+    }
+}
+
+
+/*************************************launch_command*****************************************
+*
+* Start an external command. The child has nothing to do before exec, so posix_spawn
+* is used by default : it shares the memory of the shell until exec instead of copying
+* its page tables. The fork path is kept for comparison (see the launch built-in) : like
+* posix_spawn, it reports a failed exec through a pipe closed on exec.
+*
+* ARGUMENT :
+*   - path : the full path of the command
+*   - args : the arguments of the command, args[0] being its name
+*   - moves : the file descriptors to set up in the child (pipes and redirections)
+*   - pid : will contain the pid of the child
+*
+* RETURN : 0 if successful, the error number otherwise (ENOENT if the binary is gone)
+*
+*******************************************************************************************/
+int launch_command(const char* path, char** args, const struct fd_moves* moves, pid_t* pid){
+
+    if(use_spawn){
+
+        //SIGCHLD is blocked while the shell starts a job, not in the command
+        posix_spawnattr_t attributes;
+        sigset_t mask;
+        posix_spawnattr_init(&attributes);
+        sigprocmask(SIG_SETMASK, NULL, &mask);
+        sigdelset(&mask, SIGCHLD);
+        posix_spawnattr_setsigmask(&attributes, &mask);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        for(int i = 0; i < moves->nb_moves; i++){
+            if(moves->source[i] == -1)
+                posix_spawn_file_actions_addclose(&actions, moves->fd[i]);
+            else
+                posix_spawn_file_actions_adddup2(&actions, moves->source[i], moves->fd[i]);
+        }
+
+        int ret = posix_spawn(pid, path, &actions, &attributes, args, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        return ret;
+    }
+
+    int error_pipe[2];
+    if(pipe2(error_pipe, O_CLOEXEC) == -1)
+        return errno;
+
+    *pid = fork();
+
+    //Error
+    if(*pid < 0){
+        perror("Process creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    //This is the son
+    if(*pid == 0){
+
+        //SIGCHLD is blocked while the shell starts a job
+        block_sigchld(false);
+
+        close(error_pipe[0]);
+        fd_moves_apply(moves);
+
+        execv(path, args);
+
+        //The father reports it
+        int exec_errno = errno;
+        if(write(error_pipe[1], &exec_errno, sizeof(int)) == -1)
+            perror("Instruction failed");
+        _exit(127);
+    }
+
+    //Nothing to read once the exec closed the pipe
+    close(error_pipe[1]);
+
+    int exec_errno;
+    ssize_t n;
+    while((n = read(error_pipe[0], &exec_errno, sizeof(int))) == -1 && errno == EINTR);
+    close(error_pipe[0]);
+
+    if(n != sizeof(int))
+        return 0;
+
+    while(waitpid(*pid, NULL, 0) == -1 && errno == EINTR);
+    return exec_errno;
+}
+
+
+/*************************************builtin_launch*****************************************
+*
+* The launch built-in, selecting how external commands are started :
+*   - launch : print the current mode
+*   - launch spawn : use posix_spawn
+*   - launch fork : use fork + execv
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_launch(char** args){
+
+    if(args[1] == NULL){
+        printf("%s\n", use_spawn ? "spawn" : "fork");
+        return 0;
+    }
+
+    if(args[2] != NULL)
+        return 1;
+
+    if(!strcmp(args[1], "spawn"))
+        use_spawn = true;
+    else if(!strcmp(args[1], "fork"))
+        use_spawn = false;
+    else
+        return 1;
+
+    return 0;
+}
+
+
+/*************************************builtin_cd*****************************************
+*
+* The cd built-in : change the current directory
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, -1 otherwise
+*
+*******************************************************************************************/
+int builtin_cd(char** args){
+
+    int nb_args = 0;
+    while(args[nb_args] != NULL)
+        nb_args++;
+
+    // Case 1 : cd or cd ~
+    if(args[1] == NULL || !strcmp(args[1],"~"))
+        args[1] = getenv("HOME");
+
+    //Case 2 : cd ..
+    else if(!strcmp(args[1],"..")){
+
+        char* new_dir = strrchr(args[1],'/');
+
+        if(new_dir != NULL)
+            *new_dir = '\0';
+    }
+
+
+    /*Case 3 :  cd FirstDir/"My directory"/DestDir
+                cd FirstDir/'My directory'/DestDir
+                cd FirstDir/My\ directory/DestDir
+      are already a single word, more than one directory is an error
+    */
+    if(nb_args > 2){
+        fprintf(stderr, "cd: too many arguments\n");
+        return -1;
+    }
+
+    return chdir(args[1]);
+}
+
+
+/*************************************parse_cpu_list*****************************************
+*
+* Parse a list of CPUs : "all", "N", "A-B" or a comma separated list of them ("0-3,8")
+*
+* ARGUMENT :
+*   - spec : the list
+*   - selected : will contain true for each CPU of the list
+*   - nb_cpus : the number of CPUs of the machine
+*
+* RETURN : the number of CPUs selected, -1 if the list is invalid
+*
+*******************************************************************************************/
+int parse_cpu_list(const char* spec, bool* selected, int nb_cpus){
+
+    memset(selected, 0, nb_cpus * sizeof(bool));
+
+    if(!strcmp(spec, "all")){
+        for(int cpu = 0; cpu < nb_cpus; cpu++)
+            selected[cpu] = true;
+        return nb_cpus;
+    }
+
+    int count = 0;
+    const char* ptr = spec;
+
+    while(*ptr){
+
+        char* end;
+        long first = strtol(ptr, &end, 10);
+        long last = first;
+        if(end == ptr)
+            return -1;
+
+        if(*end == '-'){
+            ptr = end + 1;
+            last = strtol(ptr, &end, 10);
+            if(end == ptr)
+                return -1;
+        }
+
+        if(first < 0 || last < first || last >= nb_cpus){
+            fprintf(stderr, "CPU %ld-%ld out of range (0-%d)\n", first, last, nb_cpus - 1);
+            return -1;
+        }
+
+        for(long cpu = first; cpu <= last; cpu++){
+            if(!selected[cpu])
+                count++;
+            selected[cpu] = true;
+        }
+
+        if(*end == ',')
+            end++;
+        else if(*end != 0)
+            return -1;
+        ptr = end;
+    }
+
+    return count;
+}
+
+
+/*************************************read_cpu_freqs*****************************************
+*
+* Read the current frequency of the selected CPUs in one pass. The scaling_cur_freq files
+* of cpufreq are opened the first time and kept open, each one is then read with a single
+* pread. CPUs without cpufreq (e.g. virtual machines) get the "cpu MHz" of the index of
+* /proc/cpuinfo.
+*
+* ARGUMENT :
+*   - selected : true for each CPU to read
+*   - mhz : will contain the frequency of each selected CPU in MHz, -1 if unknown
+*   - nb_cpus : the number of CPUs of the machine
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void read_cpu_freqs(const bool* selected, double* mhz, int nb_cpus){
+
+    //Open file descriptors of scaling_cur_freq (-2 : not opened yet, -1 : missing)
+    static int* freq_fds = NULL;
+    static int nb_freq_fds = 0;
+
+    if(nb_freq_fds < nb_cpus){
+
+        int* new_fds = realloc(freq_fds, nb_cpus * sizeof(int));
+        if(new_fds != NULL){
+            for(int cpu = nb_freq_fds; cpu < nb_cpus; cpu++)
+                new_fds[cpu] = -2;
+            freq_fds = new_fds;
+            nb_freq_fds = nb_cpus;
+        }
+    }
+
+    bool missing = false;
+
+    for(int cpu = 0; cpu < nb_cpus; cpu++){
+
+        mhz[cpu] = -1;
+        if(!selected[cpu] || cpu >= nb_freq_fds)
+            continue;
+
+        if(freq_fds[cpu] == -2){
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+            freq_fds[cpu] = open(path, O_RDONLY | O_CLOEXEC);
+        }
+
+        char buffer[32];
+        ssize_t n = freq_fds[cpu] >= 0 ? pread(freq_fds[cpu], buffer, sizeof(buffer) - 1, 0) : -1;
+
+        if(n > 0){
+            buffer[n] = 0;
+            mhz[cpu] = atol(buffer) / 1000.0; //kHz
+        }
+        else
+            missing = true;
+    }
+
+    if(!missing)
+        return;
+
+    //CPUs without cpufreq : index of /proc/cpuinfo
+    for(int cpu = 0; cpu < nb_cpus; cpu++){
+
+        if(!selected[cpu] || mhz[cpu] >= 0)
+            continue;
+
+        struct cpu_info* info = cpu_index_get(cpu);
+        if(info != NULL && info->mhz_text != NULL)
+            mhz[cpu] = info->mhz;
+    }
+}
+
+
+/*************************************sys_cpu_freq_list*****************************************
+*
+* Print the frequency of a list of CPUs (see parse_cpu_list), one "CPU MHz" line per CPU
+*
+* ARGUMENT :
+*   - spec : the list of CPUs
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int sys_cpu_freq_list(const char* spec){
+
+    int nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if(nb_cpus <= 0)
+        return 1;
+
+    bool selected[nb_cpus];
+    double mhz[nb_cpus];
+
+    if(parse_cpu_list(spec, selected, nb_cpus) <= 0){
+        fprintf(stderr, "Invalid CPU list : %s\n", spec);
+        return 1;
+    }
+
+    read_cpu_freqs(selected, mhz, nb_cpus);
+
+    int ret = 0;
+    for(int cpu = 0; cpu < nb_cpus; cpu++){
+
+        if(!selected[cpu])
+            continue;
+
+        if(mhz[cpu] < 0){
+            printf("%d ?\n", cpu);
+            ret = 1;
+        }
+        else
+            printf("%d %.3f\n", cpu, mhz[cpu]);
+    }
+
+    return ret;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/*************************************proc_classify_sse2*****************************************
+*
+* Find the ':' and the ends of lines of a block of 64 bytes, 16 bytes at a time
+*
+* ARGUMENT :
+*   - block : the 64 bytes
+*   - colons : will contain a bit set for each ':' (bit i : byte i)
+*   - newlines : will contain a bit set for each '\n'
+*
+* RETURN : /
+*
+*******************************************************************************************/
+__attribute__((target("sse2")))
+static void proc_classify_sse2(const char* block, uint64_t* colons, uint64_t* newlines){
+
+    __m128i colon = _mm_set1_epi8(':');
+    __m128i newline = _mm_set1_epi8('\n');
+
+    *colons = 0;
+    *newlines = 0;
+
+    for(int i = 0; i < 64; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (block + i));
+        *colons |= (uint64_t) (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, colon)) << i;
+        *newlines |= (uint64_t) (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) << i;
+    }
+}
+
+
+/*************************************proc_classify_avx2*****************************************
+*
+* Find the ':' and the ends of lines of a block of 64 bytes, 32 bytes at a time
+*
+* ARGUMENT :
+*   - block : the 64 bytes
+*   - colons : will contain a bit set for each ':' (bit i : byte i)
+*   - newlines : will contain a bit set for each '\n'
+*
+* RETURN : /
+*
+*******************************************************************************************/
+__attribute__((target("avx2")))
+static void proc_classify_avx2(const char* block, uint64_t* colons, uint64_t* newlines){
+
+    __m256i colon = _mm256_set1_epi8(':');
+    __m256i newline = _mm256_set1_epi8('\n');
+    __m256i low = _mm256_loadu_si256((const __m256i*) block);
+    __m256i high = _mm256_loadu_si256((const __m256i*) (block + 32));
+
+    *colons = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, colon)) |
+              (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, colon)) << 32;
+    *newlines = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)) |
+                (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)) << 32;
+}
+#endif
+
+
+/*************************************proc_classify_init*****************************************
+*
+* Choose the fastest version of proc_classify the CPU supports, none if it has no SIMD
+* version (proc_scan then cuts the lines with memchr)
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void proc_classify_init(void){
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        proc_classify = proc_classify_avx2;
+    else if(__builtin_cpu_supports("sse2"))
+        proc_classify = proc_classify_sse2;
+#endif
+    proc_classify_ready = true;
+}
+
+
+/*************************************proc_scan_line*****************************************
+*
+* Give the value of a line of a "key : value" text to proc_scan's callback if its key is
+* one of the keys searched
+*
+* ARGUMENT :
+*   - line : the start of the line
+*   - separator : its first ':', NULL if none
+*   - line_end : its '\n' (or the 0 ending the text)
+*   - keys, key_lengths, nb_keys : the keys searched and their lengths
+*   - found, data : see proc_scan
+*
+* RETURN : false if found stopped the scan, true otherwise
+*
+*******************************************************************************************/
+static inline bool proc_scan_line(char* line, char* separator, char* line_end, const char* const* keys,
+                                  const size_t* key_lengths, int nb_keys,
+                                  bool (*found)(int key, char* value, void* data), void* data){
+
+    if(separator == NULL)
+        return true;
+
+    //Key without the tabulations before ':'
+    char* key_end = separator;
+    while(key_end > line && (key_end[-1] == '\t' || key_end[-1] == ' '))
+        key_end--;
+
+    for(int k = 0; k < nb_keys; k++){
+
+        if(key_lengths[k] != (size_t) (key_end - line) || memcmp(line, keys[k], key_lengths[k]))
+            continue;
+
+        *key_end = 0;
+        *line_end = 0;
+        char* value = separator + 1;
+        if(*value == ' ')
+            value++;
+
+        return found(k, value, data);
+    }
+
+    return true;
+}
+
+
+/*************************************proc_scan*****************************************
+*
+* Find the values of some keys in a "key : value" text (/proc/cpuinfo, /proc/meminfo, the
+* status files...) in a single pass. The text is classified 64 bytes at a time with SIMD
+* into bit masks of ':' and '\n', the lines are then cut from the bits set : the long
+* values (flags) cost no more than the short ones. Without a SIMD version, the lines are
+* cut with memchr, which the C library optimizes for each CPU. The keys and values of the
+* lines found are cut in place.
+*
+* ARGUMENT :
+*   - text : the text, followed by a 0
+*   - length : the length of the text
+*   - keys : the keys searched (without the blanks before ':')
+*   - nb_keys : the number of keys
+*   - found : called for each line of a key searched, in order, with the index of the key
+*             and the value (without the space after ':'), returns false to stop
+*   - data : given to found
+*
+* RETURN : true if the whole text was scanned, false if found stopped it
+*
+*******************************************************************************************/
+bool proc_scan(char* text, size_t length, const char* const* keys, int nb_keys,
+               bool (*found)(int key, char* value, void* data), void* data){
+
+    if(!proc_classify_ready)
+        proc_classify_init();
+
+    size_t key_lengths[nb_keys];
+    for(int k = 0; k < nb_keys; k++)
+        key_lengths[k] = strlen(keys[k]);
+
+    char* line = text;
+
+    if(proc_classify == NULL){
+
+        //The last line may not end with '\n'
+        for(char* text_end = text + length; line <= text_end; ){
+
+            char* line_end = memchr(line, '\n', text_end - line);
+            if(line_end == NULL)
+                line_end = text_end;
+
+            if(!proc_scan_line(line, memchr(line, ':', line_end - line), line_end, keys, key_lengths, nb_keys, found, data))
+                return false;
+            line = line_end + 1;
+        }
+
+        return true;
+    }
+
+    char* separator = NULL; //First ':' of the line, NULL if none yet
+
+    //The last line may not end with '\n'
+    for(size_t base = 0; base <= length; base += 64){
+
+        uint64_t colons, newlines;
+
+        if(length - base >= 64)
+            proc_classify(text + base, &colons, &newlines);
+        else{
+            char tail[64] = {0};
+            memcpy(tail, text + base, length - base);
+            tail[length - base] = '\n';
+            proc_classify(tail, &colons, &newlines);
+        }
+
+        for(uint64_t events = colons | newlines; events != 0; events &= events - 1){
+
+            int bit = __builtin_ctzll(events);
+            char* position = text + base + bit;
+
+            if(!(newlines >> bit & 1)){
+                if(separator == NULL)
+                    separator = position;
+                continue;
+            }
+
+            if(!proc_scan_line(line, separator, position, keys, key_lengths, nb_keys, found, data))
+                return false;
+
+            line = position + 1;
+            separator = NULL;
+        }
+    }
+
+    return true;
+}
+
+
+/*************************************cpu_index_found*****************************************
+*
+* Add a value of /proc/cpuinfo to the index (see proc_scan)
+*
+* ARGUMENT :
+*   - key : the index of the key in cpu_keys
+*   - value : the value
+*   - data : the entry of the current CPU (struct cpu_info**)
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static const char* const cpu_keys[] = {"processor", "model name", "cpu MHz", "flags", "physical id", "core id"};
+static bool cpu_index_found(int key, char* value, void* data){
+
+    struct cpu_info** cpu = data;
+
+    if(key == 0){
+
+        if(nb_cpu_infos == cpu_infos_capacity){
+            int new_capacity = cpu_infos_capacity ? cpu_infos_capacity * 2 : 64;
+            struct cpu_info* new_infos = realloc(cpu_infos, new_capacity * sizeof(struct cpu_info));
+            if(new_infos == NULL)
+                return false;
+            cpu_infos = new_infos;
+            cpu_infos_capacity = new_capacity;
+        }
+
+        *cpu = &cpu_infos[nb_cpu_infos++];
+        memset(*cpu, 0, sizeof(struct cpu_info));
+        (*cpu)->processor = atoi(value);
+        (*cpu)->physical_id = -1;
+        (*cpu)->core_id = -1;
+        return true;
+    }
+
+    if(*cpu == NULL)
+        return true;
+
+    if(key == 1)
+        (*cpu)->model = value;
+    else if(key == 2){
+        (*cpu)->mhz_text = value;
+        (*cpu)->mhz = atof(value);
+    }
+    else if(key == 3)
+        (*cpu)->flags = value;
+    else if(key == 4)
+        (*cpu)->physical_id = atoi(value);
+    else
+        (*cpu)->core_id = atoi(value);
+
+    return true;
+}
+
+
+/*************************************cpu_index_load*****************************************
+*
+* Read a cpuinfo file and index it (see cpu_index_read)
+*
+* ARGUMENT :
+*   - path : the path of the file (/proc/cpuinfo)
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+bool cpu_index_load(const char* path){
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        perror("File couldn't be opened");
+        return false;
+    }
+
+    bool ret = cpu_index_read(fd);
+    close(fd);
+    return ret;
+}
+
+
+/*************************************cpu_index_read*****************************************
+*
+* Read an open cpuinfo file from its start with as few pread() as possible and index it :
+* the lines are cut in place, each CPU entry points to its values in the buffer. The
+* buffers are kept from one load to the next, a refresh doesn't allocate unless the file
+* grew. The file can stay open to be read again (see sys_watch_cpu_freq).
+*
+* ARGUMENT :
+*   - fd : the file descriptor of the file
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+bool cpu_index_read(int fd){
+
+    //The size of /proc files is unknown, read until the end
+    size_t length = 0;
+    while(true){
+
+        if(length + 4096 > cpu_text_capacity){
+            size_t new_capacity = cpu_text_capacity ? cpu_text_capacity * 2 : 65536;
+            char* new_text = realloc(cpu_text, new_capacity);
+            if(new_text == NULL)
+                return false;
+            cpu_text = new_text;
+            cpu_text_capacity = new_capacity;
+        }
+
+        ssize_t n = pread(fd, cpu_text + length, cpu_text_capacity - length - 1, length);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        length += n;
+    }
+    cpu_text[length] = 0;
+
+    nb_cpu_infos = 0;
+    struct cpu_info* cpu = NULL;
+    if(!proc_scan(cpu_text, length, cpu_keys, sizeof(cpu_keys) / sizeof(cpu_keys[0]), cpu_index_found, &cpu))
+        return false;
+
+    cpu_index_time = now_ns();
+    return true;
+}
+
+
+/*************************************cpu_index_get*****************************************
+*
+* Get the information of a CPU from the index of /proc/cpuinfo, loading it again when it is
+* older than the time to live (the frequencies change)
+*
+* ARGUMENT :
+*   - processor : the number of the CPU
+*
+* RETURN : the information of the CPU, NULL if it doesn't exist
+*
+*******************************************************************************************/
+struct cpu_info* cpu_index_get(int processor){
+
+    if(cpu_index_time == 0 || now_ns() - cpu_index_time > cpu_index_ttl_ns){
+        if(!cpu_index_load("/proc/cpuinfo"))
+            return NULL;
+    }
+
+    if(processor < 0)
+        return NULL;
+
+    //The processors are normally numbered in order
+    if(processor < nb_cpu_infos && cpu_infos[processor].processor == processor)
+        return &cpu_infos[processor];
+
+    for(int i = 0; i < nb_cpu_infos; i++){
+        if(cpu_infos[i].processor == processor)
+            return &cpu_infos[i];
+    }
+
+    return NULL;
+}
+
+
+/*************************************sys_cpu_info*****************************************
+*
+* Print the topology, frequency and model of a list of CPUs (see parse_cpu_list)
+*
+* ARGUMENT :
+*   - spec : the list of CPUs
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int sys_cpu_info(const char* spec){
+
+    int nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if(nb_cpus <= 0)
+        return 1;
+
+    bool selected[nb_cpus];
+    if(parse_cpu_list(spec, selected, nb_cpus) <= 0){
+        fprintf(stderr, "Invalid CPU list : %s\n", spec);
+        return 1;
+    }
+
+    printf("cpu socket core mhz model\n");
+
+    for(int n = 0; n < nb_cpus; n++){
+
+        if(!selected[n])
+            continue;
+
+        struct cpu_info* cpu = cpu_index_get(n);
+        if(cpu == NULL)
+            return 1;
+
+        printf("%d %d %d %s %s\n", n, cpu->physical_id, cpu->core_id,
+               cpu->mhz_text ? cpu->mhz_text : "?", cpu->model ? cpu->model : "?");
+    }
+
+    return 0;
+}
+
+
+/*************************************watch_interval*****************************************
+*
+* Convert the interval of sys watch : a number of seconds, or of ms or us with a suffix
+*
+* ARGUMENT :
+*   - str : the interval ("100ms", "2s", "0.5"...)
+*   - ns : the interval in nanoseconds, set if successful
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool watch_interval(const char* str, long long* ns){
+
+    char* end;
+    double value = strtod(str, &end);
+
+    if(end == str || !(value > 0) || value > 1e6)
+        return false;
+
+    if(*end == 0 || !strcmp(end, "s"))
+        value *= 1e9;
+    else if(!strcmp(end, "ms"))
+        value *= 1e6;
+    else if(!strcmp(end, "us"))
+        value *= 1e3;
+    else
+        return false;
+
+    *ns = value < 1e6 ? 1000000 : (long long) value;
+    return true;
+}
+
+
+/*************************************sys_watch_cpu_freq*****************************************
+*
+* Print the frequency of a list of CPUs (see parse_cpu_list) every interval, until SIGINT.
+* The sources are opened once and read again with pread on each tick of a timerfd : the
+* scaling_cur_freq files, and /proc/cpuinfo only if a CPU has no cpufreq. Each sample is
+* one line "SECONDS.MS CPU:MHZ..." (real time) with only the CPUs whose frequency changed,
+* all of them on the first line, written at once.
+*
+* ARGUMENT :
+*   - spec : the list of CPUs
+*   - interval_ns : the time between two samples
+*
+* RETURN : 0 if stopped by SIGINT, 1 otherwise
+*
+*******************************************************************************************/
+int sys_watch_cpu_freq(const char* spec, long long interval_ns){
+
+    int nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if(nb_cpus <= 0)
+        return 1;
+
+    bool selected[nb_cpus];
+    if(parse_cpu_list(spec, selected, nb_cpus) <= 0){
+        fprintf(stderr, "Invalid CPU list : %s\n", spec);
+        return 1;
+    }
+
+    int* fds = malloc(nb_cpus * sizeof(int));
+    long* last_khz = malloc(nb_cpus * sizeof(long));
+    char* line = malloc(nb_cpus * 24 + 32);
+    int info_fd = -1;
+
+    if(fds == NULL || last_khz == NULL || line == NULL){
+        perror("sys watch");
+        free(fds);
+        free(last_khz);
+        free(line);
+        return 1;
+    }
+
+    for(int cpu = 0; cpu < nb_cpus; cpu++){
+
+        fds[cpu] = -1;
+        last_khz[cpu] = -2; //Never printed, -1 once printed unreadable
+        if(!selected[cpu])
+            continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        fds[cpu] = open(path, O_RDONLY | O_CLOEXEC);
+
+        if(fds[cpu] == -1 && info_fd == -1)
+            info_fd = open("/proc/cpuinfo", O_RDONLY | O_CLOEXEC);
+    }
+
+    //SIGINT only ends the watch : it is received through a signalfd
+    sigset_t interrupt, saved_mask;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    sigprocmask(SIG_BLOCK, &interrupt, &saved_mask);
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int signal_fd = signalfd(-1, &interrupt, SFD_CLOEXEC);
+
+    //The first sample right away
+    struct itimerspec period = {
+        .it_interval = {interval_ns / 1000000000LL, interval_ns % 1000000000LL},
+        .it_value = {0, 1}
+    };
+
+    int ret = 1;
+    if(timer_fd == -1 || signal_fd == -1 || timerfd_settime(timer_fd, 0, &period, NULL) == -1)
+        perror("sys watch");
+    else
+        fflush(stdout);
+
+    while(timer_fd != -1 && signal_fd != -1){
+
+        struct pollfd waited[2] = {{timer_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+        if(poll(waited, 2, -1) == -1){
+            if(errno == EINTR)
+                continue;
+            perror("sys watch");
+            break;
+        }
+
+        if(waited[1].revents & POLLIN){
+            struct signalfd_siginfo info;
+            if(read(signal_fd, &info, sizeof(info)) > 0)
+                ret = 0;
+            break;
+        }
+
+        //The number of ticks elapsed (more than one if a sample was late)
+        uint64_t ticks;
+        if(read(timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+            continue;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int length = sprintf(line, "%lld.%03ld", (long long) now.tv_sec, now.tv_nsec / 1000000);
+
+        bool info_read = false;
+
+        for(int cpu = 0; cpu < nb_cpus; cpu++){
+
+            if(!selected[cpu])
+                continue;
+
+            long khz = -1;
+            char buffer[32];
+            ssize_t n = fds[cpu] != -1 ? pread(fds[cpu], buffer, sizeof(buffer) - 1, 0) : -1;
+
+            if(n > 0){
+                buffer[n] = 0;
+                khz = atol(buffer);
+            }
+            else if(info_fd != -1){
+
+                //Read once per sample for all the CPUs without cpufreq
+                if(!info_read)
+                    info_read = cpu_index_read(info_fd);
+
+                struct cpu_info* info = info_read ? cpu_index_get(cpu) : NULL;
+                if(info != NULL && info->mhz_text != NULL)
+                    khz = (long) (info->mhz * 1000 + 0.5);
+            }
+
+            if(khz == last_khz[cpu])
+                continue;
+
+            if(khz == -1)
+                length += sprintf(line + length, " %d:?", cpu);
+            else
+                length += sprintf(line + length, " %d:%ld.%03ld", cpu, khz / 1000, khz % 1000);
+            last_khz[cpu] = khz;
+        }
+
+        line[length++] = '\n';
+        if(write(STDOUT_FILENO, line, length) != length)
+            break;
+    }
+
+    if(timer_fd != -1)
+        close(timer_fd);
+    if(signal_fd != -1)
+        close(signal_fd);
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+    for(int cpu = 0; cpu < nb_cpus; cpu++){
+        if(fds[cpu] != -1)
+            close(fds[cpu]);
+    }
+    if(info_fd != -1)
+        close(info_fd);
+
+    free(fds);
+    free(last_khz);
+    free(line);
+
+    return ret;
+}
+
+
+/*************************************netlink_open*****************************************
+*
+* Open the rtnetlink socket once, it is kept for every following request
+*
+* ARGUMENT : /
+*
+* RETURN : the socket, -1 if it couldn't be created
+*
+*******************************************************************************************/
+static int netlink_open(void){
+
+    if(netlink_fd != -1)
+        return netlink_fd;
+
+    netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(netlink_fd == -1){
+        perror("Netlink socket couldn't be created");
+        return -1;
+    }
+
+    //The errors of a batch only need the header of the failed request
+    int one = 1;
+    setsockopt(netlink_fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+    return netlink_fd;
+}
+
+
+/*************************************netlink_dump*****************************************
+*
+* Send a dump request on the rtnetlink socket and give every message of the answer to a
+* callback. Messages left by an older request (other sequence number) are skipped.
+*
+* ARGUMENT :
+*   - type : the type of the request (RTM_GETLINK, RTM_GETADDR...)
+*   - payload : the family specific header of the request
+*   - length : the length of the payload
+*   - callback : the function called for each message of the answer
+*   - data : given to the callback
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool netlink_dump(int type, const void* payload, size_t length,
+                         void (*callback)(struct nlmsghdr*, void*), void* data){
+
+    int fd = netlink_open();
+    if(fd == -1)
+        return false;
+
+    struct{
+        struct nlmsghdr header;
+        char payload[64];
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(length);
+    request.header.nlmsg_type = type;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = ++netlink_seq;
+    memcpy(NLMSG_DATA(&request.header), payload, length);
+
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+
+    if(sendto(fd, &request, request.header.nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel)) == -1){
+        perror("Netlink request couldn't be sent");
+        return false;
+    }
+
+    while(true){
+
+        ssize_t received = recv(fd, netlink_buffer, sizeof(netlink_buffer), 0);
+        if(received == -1){
+            if(errno == EINTR)
+                continue;
+            perror("Netlink answer couldn't be received");
+            return false;
+        }
+
+        int remaining = received;
+        for(struct nlmsghdr* message = (struct nlmsghdr*)netlink_buffer; NLMSG_OK(message, remaining);
+            message = NLMSG_NEXT(message, remaining)){
+
+            if(message->nlmsg_seq != netlink_seq)
+                continue;
+
+            if(message->nlmsg_type == NLMSG_DONE)
+                return true;
+
+            if(message->nlmsg_type == NLMSG_ERROR){
+                struct nlmsgerr* error = NLMSG_DATA(message);
+                errno = -error->error;
+                perror("Netlink request failed");
+                return false;
+            }
+
+            callback(message, data);
+        }
+    }
+}
+
+
+/*************************************link_callback*****************************************
+*
+* Record the name of an interface of a RTM_GETLINK dump in the table of interfaces
+*
+* ARGUMENT :
+*   - message : a RTM_NEWLINK message
+*   - data : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void link_callback(struct nlmsghdr* message, void* data){
+
+    (void)data;
+
+    if(message->nlmsg_type != RTM_NEWLINK)
+        return;
+
+    struct ifinfomsg* info = NLMSG_DATA(message);
+    int length = IFLA_PAYLOAD(message);
+
+    for(struct rtattr* attribute = IFLA_RTA(info); RTA_OK(attribute, length);
+        attribute = RTA_NEXT(attribute, length)){
+
+        if(attribute->rta_type != IFLA_IFNAME)
+            continue;
+
+        if(nb_links == links_capacity){
+            int new_capacity = links_capacity ? links_capacity * 2 : 16;
+            struct link_name* new_links = realloc(links, new_capacity * sizeof(struct link_name));
+            if(new_links == NULL)
+                return;
+            links = new_links;
+            links_capacity = new_capacity;
+        }
+
+        links[nb_links].index = info->ifi_index;
+        snprintf(links[nb_links].name, IF_NAMESIZE, "%s", (char*)RTA_DATA(attribute));
+        nb_links++;
+        return;
+    }
+}
+
+
+/*************************************link_find*****************************************
+*
+* Find an interface of the last RTM_GETLINK dump from its index or from its name
+*
+* ARGUMENT :
+*   - index : the index of the interface, or 0 to search by name
+*   - name : the name of the interface if index is 0
+*
+* RETURN : the interface, NULL if it doesn't exist
+*
+*******************************************************************************************/
+static struct link_name* link_find(int index, const char* name){
+
+    for(int i = 0; i < nb_links; i++){
+        if(index != 0 && links[i].index == index)
+            return &links[i];
+        if(index == 0 && name != NULL && !strcmp(links[i].name, name))
+            return &links[i];
+    }
+
+    return NULL;
+}
+
+
+/*************************************addr_callback*****************************************
+*
+* Print an address of a RTM_GETADDR dump, or keep the first IPv4 address of one interface
+*
+* ARGUMENT :
+*   - message : a RTM_NEWADDR message
+*   - data : the address query
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void addr_callback(struct nlmsghdr* message, void* data){
+
+    struct addr_query* query = data;
+
+    if(message->nlmsg_type != RTM_NEWADDR)
+        return;
+
+    struct ifaddrmsg* info = NLMSG_DATA(message);
+    if(info->ifa_family != AF_INET && info->ifa_family != AF_INET6)
+        return;
+
+    if(query->index != 0 && (query->found || info->ifa_family != AF_INET || (int)info->ifa_index != query->index))
+        return;
+
+    //IFA_LOCAL is the address of the interface on point to point links, IFA_ADDRESS the peer
+    void* address = NULL;
+    int length = IFA_PAYLOAD(message);
+
+    for(struct rtattr* attribute = IFA_RTA(info); RTA_OK(attribute, length);
+        attribute = RTA_NEXT(attribute, length)){
+
+        if(attribute->rta_type == IFA_LOCAL || (attribute->rta_type == IFA_ADDRESS && address == NULL))
+            address = RTA_DATA(attribute);
+    }
+
+    if(address == NULL)
+        return;
+
+    if(query->index != 0){
+        memcpy(&query->address, address, sizeof(struct in_addr));
+        query->prefix = info->ifa_prefixlen;
+        query->found = true;
+        return;
+    }
+
+    char text[INET6_ADDRSTRLEN];
+    inet_ntop(info->ifa_family, address, text, sizeof(text));
+
+    struct link_name* link = link_find(info->ifa_index, NULL);
+    printf("%s %s %s/%d\n", link != NULL ? link->name : "?",
+           info->ifa_family == AF_INET ? "inet" : "inet6", text, info->ifa_prefixlen);
+}
+
+
+/*************************************links_load*****************************************
+*
+* Load the table of interfaces with a RTM_GETLINK dump (they can change between two calls)
+*
+* ARGUMENT : /
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool links_load(void){
+
+    nb_links = 0;
+    struct ifinfomsg link_request = {.ifi_family = AF_UNSPEC};
+
+    return netlink_dump(RTM_GETLINK, &link_request, sizeof(link_request), link_callback, NULL);
+}
+
+
+/*************************************sys_ip_addr*****************************************
+*
+* Print the addresses of the interfaces with rtnetlink : every IPv4 and IPv6 address of
+* every interface, or the first IPv4 address and its mask of one interface
+*
+* ARGUMENT :
+*   - dev : the name of the interface, NULL for all of them
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int sys_ip_addr(const char* dev){
+
+    if(!links_load())
+        return 1;
+
+    struct addr_query query = {0};
+
+    if(dev != NULL){
+        struct link_name* link = link_find(0, dev);
+        if(link == NULL){
+            fprintf(stderr, "Unknown interface : %s\n", dev);
+            return 1;
+        }
+        query.index = link->index;
+    }
+
+    struct ifaddrmsg addr_request = {.ifa_family = AF_UNSPEC};
+    if(!netlink_dump(RTM_GETADDR, &addr_request, sizeof(addr_request), addr_callback, &query))
+        return 1;
+
+    if(dev == NULL)
+        return 0;
+
+    if(!query.found){
+        fprintf(stderr, "Couldn't retrieve the IP address of %s\n", dev);
+        return 1;
+    }
+
+    struct in_addr mask = {.s_addr = query.prefix ? htonl(0xffffffffu << (32 - query.prefix)) : 0};
+    printf("%s", inet_ntoa(query.address));
+    printf(".%s\n", inet_ntoa(mask));
+
+    return 0;
+}
+
+
+/*************************************addr_entry_parse*****************************************
+*
+* Check an interface, an address and a mask (dotted IPv4 mask or prefix length) and fill
+* an address entry with them. The interfaces must have been loaded by links_load.
+*
+* ARGUMENT :
+*   - entry : the entry to fill
+*   - dev : the name of the interface
+*   - address : the IPv4 or IPv6 address
+*   - mask : the mask or the prefix length
+*
+* RETURN : true if successful, false otherwise (the error is printed)
+*
+*******************************************************************************************/
+static bool addr_entry_parse(struct addr_entry* entry, const char* dev, const char* address, const char* mask){
+
+    struct link_name* link = link_find(0, dev);
+    if(link == NULL){
+        fprintf(stderr, "Line %d : unknown interface %s\n", entry->line, dev);
+        return false;
+    }
+    entry->index = link->index;
+    snprintf(entry->dev, IF_NAMESIZE, "%s", dev);
+
+    if(inet_pton(AF_INET, address, entry->address) == 1)
+        entry->family = AF_INET;
+    else if(inet_pton(AF_INET6, address, entry->address) == 1)
+        entry->family = AF_INET6;
+    else{
+        fprintf(stderr, "Line %d : invalid address %s\n", entry->line, address);
+        return false;
+    }
+
+    int max_prefix = entry->family == AF_INET ? 32 : 128;
+    struct in_addr dotted;
+    char* end;
+
+    if(entry->family == AF_INET && strchr(mask, '.') != NULL && inet_pton(AF_INET, mask, &dotted) == 1){
+
+        //The bits of the mask must be contiguous
+        uint32_t inverted = ~ntohl(dotted.s_addr);
+        if((inverted & (inverted + 1)) != 0){
+            fprintf(stderr, "Line %d : invalid mask %s\n", entry->line, mask);
+            return false;
+        }
+        entry->prefix = 32 - __builtin_popcount(inverted);
+    }
+    else{
+        long prefix = strtol(mask, &end, 10);
+        if(*mask == 0 || *end != 0 || prefix < 0 || prefix > max_prefix){
+            fprintf(stderr, "Line %d : invalid mask %s\n", entry->line, mask);
+            return false;
+        }
+        entry->prefix = prefix;
+    }
+
+    return true;
+}
+
+
+/*************************************batch_message*****************************************
+*
+* Append a netlink message to the batch
+*
+* ARGUMENT :
+*   - length : the current length of the batch, updated
+*   - type : the type of the message
+*   - seq : the sequence number of the message
+*   - payload : the family specific header
+*   - payload_length : its length
+*
+* RETURN : the header of the message, to add attributes to it
+*
+*******************************************************************************************/
+static struct nlmsghdr* batch_message(size_t* length, int type, unsigned int seq, const void* payload, size_t payload_length){
+
+    struct nlmsghdr* message = (struct nlmsghdr*)(netlink_batch + *length);
+
+    memset(message, 0, NLMSG_SPACE(payload_length));
+    message->nlmsg_len = NLMSG_LENGTH(payload_length);
+    message->nlmsg_type = type;
+    message->nlmsg_flags = NLM_F_REQUEST;
+    message->nlmsg_seq = seq;
+    if(payload_length > 0)
+        memcpy(NLMSG_DATA(message), payload, payload_length);
+
+    return message;
+}
+
+
+/*************************************batch_attribute*****************************************
+*
+* Add an attribute to the last message of the batch
+*
+* ARGUMENT :
+*   - message : the message
+*   - type : the type of the attribute
+*   - data : the value of the attribute
+*   - data_length : its length
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void batch_attribute(struct nlmsghdr* message, int type, const void* data, size_t data_length){
+
+    struct rtattr* attribute = (struct rtattr*)((char*)message + NLMSG_ALIGN(message->nlmsg_len));
+
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(data_length);
+    memcpy(RTA_DATA(attribute), data, data_length);
+    message->nlmsg_len = NLMSG_ALIGN(message->nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+}
+
+
+/*************************************addr_entries_apply*****************************************
+*
+* Set the addresses of a group of entries and bring their interfaces up : all the netlink
+* messages are sent at once and the kernel only answers the failed ones, followed by the
+* ack of a last NLMSG_NOOP. The entry i gets the sequence numbers base + 2i (address) and
+* base + 2i + 1 (link up), which gives the entry of each error.
+*
+* ARGUMENT :
+*   - entries : the entries
+*   - nb_entries : the number of entries (at most ADDR_BATCH)
+*
+* RETURN : the number of entries that failed
+*
+*******************************************************************************************/
+static int addr_entries_apply(struct addr_entry* entries, int nb_entries){
+
+    int fd = netlink_open();
+    if(fd == -1)
+        return nb_entries;
+
+    unsigned int base = netlink_seq + 1;
+    netlink_seq += 2 * nb_entries;
+    size_t length = 0;
+
+    for(int i = 0; i < nb_entries; i++){
+
+        struct ifaddrmsg addr = {
+            .ifa_family = entries[i].family,
+            .ifa_prefixlen = entries[i].prefix,
+            .ifa_index = entries[i].index
+        };
+        size_t address_length = entries[i].family == AF_INET ? 4 : 16;
+
+        struct nlmsghdr* message = batch_message(&length, RTM_NEWADDR, base + 2 * i, &addr, sizeof(addr));
+        message->nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+        batch_attribute(message, IFA_LOCAL, entries[i].address, address_length);
+        batch_attribute(message, IFA_ADDRESS, entries[i].address, address_length);
+        length += NLMSG_ALIGN(message->nlmsg_len);
+
+        struct ifinfomsg link = {
+            .ifi_family = AF_UNSPEC,
+            .ifi_index = entries[i].index,
+            .ifi_flags = IFF_UP,
+            .ifi_change = IFF_UP
+        };
+
+        message = batch_message(&length, RTM_NEWLINK, base + 2 * i + 1, &link, sizeof(link));
+        length += NLMSG_ALIGN(message->nlmsg_len);
+
+        entries[i].error = 0;
+    }
+
+    //Every message before it has been handled when this one is acked
+    unsigned int last = base + 2 * nb_entries;
+    netlink_seq++;
+    struct nlmsghdr* barrier = batch_message(&length, NLMSG_NOOP, last, NULL, 0);
+    barrier->nlmsg_flags |= NLM_F_ACK;
+    length += NLMSG_ALIGN(barrier->nlmsg_len);
+
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+
+    if(sendto(fd, netlink_batch, length, 0, (struct sockaddr*)&kernel, sizeof(kernel)) == -1){
+        perror("Netlink request couldn't be sent");
+        return nb_entries;
+    }
+
+    bool done = false;
+    while(!done){
+
+        ssize_t received = recv(fd, netlink_buffer, sizeof(netlink_buffer), 0);
+        if(received == -1){
+            if(errno == EINTR)
+                continue;
+            perror("Netlink answer couldn't be received");
+            return nb_entries;
+        }
+
+        int remaining = received;
+        for(struct nlmsghdr* message = (struct nlmsghdr*)netlink_buffer; NLMSG_OK(message, remaining);
+            message = NLMSG_NEXT(message, remaining)){
+
+            if(message->nlmsg_type != NLMSG_ERROR || message->nlmsg_seq < base || message->nlmsg_seq > last)
+                continue;
+
+            if(message->nlmsg_seq == last){
+                done = true;
+                continue;
+            }
+
+            struct nlmsgerr* error = NLMSG_DATA(message);
+            struct addr_entry* entry = &entries[(message->nlmsg_seq - base) / 2];
+            if(entry->error == 0)
+                entry->error = -error->error;
+        }
+    }
+
+    int nb_failed = 0;
+    for(int i = 0; i < nb_entries; i++){
+        if(entries[i].error != 0){
+            fprintf(stderr, "Line %d : %s : %s\n", entries[i].line, entries[i].dev, strerror(entries[i].error));
+            nb_failed++;
+        }
+    }
+
+    return nb_failed;
+}
+
+
+/*************************************sys_ip_addr_set*****************************************
+*
+* Set the address of an interface and bring it up (a batch of one entry)
+*
+* ARGUMENT :
+*   - dev : the name of the interface
+*   - address : the IPv4 or IPv6 address
+*   - mask : the mask or the prefix length
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int sys_ip_addr_set(const char* dev, const char* address, const char* mask){
+
+    if(!links_load())
+        return 1;
+
+    struct addr_entry entry = {.line = 1};
+    if(!addr_entry_parse(&entry, dev, address, mask))
+        return 1;
+
+    return addr_entries_apply(&entry, 1) == 0 ? 0 : 1;
+}
+
+
+/*************************************sys_ip_addr_batch*****************************************
+*
+* Set the addresses of interfaces from "DEV IP MASK" lines (empty lines and lines starting
+* with # are skipped). The lines are applied by groups of ADDR_BATCH netlink requests and
+* every failed line is reported.
+*
+* ARGUMENT :
+*   - path : the file of the lines, "-" for the standard input
+*
+* RETURN : 0 if every line has been applied, 1 otherwise
+*
+*******************************************************************************************/
+int sys_ip_addr_batch(const char* path){
+
+    //The standard input is read through its own stream : the shell's stdin FILE may be
+    //reading a script, not the redirected file descriptor
+    FILE* file = NULL;
+    if(strcmp(path, "-"))
+        file = fopen(path, "r");
+    else{
+        int stdin_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        if(stdin_fd != -1 && (file = fdopen(stdin_fd, "r")) == NULL)
+            close(stdin_fd);
+    }
+    if(file == NULL){
+        perror("File couldn't be opened");
+        return 1;
+    }
+
+    if(!links_load()){
+        fclose(file);
+        return 1;
+    }
+
+    struct addr_entry entries[ADDR_BATCH];
+    int nb_entries = 0;
+    int nb_failed = 0;
+    int line_number = 0;
+    char* line = NULL;
+    size_t len = 0;
+
+    while(getline(&line, &len, file) != -1){
+
+        line_number++;
+
+        char dev[IF_NAMESIZE + 1], address[INET6_ADDRSTRLEN], mask[INET6_ADDRSTRLEN], extra[2];
+        int nb_fields = sscanf(line, "%16s %45s %45s %1s", dev, address, mask, extra);
+
+        if(nb_fields <= 0 || dev[0] == '#')
+            continue;
+
+        entries[nb_entries].line = line_number;
+        if(nb_fields != 3){
+            fprintf(stderr, "Line %d : expected DEV IP MASK\n", line_number);
+            nb_failed++;
+            continue;
+        }
+
+        if(!addr_entry_parse(&entries[nb_entries], dev, address, mask)){
+            nb_failed++;
+            continue;
+        }
+
+        if(++nb_entries == ADDR_BATCH){
+            nb_failed += addr_entries_apply(entries, nb_entries);
+            nb_entries = 0;
+        }
+    }
+
+    if(nb_entries > 0)
+        nb_failed += addr_entries_apply(entries, nb_entries);
+
+    free(line);
+    fclose(file);
+
+    return nb_failed == 0 ? 0 : 1;
+}
+
+
+/*************************************builtin_sys*****************************************
+*
+* The sys built-in : get or set information about the system
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_sys(char** args){
+
+
+
+    //Gives the hostname without using a system call
+    if ((args[1]!=NULL)&&(!strcmp(args[1], "hostname"))){
+
+        //Forward the file as is, without copying it in the shell
+        if(forward_file("/proc/sys/kernel/hostname") == -1){
+            return 1;
+        }
+
+        return 0;
+
+    }
+
+
+    //Load /proc/cpuinfo again now, or set how long it is kept (in ms)
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&(!strcmp(args[1], "cpu"))&&
+        (!strcmp(args[2], "refresh"))&&(args[3]==NULL)){
+
+        return cpu_index_load("/proc/cpuinfo") ? 0 : 1;
+    }
+
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&(!strcmp(args[1], "cpu"))&&
+        (!strcmp(args[2], "ttl"))){
+
+        if(args[3] == NULL){
+            printf("%lld\n", cpu_index_ttl_ns / 1000000);
+            return 0;
+        }
+
+        //0 reads /proc/cpuinfo every time
+        char* end;
+        errno = 0;
+        long long ms = strtoll(args[3], &end, 10);
+        if(args[4] != NULL || end == args[3] || *end != 0 || errno != 0 || ms < 0 || ms > LLONG_MAX / 1000000){
+            fprintf(stderr, "sys cpu ttl: usage: sys cpu ttl [MILLISECONDS]\n");
+            return 1;
+        }
+
+        cpu_index_ttl_ns = ms * 1000000LL;
+        return 0;
+    }
+
+
+    //Gives the topology, frequency and model of a list of processors
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&(!strcmp(args[1], "cpu"))&&
+        (!strcmp(args[2], "info"))&&(args[3]==NULL || args[4]==NULL)){
+
+        return sys_cpu_info(args[3] != NULL ? args[3] : "all");
+    }
+
+
+    //Gives the CPU flags of the Nth processor
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&(!strcmp(args[1], "cpu"))&&
+        (!strcmp(args[2], "flags"))&&(args[3]==NULL || args[4]==NULL)){
+
+        struct cpu_info* cpu = cpu_index_get(args[3] != NULL ? atoi(args[3]) : 0);
+        if(cpu == NULL || cpu->flags == NULL){
+            return 1;
+        }
+
+        printf("%s\n", cpu->flags);
+        return 0;
+    }
+
+
+    //Gives the CPU model
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&
+        (!strcmp(args[1], "cpu"))&&(!strcmp(args[2], "model"))){
+
+        struct cpu_info* cpu = cpu_index_get(0);
+        if(cpu == NULL || cpu->model == NULL){
+            return 1;
+        }
+
+        printf("%s\n", cpu->model);
+        return 0;
+    }
+
+
+    //Print the CPU frequency of a list of processors every interval (1s by default)
+    if ((args[1]!=NULL)&&(!strcmp(args[1], "watch"))){
+
+        long long interval_ns = 1000000000LL;
+        int k = 2;
+
+        if((args[k]!=NULL)&&(!strcmp(args[k], "-i"))){
+            if((args[k+1]==NULL)||(!watch_interval(args[k+1], &interval_ns))){
+                fprintf(stderr, "sys watch: invalid interval\n");
+                return 1;
+            }
+            k += 2;
+        }
+
+        if ((args[k]==NULL)||(args[k+1]==NULL)||(strcmp(args[k], "cpu"))||
+            (strcmp(args[k+1], "freq"))||(args[k+2]==NULL)||(args[k+3]!=NULL)){
+            fprintf(stderr, "Usage: sys watch [-i INTERVAL] cpu freq CPUS\n");
+            return 1;
+        }
+
+        return sys_watch_cpu_freq(args[k+2], interval_ns);
+    }
+
+
+    //Gives the CPU frequency of a list of processors (all, A-B, A,B...)
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&
+        (!strcmp(args[1], "cpu"))&&(!strcmp(args[2], "freq"))&&
+        (args[3]!= NULL)&&(args[4]==NULL)&&
+        (!strcmp(args[3], "all") || strpbrk(args[3], "-,") != NULL)){
+
+        return sys_cpu_freq_list(args[3]);
+    }
+
+
+    //Gives the CPU frequency of Nth processor
+    if ((args[1]!=NULL)&&(args[2]!=NULL)&&
+        (!strcmp(args[1], "cpu"))&&(!strcmp(args[2], "freq"))&&
+        (args[3]!= NULL)&&(args[4]==NULL)){
+
+        struct cpu_info* cpu = cpu_index_get(atoi(args[3]));
+        if(cpu == NULL || cpu->mhz_text == NULL){
+            return 1;
+        }
+
+        printf("%s\n", cpu->mhz_text);
+        return 0;
+
+    }
+
+
+    //Set the frequency of the CPU N to X (in HZ)
+    else if ((args[1]!=NULL)&&
+            (args[2]!=NULL)&&
+            (!strcmp(args[1], "cpu"))&&
+            (!strcmp(args[2], "freq"))&&
+            (args[3]!= NULL)&&
+            (args[4]!=NULL)){
+
+        int number = atoi(args[3]);
+        char path[256];
+
+        //Convert frequency from Hz to kHz
+        int frequency = atoi(args[4])/1000;
+        snprintf(path,256,"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_setspeed",number);
+
+        FILE* file = fopen(path,"w");
+        if(file == NULL){
+            perror("File couldn't be opened");
+            return 1;
+        }
+
+        fprintf(file,"%d",frequency);
+        fclose(file);
+
+        return 0;
+
+    }
+
+
+    //Get the ip and mask of the interface DEV, or every address of every interface
+    else if ((args[1] != NULL)&&
+            (args[2] != NULL)&&
+            (!strcmp(args[1], "ip"))&&
+            (!strcmp(args[2], "addr"))&&
+            (args[3] == NULL || args[4] == NULL)){
+
+            return sys_ip_addr(args[3]);
+    }
+
+
+    //Set the ip of the interfaces from the DEV IP MASK lines of a file (- for stdin)
+    else if ((args[1]!=NULL)&&
+        (args[2]!=NULL)&&
+        (!strcmp(args[1], "ip"))&&
+        (!strcmp(args[2], "addr"))&&
+        (args[3]!=NULL)&&
+        (!strcmp(args[3], "batch"))&&
+        (args[4]!=NULL)&&
+        (args[5]==NULL)){
+
+        return sys_ip_addr_batch(args[4]);
+    }
+
+
+    //Set the ip of the interface DEV to IP/MASK
+    else if ((args[1]!=NULL)&&
+        (args[2]!=NULL)&&
+        (!strcmp(args[1], "ip"))&&
+        (!strcmp(args[2], "addr"))&&
+        (args[3]!= NULL)&&
+        (args[4]!=NULL)&&
+        (args[5]!=NULL)&&
+        (args[6]==NULL)){
+
+        return sys_ip_addr_set(args[3], args[4], args[5]);
+    }
+
+    //In all other cases, error
+    else{
+        return 1;
+    }
+}
+
+
+/*************************************forward_fd*****************************************
+*
+* Copy everything that can be read from in to out without going through a user space
+* buffer : copy_file_range() between regular files, splice() when one side is a pipe,
+* sendfile() otherwise. Falls back to read()/write() when the kernel refuses them (e.g.
+* some /proc files).
+*
+* ARGUMENT :
+*   - in : the file descriptor to read from
+*   - out : the file descriptor to write to
+*
+* RETURN : 0 if successful, -1 otherwise
+*
+*******************************************************************************************/
+int forward_fd(int in, int out){
+
+    struct stat in_stat, out_stat;
+    if(fstat(in, &in_stat) == -1 || fstat(out, &out_stat) == -1)
+        return -1;
+
+    bool use_splice = S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode);
+
+    //File to file (cat LOG > COPY) : the file system can copy without reading the data
+    if(S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode)){
+
+        bool copied = false;
+
+        while(true){
+
+            ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+
+            if(n < 0){
+                if(errno == EINTR)
+                    continue;
+                //Not possible between these files (other file system, O_APPEND...), use sendfile
+                break;
+            }
+
+            //Nothing at all may mean a /proc or /sys file, whose size is unknown
+            if(n == 0 && copied)
+                return 0;
+            if(n == 0)
+                break;
+            copied = true;
+        }
+    }
+
+    while(true){
+
+        ssize_t n;
+        if(use_splice)
+            n = splice(in, NULL, out, NULL, 1 << 16, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+            n = sendfile(out, in, NULL, 1 << 16);
+
+        if(n == 0)
+            return 0;
+
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            //Not supported by one of the files, copy what remains the usual way
+            if(errno == EINVAL || errno == ENOSYS)
+                break;
+            return -1;
+        }
+    }
+
+    char buffer[65536];
+    ssize_t n;
+
+    while((n = read(in, buffer, sizeof(buffer))) != 0){
+
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for(ssize_t written = 0; written < n; ){
+            ssize_t w = write(out, buffer + written, n - written);
+            if(w < 0){
+                if(errno == EINTR)
+                    continue;
+                return -1;
+            }
+            written += w;
+        }
+    }
+
+    return 0;
+}
+
+
+/*************************************forward_file*****************************************
+*
+* Copy a whole file to the standard output (see forward_fd)
+*
+* ARGUMENT :
+*   - path : the path of the file
+*
+* RETURN : 0 if successful, -1 otherwise
+*
+*******************************************************************************************/
+int forward_file(const char* path){
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        perror("File couldn't be opened");
+        return -1;
+    }
+
+    //What was printed before must come first
+    fflush(stdout);
+
+    int ret = forward_fd(fd, STDOUT_FILENO);
+    close(fd);
+
+    return ret;
+}
+
+
+/*************************************cat_input*****************************************
+*
+* Copy an input of cat to the standard output, unless it is the output itself : the copy
+* would read again what it just wrote (cat f >> f never ends)
+*
+* ARGUMENT :
+*   - fd : the input
+*   - name : its name, for the errors
+*   - out_stat : the output, NULL if it couldn't be read
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+static int cat_input(int fd, const char* name, const struct stat* out_stat){
+
+    struct stat in_stat;
+
+    if(out_stat != NULL && S_ISREG(out_stat->st_mode) && fstat(fd, &in_stat) == 0 &&
+       in_stat.st_dev == out_stat->st_dev && in_stat.st_ino == out_stat->st_ino){
+        fprintf(stderr, "cat: %s: input file is output file\n", name);
+        return 1;
+    }
+
+    return forward_fd(fd, STDOUT_FILENO) == -1 ? 1 : 0;
+}
+
+
+/*************************************builtin_cat*****************************************
+*
+* The cat built-in : copy the files (or the standard input for none or "-") to the
+* standard output. Options aren't supported, the external cat is used for them. Like
+* coreutils, a file that is the output is skipped.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_cat(char** args){
+
+    int ret = 0;
+
+    fflush(stdout);
+
+    struct stat out_stat;
+    const struct stat* out = fstat(STDOUT_FILENO, &out_stat) == 0 ? &out_stat : NULL;
+
+    if(args[1] == NULL)
+        return cat_input(STDIN_FILENO, "-", out);
+
+    for(int i = 1; args[i] != NULL; i++){
+
+        if(!strcmp(args[i], "-")){
+            if(cat_input(STDIN_FILENO, "-", out) != 0)
+                ret = 1;
+            continue;
+        }
+
+        int fd = open(args[i], O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            perror("File couldn't be opened");
+            ret = 1;
+            continue;
+        }
+
+        if(cat_input(fd, args[i], out) != 0)
+            ret = 1;
+        close(fd);
+    }
+
+    return ret;
+}
+
+
+/*************************************builtin_tee*****************************************
+*
+* The tee built-in : copy the standard input to the standard output and to a file.
+* Between two pipes, the data is duplicated with tee() and moved to the file with
+* splice(), it never goes through user space.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_tee(char** args){
+
+    int i = 1;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if(args[i] != NULL && !strcmp(args[i], "-a")){
+        flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        i++;
+    }
+
+    int fd = open(args[i], flags, 0666);
+    if(fd == -1){
+        perror("File couldn't be opened");
+        return 1;
+    }
+
+    fflush(stdout);
+
+    struct stat in_stat, out_stat;
+    bool pipes = fstat(STDIN_FILENO, &in_stat) == 0 && fstat(STDOUT_FILENO, &out_stat) == 0 &&
+                 S_ISFIFO(in_stat.st_mode) && S_ISFIFO(out_stat.st_mode);
+
+    char buffer[65536];
+    int ret = 0;
+
+    while(true){
+
+        ssize_t n;
+
+        if(pipes){
+            //Duplicate the content of the input pipe into the output pipe
+            n = tee(STDIN_FILENO, STDOUT_FILENO, 1 << 16, 0);
+            if(n == 0)
+                break;
+            if(n < 0){
+                if(errno == EINTR)
+                    continue;
+                ret = 1;
+                break;
+            }
+
+            //Then consume it into the file
+            for(ssize_t moved = 0; moved < n; ){
+                ssize_t m = splice(STDIN_FILENO, NULL, fd, NULL, n - moved, SPLICE_F_MOVE);
+                if(m <= 0){
+                    if(m < 0 && errno == EINTR)
+                        continue;
+                    ret = 1;
+                    break;
+                }
+                moved += m;
+            }
+            if(ret)
+                break;
+            continue;
+        }
+
+        n = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if(n == 0)
+            break;
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            ret = 1;
+            break;
+        }
+
+        if(write(STDOUT_FILENO, buffer, n) != n || write(fd, buffer, n) != n){
+            ret = 1;
+            break;
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+
+/*************************************print_escaped*****************************************
+*
+* Print a string, replacing its backslash escapes (echo -e, printf's format and %b)
+*
+* ARGUMENT :
+*   - str : the string
+*   - octal_zero : true if octal escapes start with \0 (echo, %b), false for \NNN (format)
+*
+* RETURN : true if \c was found, i.e. nothing more must be printed
+*
+*******************************************************************************************/
+static bool print_escaped(const char* str, bool octal_zero){
+
+    for(const char* p = str; *p != 0; p++){
+
+        if(*p != '\\' || p[1] == 0){
+            putchar(*p);
+            continue;
+        }
+
+        p++;
+        switch(*p){
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'c': return true;
+            case 'e': putchar(27); break;
+            case 'f': putchar('\f'); break;
+            case 'n': putchar('\n'); break;
+            case 'r': putchar('\r'); break;
+            case 't': putchar('\t'); break;
+            case 'v': putchar('\v'); break;
+            case '\\': putchar('\\'); break;
+
+            case 'x':{
+                int value = 0, nb_digits = 0;
+                while(nb_digits < 2 && isxdigit((unsigned char)p[1])){
+                    p++;
+                    value = value * 16 + (isdigit((unsigned char)*p) ? *p - '0' : tolower(*p) - 'a' + 10);
+                    nb_digits++;
+                }
+                if(nb_digits == 0)
+                    printf("\\x");
+                else
+                    putchar(value);
+                break;
+            }
+
+            default:
+                if(*p >= '0' && *p <= '7' && (*p == '0' || !octal_zero)){
+                    //\0NNN (up to 3 digits after the 0) or \NNN
+                    int max_digits = (*p == '0' && octal_zero) ? 4 : 3;
+                    int value = 0, nb_digits = 0;
+                    p--;
+                    while(nb_digits < max_digits && p[1] >= '0' && p[1] <= '7'){
+                        p++;
+                        value = value * 8 + (*p - '0');
+                        nb_digits++;
+                    }
+                    putchar(value & 0xff);
+                }
+                else{
+                    putchar('\\');
+                    putchar(*p);
+                }
+        }
+    }
+
+    return false;
+}
+
+
+/*************************************builtin_echo*****************************************
+*
+* The echo built-in : echo [-neE] ARGS... (-n : no newline, -e : escapes, -E : no escapes)
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0
+*
+*******************************************************************************************/
+int builtin_echo(char** args){
+
+    bool newline = true;
+    bool escapes = false;
+    int i = 1;
+
+    //Like coreutils, only words made of n, e and E are options
+    for(; args[i] != NULL && args[i][0] == '-' && args[i][1] != 0; i++){
+
+        if(strspn(args[i] + 1, "neE") != strlen(args[i] + 1))
+            break;
+
+        for(const char* c = args[i] + 1; *c != 0; c++){
+            if(*c == 'n')
+                newline = false;
+            else
+                escapes = (*c == 'e');
+        }
+    }
+
+    for(bool first = true; args[i] != NULL; i++, first = false){
+
+        if(!first)
+            putchar(' ');
+
+        if(!escapes)
+            fputs(args[i], stdout);
+        else if(print_escaped(args[i], true))
+            return 0;
+    }
+
+    if(newline)
+        putchar('\n');
+
+    return 0;
+}
+
+
+/*************************************builtin_true*****************************************
+*
+* The true built-in
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0
+*
+*******************************************************************************************/
+int builtin_true(char** args){
+
+    (void) args;
+    return 0;
+}
+
+
+/*************************************builtin_false*****************************************
+*
+* The false built-in
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 1
+*
+*******************************************************************************************/
+int builtin_false(char** args){
+
+    (void) args;
+    return 1;
+}
+
+
+/*************************************builtin_pwd*****************************************
+*
+* The pwd built-in : pwd [-L|-P]. -L prints $PWD when it designates the working directory,
+* -P (the default, like /bin/pwd) the path without symbolic links.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_pwd(char** args){
+
+    bool logical = false;
+    for(int i = 1; args[i] != NULL; i++)
+        logical = !strcmp(args[i], "-L");
+
+    const char* pwd = getenv("PWD");
+    struct stat pwd_stat, dot_stat;
+
+    if(logical && pwd != NULL && pwd[0] == '/' && stat(pwd, &pwd_stat) == 0 && stat(".", &dot_stat) == 0 &&
+       pwd_stat.st_dev == dot_stat.st_dev && pwd_stat.st_ino == dot_stat.st_ino){
+        printf("%s\n", pwd);
+        return 0;
+    }
+
+    char* cwd = getcwd(NULL, 0);
+    if(cwd == NULL){
+        perror("pwd");
+        return 1;
+    }
+
+    printf("%s\n", cwd);
+    free(cwd);
+    return 0;
+}
+
+
+/*************************************test_integer*****************************************
+*
+* Convert an operand of an integer comparison of test
+*
+* ARGUMENT :
+*   - str : the operand
+*   - value : the value, set if successful
+*
+* RETURN : true if successful, false otherwise (the error is printed)
+*
+*******************************************************************************************/
+static bool test_integer(const char* str, long long* value){
+
+    char* end;
+    errno = 0;
+    *value = strtoll(str, &end, 10);
+
+    while(isspace((unsigned char)*end))
+        end++;
+
+    if(*str == 0 || *end != 0 || errno != 0){
+        fprintf(stderr, "test: %s: integer expression expected\n", str);
+        return false;
+    }
+
+    return true;
+}
+
+
+/*************************************test_unary*****************************************
+*
+* Evaluate a unary expression of test (-e FILE, -z STRING...)
+*
+* ARGUMENT :
+*   - op : the operator
+*   - operand : the operand
+*
+* RETURN : 1 if true, 0 if false, -1 if op isn't a unary operator
+*
+*******************************************************************************************/
+static int test_unary(const char* op, const char* operand){
+
+    if(op[0] != '-' || op[1] == 0 || op[2] != 0)
+        return -1;
+
+    struct stat st;
+
+    switch(op[1]){
+        case 'z': return operand[0] == 0;
+        case 'n': return operand[0] != 0;
+        case 't': return isatty(atoi(operand));
+        case 'r': return access(operand, R_OK) == 0;
+        case 'w': return access(operand, W_OK) == 0;
+        case 'x': return access(operand, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(operand, &st) == 0 && S_ISLNK(st.st_mode);
+        case 'e': case 'f': case 'd': case 's': case 'p': case 'S': case 'b':
+        case 'c': case 'g': case 'u': case 'k': case 'O': case 'G':
+            break;
+        default: return -1;
+    }
+
+    if(stat(operand, &st) != 0)
+        return 0;
+
+    switch(op[1]){
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+        default: return 1;
+    }
+}
+
+
+/*************************************test_binary*****************************************
+*
+* Evaluate a binary expression of test (A = B, A -lt B, F1 -nt F2...)
+*
+* ARGUMENT :
+*   - left : the left operand
+*   - op : the operator
+*   - right : the right operand
+*
+* RETURN : 1 if true, 0 if false, -1 if op isn't a binary operator, 2 on error
+*
+*******************************************************************************************/
+static int test_binary(const char* left, const char* op, const char* right){
+
+    if(!strcmp(op, "=") || !strcmp(op, "=="))
+        return strcmp(left, right) == 0;
+    if(!strcmp(op, "!="))
+        return strcmp(left, right) != 0;
+    if(!strcmp(op, "<"))
+        return strcmp(left, right) < 0;
+    if(!strcmp(op, ">"))
+        return strcmp(left, right) > 0;
+
+    static const char* integer_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    for(int i = 0; i < 6; i++){
+
+        if(strcmp(op, integer_ops[i]))
+            continue;
+
+        long long a, b;
+        if(!test_integer(left, &a) || !test_integer(right, &b))
+            return 2;
+
+        switch(i){
+            case 0: return a == b;
+            case 1: return a != b;
+            case 2: return a < b;
+            case 3: return a <= b;
+            case 4: return a > b;
+            default: return a >= b;
+        }
+    }
+
+    if(!strcmp(op, "-nt") || !strcmp(op, "-ot") || !strcmp(op, "-ef")){
+
+        struct stat a, b;
+        bool has_a = stat(left, &a) == 0, has_b = stat(right, &b) == 0;
+
+        if(op[1] == 'e')
+            return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+
+        //A missing file is older than any other
+        bool newer = has_a && (!has_b || a.st_mtim.tv_sec > b.st_mtim.tv_sec ||
+                     (a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec > b.st_mtim.tv_nsec));
+        bool older = has_b && (!has_a || b.st_mtim.tv_sec > a.st_mtim.tv_sec ||
+                     (a.st_mtim.tv_sec == b.st_mtim.tv_sec && b.st_mtim.tv_nsec > a.st_mtim.tv_nsec));
+        return op[1] == 'n' ? newer : older;
+    }
+
+    return -1;
+}
+
+
+/*************************************test_expression*****************************************
+*
+* Evaluate the expression of test made of the words [*pos, end), with the precedence
+* ! > -a > -o and parentheses. The POSIX rules for 1 to 4 words are followed by looking
+* for a binary operator in second position before anything else.
+*
+* ARGUMENT :
+*   - args : the words
+*   - pos : the word to start from, updated
+*   - end : the index after the last word
+*   - level : 0 for -o, 1 for -a, 2 for the operands
+*
+* RETURN : 1 if true, 0 if false, 2 on error
+*
+*******************************************************************************************/
+static int test_expression(char** args, int* pos, int end, int level){
+
+    if(*pos >= end){
+        fprintf(stderr, "test: argument expected\n");
+        return 2;
+    }
+
+    if(level < 2){
+
+        int result = test_expression(args, pos, end, level + 1);
+        const char* op = level == 0 ? "-o" : "-a";
+
+        while(result != 2 && *pos < end - 1 && !strcmp(args[*pos], op)){
+            (*pos)++;
+            int right = test_expression(args, pos, end, level + 1);
+            if(right == 2)
+                return 2;
+            result = level == 0 ? (result || right) : (result && right);
+        }
+
+        return result;
+    }
+
+    int remaining = end - *pos;
+    char* word = args[*pos];
+
+    //A binary operator in second position wins (test ! = x compares "!" and "x")
+    if(remaining >= 3){
+        int result = test_binary(word, args[*pos + 1], args[*pos + 2]);
+        if(result != -1){
+            *pos += 3;
+            return result;
+        }
+    }
+
+    if(!strcmp(word, "!") && remaining >= 2){
+        (*pos)++;
+        int result = test_expression(args, pos, end, 2);
+        return result == 2 ? 2 : !result;
+    }
+
+    if(!strcmp(word, "(") && remaining >= 3){
+        (*pos)++;
+        int result = test_expression(args, pos, end, 0);
+        if(result == 2)
+            return 2;
+        if(*pos >= end || strcmp(args[*pos], ")")){
+            fprintf(stderr, "test: ')' expected\n");
+            return 2;
+        }
+        (*pos)++;
+        return result;
+    }
+
+    if(remaining >= 2){
+        int result = test_unary(word, args[*pos + 1]);
+        if(result != -1){
+            *pos += 2;
+            return result;
+        }
+    }
+
+    //A single word is true when it isn't empty
+    (*pos)++;
+    return word[0] != 0;
+}
+
+
+/*************************************builtin_test*****************************************
+*
+* The test and [ built-ins : evaluate a conditional expression
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if the expression is true, 1 if it is false, 2 on error
+*
+*******************************************************************************************/
+int builtin_test(char** args){
+
+    int end = 1;
+    while(args[end] != NULL)
+        end++;
+
+    if(!strcmp(args[0], "[")){
+        if(strcmp(args[end - 1], "]")){
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        end--;
+    }
+
+    //No expression is false
+    if(end == 1)
+        return 1;
+
+    int pos = 1;
+    int result = test_expression(args, &pos, end, 0);
+    if(result == 2)
+        return 2;
+
+    if(pos != end){
+        fprintf(stderr, "test: %s: unexpected argument\n", args[pos]);
+        return 2;
+    }
+
+    return result ? 0 : 1;
+}
+
+
+/*************************************builtin_printf*****************************************
+*
+* The printf built-in : printf FORMAT ARGS... The format is reused while arguments are
+* left, missing arguments are empty strings or 0. Conversions : %s %b %c %d %i %o %u %x
+* %X %f %e %g %a (and upper case versions) with flags, width and precision.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 if an argument isn't a valid number
+*
+*******************************************************************************************/
+int builtin_printf(char** args){
+
+    const char* format = args[1];
+    char** arg = &args[2];
+    int ret = 0;
+
+    do{
+        bool used = false;
+
+        for(const char* p = format; *p != 0; p++){
+
+            if(*p == '\\'){
+                //Only one escape at a time
+                char escape[6] = {0};
+                int length = 1;
+                escape[0] = '\\';
+                if(p[1] != 0){
+                    escape[length++] = *++p;
+                    while(length < 4 && escape[1] >= '0' && escape[1] <= '7' && p[1] >= '0' && p[1] <= '7')
+                        escape[length++] = *++p;
+                    if(escape[1] == 'x')
+                        while(length < 4 && isxdigit((unsigned char)p[1]))
+                            escape[length++] = *++p;
+                }
+                if(print_escaped(escape, false))
+                    return ret;
+                continue;
+            }
+
+            if(*p != '%'){
+                putchar(*p);
+                continue;
+            }
+
+            if(p[1] == '%'){
+                putchar('%');
+                p++;
+                continue;
+            }
+
+            //Copy the conversion (flags, width, precision) to give it to printf
+            char spec[64];
+            size_t length = 0;
+            spec[length++] = *p++;
+            while(*p != 0 && strchr("#-+ 0123456789.", *p) != NULL && length < sizeof(spec) - 3)
+                spec[length++] = *p++;
+
+            char conversion = *p;
+            if(conversion == 0){
+                fprintf(stderr, "printf: missing conversion\n");
+                return 1;
+            }
+
+            const char* value = *arg != NULL ? *arg : "";
+            if(*arg != NULL)
+                arg++;
+            used = true;
+
+            if(conversion == 's' || conversion == 'b' || conversion == 'c'){
+
+                if(conversion == 'b'){
+                    spec[length] = 0;
+                    if(print_escaped(value, true))
+                        return ret;
+                    continue;
+                }
+
+                spec[length++] = conversion;
+                spec[length] = 0;
+                if(conversion == 'c')
+                    printf(spec, value[0]);
+                else
+                    printf(spec, value);
+            }
+            else if(strchr("diouxX", conversion) != NULL){
+
+                char* end;
+                long long number;
+                errno = 0;
+
+                //'c gives the code of the character c
+                if(value[0] == '\'' || value[0] == '"'){
+                    number = (unsigned char)value[1];
+                    end = (char*)value + strlen(value);
+                }
+                else if(conversion == 'd' || conversion == 'i')
+                    number = strtoll(value, &end, 0);
+                else
+                    number = (long long)strtoull(value, &end, 0);
+
+                if(*value != 0 && (*end != 0 || errno != 0)){
+                    fprintf(stderr, "printf: %s: invalid number\n", value);
+                    ret = 1;
+                }
+
+                spec[length++] = 'l';
+                spec[length++] = 'l';
+                spec[length++] = conversion;
+                spec[length] = 0;
+                printf(spec, number);
+            }
+            else if(strchr("feEgGaAF", conversion) != NULL){
+
+                char* end;
+                double number = strtod(value, &end);
+
+                if(*value != 0 && *end != 0){
+                    fprintf(stderr, "printf: %s: invalid number\n", value);
+                    ret = 1;
+                }
+
+                spec[length++] = conversion;
+                spec[length] = 0;
+                printf(spec, number);
+            }
+            else{
+                fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+                return 1;
+            }
+        }
+
+        //Stop if the format doesn't consume arguments
+        if(!used)
+            break;
+
+    } while(*arg != NULL);
+
+    return ret;
+}
+
+
+/*************************************sleep_seconds*****************************************
+*
+* Convert an argument of sleep (a number of seconds, with an optional s, m, h or d suffix)
+*
+* ARGUMENT :
+*   - str : the argument
+*   - seconds : the duration, set if successful
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool sleep_seconds(const char* str, double* seconds){
+
+    char* end;
+    *seconds = strtod(str, &end);
+
+    if(end == str || *seconds < 0 || *seconds != *seconds || *seconds > 1e9)
+        return false;
+
+    if(*end == 0 || !strcmp(end, "s"))
+        return true;
+    if(!strcmp(end, "m"))
+        *seconds *= 60;
+    else if(!strcmp(end, "h"))
+        *seconds *= 3600;
+    else if(!strcmp(end, "d"))
+        *seconds *= 86400;
+    else
+        return false;
+
+    return true;
+}
+
+
+/*************************************builtin_sleep*****************************************
+*
+* The sleep built-in : sleep for the sum of the durations given. The sleep goes on after
+* a signal (SIGCHLD of a background job) for the time left.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0
+*
+*******************************************************************************************/
+int builtin_sleep(char** args){
+
+    double total = 0;
+    for(int i = 1; args[i] != NULL; i++){
+        double seconds;
+        sleep_seconds(args[i], &seconds);
+        total += seconds;
+    }
+
+    struct timespec left = {.tv_sec = (time_t)total, .tv_nsec = (long)((total - (time_t)total) * 1e9)};
+    while(nanosleep(&left, &left) == -1 && errno == EINTR)
+        ;
+
+    return 0;
+}
+
+
+/*************************************supports_no_options*****************************************
+*
+* Check that a command has no option, i.e. that the built-in version can run it
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if no argument starts with '-' (apart from "-" itself)
+*
+*******************************************************************************************/
+static bool supports_no_options(char** args){
+
+    for(int i = 1; args[i] != NULL; i++){
+        if(args[i][0] == '-' && args[i][1] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+/*************************************supports_tee*****************************************
+*
+* Check that the tee built-in can run a command : tee [-a] FILE
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if the built-in can run the command, false otherwise
+*
+*******************************************************************************************/
+static bool supports_tee(char** args){
+
+    int i = 1;
+    if(args[i] != NULL && !strcmp(args[i], "-a"))
+        i++;
+
+    return args[i] != NULL && args[i][0] != '-' && args[i+1] == NULL;
+}
+
+
+/*************************************supports_no_help*****************************************
+*
+* Check that a command isn't a lone --help or --version (echo, [), only the external
+* command prints these
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if the built-in can run the command, false otherwise
+*
+*******************************************************************************************/
+static bool supports_no_help(char** args){
+
+    return args[1] == NULL || args[2] != NULL || strncmp(args[1], "--", 2);
+}
+
+
+/*************************************supports_pwd*****************************************
+*
+* Check that the pwd built-in can run a command : pwd [-L|-P]...
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if the built-in can run the command, false otherwise
+*
+*******************************************************************************************/
+static bool supports_pwd(char** args){
+
+    for(int i = 1; args[i] != NULL; i++){
+        if(strcmp(args[i], "-L") && strcmp(args[i], "-P"))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*************************************supports_printf*****************************************
+*
+* Check that the printf built-in can run a command : a format without options, without
+* * for the width or the precision and with only the conversions it knows (the others, like
+* %q, are left to the external printf)
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if the built-in can run the command, false otherwise
+*
+*******************************************************************************************/
+static bool supports_printf(char** args){
+
+    if(args[1] == NULL || (args[1][0] == '-' && args[1][1] != 0) || strchr(args[1], '*') != NULL)
+        return false;
+
+    //Read like builtin_printf does : an escape hides the next character
+    for(const char* p = args[1]; *p != 0; p++){
+
+        if(*p == '\\' && p[1] != 0)
+            p++;
+
+        else if(*p == '%' && p[1] == '%')
+            p++;
+
+        else if(*p == '%'){
+            p += 1 + strspn(p + 1, "#-+ 0123456789.");
+            if(*p == 0 || strchr("sbcdiouxXfeEgGaAF", *p) == NULL)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*************************************supports_sleep*****************************************
+*
+* Check that the sleep built-in can run a command : finite durations only
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : true if the built-in can run the command, false otherwise
+*
+*******************************************************************************************/
+static bool supports_sleep(char** args){
+
+    if(args[1] == NULL)
+        return false;
+
+    for(int i = 1; args[i] != NULL; i++){
+        double seconds;
+        if(!sleep_seconds(args[i], &seconds))
+            return false;
+    }
+
+    return true;
+}
+
+
+//Built-in commands, run by the shell itself
+struct builtin{
+    const char* name;
+    int (*function)(char** args);
+    bool (*supports)(char** args); //NULL if every use of the command is supported
+};
+
+static const struct builtin builtins[] = {
+    {"cd", builtin_cd, NULL},
+    {"sys", builtin_sys, NULL},
+    {"hash", builtin_hash, NULL},
+    {"launch", builtin_launch, NULL},
+    {"cat", builtin_cat, supports_no_options},
+    {"tee", builtin_tee, supports_tee},
+    {"jobs", builtin_jobs, NULL},
+    {"wait", builtin_wait, NULL},
+    {"fg", builtin_fg, NULL},
+    {"unset", builtin_unset, NULL},
+    {"stats", builtin_stats, NULL},
+    {"parallel", builtin_parallel, NULL},
+    {"xargs", builtin_xargs, NULL},
+    {"echo", builtin_echo, supports_no_help},
+    {"true", builtin_true, NULL},
+    {"false", builtin_false, NULL},
+    {"pwd", builtin_pwd, supports_pwd},
+    {"test", builtin_test, NULL},
+    {"[", builtin_test, supports_no_help},
+    {"printf", builtin_printf, supports_printf},
+    {"sleep", builtin_sleep, supports_sleep},
+    {"history", builtin_history, NULL},
+};
+
+
+/*************************************find_builtin*****************************************
+*
+* Find the built-in able to run a command
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the command
+*
+* RETURN : the built-in, NULL if the command must be run as an external command
+*
+*******************************************************************************************/
+const struct builtin* find_builtin(char** args){
+
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++){
+
+        if(!strcmp(args[0], builtins[i].name)){
+
+            if(builtins[i].supports != NULL && !builtins[i].supports(args))
+                return NULL;
+            return &builtins[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*************************************builtin_output*****************************************
+*
+* Check that what a built-in printed could be written, like the utility it replaces : echo
+* > /dev/full fails
+*
+* ARGUMENT :
+*   - name : the name of the built-in
+*   - ret : its return value
+*   - flush : true to write what is still buffered first
+*
+* RETURN : ret, 1 if the built-in succeeded but its output was lost
+*
+*******************************************************************************************/
+static int builtin_output(const char* name, int ret, bool flush){
+
+    if(flush)
+        fflush(stdout);
+    if(!ferror(stdout))
+        return ret;
+
+    //A built-in that failed already reported why
+    if(ret == 0){
+        fprintf(stderr, "%s: write error: %s\n", name, strerror(errno));
+        ret = 1;
+    }
+
+    clearerr(stdout);
+    return ret;
+}
+
+
+/*************************************start_stage*****************************************
+*
+* Start one command of a pipeline with its pipes and redirections set up.
+* External commands are spawned, built-ins need a forked shell to run in.
+*
+* ARGUMENT :
+*   - args : the arguments of the command
+*   - moves : the file descriptors to set up in the child
+*
+* RETURN : the pid of the child, -1 if the command couldn't be started
+*
+*******************************************************************************************/
+static pid_t start_stage(char** args, const struct fd_moves* moves){
+
+    pid_t pid;
+    const struct builtin* builtin = find_builtin(args);
+
+    if(builtin != NULL){
+
+        pid = fork();
+
+        //Error
+        if(pid < 0){
+            perror("Process creation failed");
+            return -1;
+        }
+
+        //This is the son
+        if(pid == 0){
+
+            //The handler stays : built-ins like parallel wait for their own children
+            block_sigchld(false);
+
+            fd_moves_apply(moves);
+
+            int ret = builtin_output(args[0], builtin->function(args), true);
+            _exit(ret & 0xff);
+        }
+
+        return pid;
+    }
+
+    //Find the command before forking
+    const char* cmd_path = args[0];
+
+    if(strchr(args[0], '/') == NULL){
+
+        cmd_path = lookup_command(args[0]);
+        if(cmd_path == NULL){
+            printf("Command does not exist\n");
+            fflush(stdout);
+            return -1;
+        }
+    }
+
+    int launch_error = launch_command(cmd_path, args, moves, &pid);
+
+    //The remembered binary disappeared : like bash, forget it and search $PATH again once
+    if(launch_error == ENOENT && cmd_path != args[0]){
+
+        cmd_hash_remove(args[0]);
+
+        cmd_path = lookup_command(args[0]);
+        if(cmd_path == NULL){
+            printf("Command does not exist\n");
+            fflush(stdout);
+            return -1;
+        }
+
+        launch_error = launch_command(cmd_path, args, moves, &pid);
+    }
+
+    //The command couldn't be started
+    if(launch_error != 0){
+        fprintf(stderr, "Instruction failed: %s\n", strerror(launch_error));
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/*************************************now_ns*****************************************
+*
+* Read the monotonic clock (async-signal-safe, used by the SIGCHLD handler)
+*
+* ARGUMENT : /
+*
+* RETURN : the time in nanoseconds
+*
+*******************************************************************************************/
+long long now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*************************************stats_bucket*****************************************
+*
+* Get the histogram bucket of a latency. Like HDR histograms, values under 8 have their
+* own bucket, then each power of two from 8 on is split in 8 buckets (12.5% precision).
+*
+* ARGUMENT :
+*   - us : the latency in microseconds
+*
+* RETURN : the index of the bucket
+*
+*******************************************************************************************/
+static int stats_bucket(long long us){
+
+    if(us < 8)
+        return us < 0 ? 0 : us;
+
+    int msb = 63 - __builtin_clzll(us);
+    return 8 + (msb - 3) * 8 + ((us >> (msb - 3)) & 7);
+}
+
+
+/*************************************stats_bucket_max*****************************************
+*
+* Get the highest latency falling in a bucket
+*
+* ARGUMENT :
+*   - bucket : the index of the bucket
+*
+* RETURN : the latency in microseconds
+*
+*******************************************************************************************/
+static long long stats_bucket_max(int bucket){
+
+    if(bucket < 8)
+        return bucket;
+
+    int msb = (bucket - 8) / 8 + 3;
+    long long sub = (bucket - 8) % 8;
+    return ((8 + sub + 1) << (msb - 3)) - 1;
+}
+
+
+/*************************************stats_slot*****************************************
+*
+* Find the slot of a command in the statistics table (linear probing)
+*
+* ARGUMENT :
+*   - name : the name of the command
+*
+* RETURN : the index of the slot holding the command, or of the free slot ending the probe
+*
+*******************************************************************************************/
+static size_t stats_slot(const char* name){
+
+    size_t mask = stats_capacity - 1;
+    size_t i = hash_string(name) & mask;
+
+    while(stats_table[i] != NULL && strcmp(stats_table[i]->name, name))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+
+/*************************************stats_record*****************************************
+*
+* Account one run of a command
+*
+* ARGUMENT :
+*   - name : the name of the command
+*   - wall_ns : the time between its start and its end
+*   - launch_ns : the time spent starting it
+*   - usage : the resources it used (NULL if unknown)
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void stats_record(const char* name, long long wall_ns, long long launch_ns, const struct rusage* usage){
+
+    //Keep the load factor under 1/2
+    if((stats_count + 1) * 2 > stats_capacity){
+
+        struct command_stats** old_table = stats_table;
+        size_t old_capacity = stats_capacity;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 64;
+
+        struct command_stats** new_table = calloc(new_capacity, sizeof(struct command_stats*));
+        if(new_table == NULL)
+            return;
+
+        stats_table = new_table;
+        stats_capacity = new_capacity;
+
+        for(size_t i = 0; i < old_capacity; i++){
+            if(old_table[i] != NULL)
+                stats_table[stats_slot(old_table[i]->name)] = old_table[i];
+        }
+
+        free(old_table);
+    }
+
+    size_t i = stats_slot(name);
+
+    if(stats_table[i] == NULL){
+
+        struct command_stats* stats = calloc(1, sizeof(struct command_stats));
+        if(stats == NULL)
+            return;
+
+        stats->name = strdup(name);
+        if(stats->name == NULL){
+            free(stats);
+            return;
+        }
+
+        stats_table[i] = stats;
+        stats_count++;
+    }
+
+    struct command_stats* stats = stats_table[i];
+    long long wall_us = wall_ns / 1000;
+
+    stats->count++;
+    stats->total_us += wall_us;
+    stats->launch_us += launch_ns / 1000;
+    if(wall_us > stats->max_us)
+        stats->max_us = wall_us;
+    stats->buckets[stats_bucket(wall_us)]++;
+
+    if(usage != NULL){
+        stats->user_us += usage->ru_utime.tv_sec * 1000000LL + usage->ru_utime.tv_usec;
+        stats->system_us += usage->ru_stime.tv_sec * 1000000LL + usage->ru_stime.tv_usec;
+    }
+}
+
+
+/*************************************stats_percentile*****************************************
+*
+* Get a percentile of the latencies of a command from its histogram
+*
+* ARGUMENT :
+*   - stats : the statistics of the command
+*   - percent : the percentile (e.g. 99)
+*
+* RETURN : the latency in microseconds (upper bound of its bucket)
+*
+*******************************************************************************************/
+static long long stats_percentile(struct command_stats* stats, int percent){
+
+    unsigned long rank = (stats->count * percent + 99) / 100;
+    unsigned long seen = 0;
+
+    for(int b = 0; b < STATS_BUCKETS; b++){
+        seen += stats->buckets[b];
+        if(seen >= rank && seen > 0)
+            return stats_bucket_max(b) < stats->max_us ? stats_bucket_max(b) : stats->max_us;
+    }
+
+    return stats->max_us;
+}
+
+
+/*************************************stats_reset*****************************************
+*
+* Forget the statistics of every command
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void stats_reset(void){
+
+    for(size_t i = 0; i < stats_capacity; i++){
+        if(stats_table[i] != NULL){
+            free(stats_table[i]->name);
+            free(stats_table[i]);
+            stats_table[i] = NULL;
+        }
+    }
+
+    stats_count = 0;
+}
+
+
+/*************************************builtin_stats*****************************************
+*
+* The stats built-in :
+*   - stats : print the latency and resources of every command run so far
+*   - stats NAME... : print them with the histogram of the given commands
+*   - stats -r : forget everything
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0 if successful, 1 if one of the commands was never run
+*
+*******************************************************************************************/
+int builtin_stats(char** args){
+
+    if(args[1] != NULL && !strcmp(args[1], "-r")){
+        stats_reset();
+        return 0;
+    }
+
+    printf("%-20s %8s %10s %10s %10s %10s %10s %10s %10s %10s\n", "command", "count", "mean_us",
+           "p50_us", "p90_us", "p99_us", "max_us", "start_us", "user_ms", "sys_ms");
+
+    int ret = 0;
+
+    for(size_t i = 0; i < stats_capacity; i++){
+
+        struct command_stats* stats = stats_table[i];
+        if(stats == NULL)
+            continue;
+
+        //Only the given commands
+        bool selected = (args[1] == NULL);
+        for(int k = 1; args[k] != NULL && !selected; k++)
+            selected = !strcmp(args[k], stats->name);
+        if(!selected)
+            continue;
+
+        printf("%-20s %8lu %10lld %10lld %10lld %10lld %10lld %10lld %10.1f %10.1f\n",
+               stats->name, stats->count, stats->total_us / (long long) stats->count,
+               stats_percentile(stats, 50), stats_percentile(stats, 90),
+               stats_percentile(stats, 99), stats->max_us,
+               stats->launch_us / (long long) stats->count,
+               stats->user_us / 1000.0, stats->system_us / 1000.0);
+
+        if(args[1] == NULL)
+            continue;
+
+        //Histogram
+        for(int b = 0; b < STATS_BUCKETS; b++){
+            if(stats->buckets[b] != 0)
+                printf("  <= %10lld us : %lu\n", stats_bucket_max(b), stats->buckets[b]);
+        }
+    }
+
+    for(int k = 1; args[k] != NULL; k++){
+        if(stats_count == 0 || stats_table[stats_slot(args[k])] == NULL){
+            fprintf(stderr, "stats: %s: never run\n", args[k]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+
+/*************************************print_time*****************************************
+*
+* Print the report of the time prefix
+*
+* ARGUMENT :
+*   - wall_ns : the elapsed time
+*   - usage : the resources used
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void print_time(long long wall_ns, const struct rusage* usage){
+
+    fflush(stdout);
+    fprintf(stderr, "\nreal %.3fs user %.3fs sys %.3fs maxrss %ldKB\n", wall_ns / 1e9,
+            usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+            usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, usage->ru_maxrss);
+}
+
+
+/*************************************status_code*****************************************
+*
+* Convert a status returned by waitpid to the value of $?
+*
+* ARGUMENT :
+*   - status : the status returned by waitpid
+*
+* RETURN : the exit value of the command, 128 + the signal number if it was killed
+*
+*******************************************************************************************/
+static int status_code(int status){
+
+    if(WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+
+    return WEXITSTATUS(status);
+}
+
+
+/*************************************job_child_exited*****************************************
+*
+* Record the end of a child in the job it belongs to. Called by the SIGCHLD handler, the
+* rest of the shell only touches the job table with SIGCHLD blocked.
+*
+* ARGUMENT :
+*   - pid : the pid of the child
+*   - status : the status returned by wait4
+*   - usage : the resources used by the child
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void job_child_exited(pid_t pid, int status, const struct rusage* usage){
+
+    for(int i = 0; i < jobs_capacity; i++){
+
+        struct job* job = jobs[i];
+        if(job == NULL)
+            continue;
+
+        for(int k = 0; k < job->nb_stages; k++){
+
+            struct job_stage* stage = &job->stages[k];
+            if(stage->pid == pid){
+                stage->pid = 0;
+                stage->status = status_code(status);
+                stage->end_ns = now_ns();
+                stage->usage = *usage;
+                job->nb_running--;
+                return;
+            }
+        }
+    }
+}
+
+
+/*************************************sigchld_handler*****************************************
+*
+* Reap every child that ended, so that no zombie is left even while the shell is waiting
+* for the user. wait4 also gives the resources used by the child.
+*
+* ARGUMENT :
+*   - sig : the signal number (SIGCHLD)
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void sigchld_handler(int sig){
+
+    (void) sig;
+    int saved_errno = errno;
+    pid_t pid;
+    int status;
+    struct rusage usage;
+
+    while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+        job_child_exited(pid, status, &usage);
+
+    errno = saved_errno;
+}
+
+
+/*************************************block_sigchld*****************************************
+*
+* Block (or unblock) SIGCHLD, i.e. keep the handler away from the job table
+*
+* ARGUMENT :
+*   - block : true to block SIGCHLD, false to unblock it
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void block_sigchld(bool block){
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+
+/*************************************job_create*****************************************
+*
+* Add a job to the job table (SIGCHLD must be blocked)
+*
+* ARGUMENT :
+*   - nb_stages : the number of commands of the job
+*   - command : the command line, for jobs and fg (NULL for foreground jobs)
+*   - background : true if the shell doesn't wait for the job
+*
+* RETURN : the new job, NULL if it couldn't be allocated
+*
+*******************************************************************************************/
+struct job* job_create(int nb_stages, char* command, bool background){
+
+    int slot = 0;
+    while(slot < jobs_capacity && jobs[slot] != NULL)
+        slot++;
+
+    //The table is full, double its size
+    if(slot == jobs_capacity){
+
+        int new_capacity = jobs_capacity ? jobs_capacity * 2 : 16;
+        struct job** new_jobs = realloc(jobs, new_capacity * sizeof(struct job*));
+        if(new_jobs == NULL){
+            perror("Job table couldn't be allocated");
+            return NULL;
+        }
+
+        for(int i = jobs_capacity; i < new_capacity; i++)
+            new_jobs[i] = NULL;
+        jobs = new_jobs;
+        jobs_capacity = new_capacity;
+    }
+
+    struct job* job = job_spare;
+
+    if(job != NULL && job->stages_capacity >= nb_stages){
+
+        struct job_stage* stages = job->stages;
+        int capacity = job->stages_capacity;
+
+        job_spare = NULL;
+        memset(job, 0, sizeof(struct job));
+        memset(stages, 0, nb_stages * sizeof(struct job_stage));
+        job->stages = stages;
+        job->stages_capacity = capacity;
+    }
+    else{
+
+        job = calloc(1, sizeof(struct job));
+        if(job != NULL)
+            job->stages = calloc(nb_stages, sizeof(struct job_stage));
+
+        if(job == NULL || job->stages == NULL){
+            perror("Job couldn't be allocated");
+            free(job);
+            return NULL;
+        }
+        job->stages_capacity = nb_stages;
+    }
+
+    static unsigned long sequence = 0;
+
+    job->id = slot + 1;
+    job->nb_stages = nb_stages;
+    job->background = background;
+    job->command = command;
+    job->sequence = ++sequence;
+    jobs[slot] = job;
+
+    return job;
+}
+
+
+/*************************************job_remove*****************************************
+*
+* Remove a job from the job table and record the statistics of its commands (SIGCHLD must
+* be blocked)
+*
+* ARGUMENT :
+*   - job : the job to remove
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void job_remove(struct job* job){
+
+    //Account the commands that ended
+    for(int k = 0; k < job->nb_stages; k++){
+        struct job_stage* stage = &job->stages[k];
+        if(stage->start_ns != 0 && stage->end_ns != 0)
+            stats_record(stage->name, stage->end_ns - stage->start_ns, stage->launch_ns, &stage->usage);
+    }
+
+    jobs[job->id - 1] = NULL;
+    free(job->command);
+    job->command = NULL;
+
+    //The largest job is kept for the next one
+    if(job_spare != NULL && job_spare->stages_capacity < job->stages_capacity){
+        free(job_spare->stages);
+        free(job_spare);
+        job_spare = NULL;
+    }
+
+    if(job_spare == NULL)
+        job_spare = job;
+    else{
+        free(job->stages);
+        free(job);
+    }
+}
+
+
+/*************************************job_forget*****************************************
+*
+* Remove the oldest ended background jobs beyond JOBS_DONE_KEPT. Only the interactive
+* prompt reports and removes them (see notify_jobs) : the table would otherwise keep
+* growing in scripts and with -c. SIGCHLD must be blocked.
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void job_forget(void){
+
+    while(true){
+
+        struct job* oldest = NULL;
+        int nb_done = 0;
+
+        for(int i = 0; i < jobs_capacity; i++){
+
+            struct job* job = jobs[i];
+            if(job == NULL || !job->background || job->nb_running > 0)
+                continue;
+
+            nb_done++;
+            if(oldest == NULL || job->sequence < oldest->sequence)
+                oldest = job;
+        }
+
+        if(nb_done <= JOBS_DONE_KEPT)
+            return;
+
+        job_remove(oldest);
+    }
+}
+
+
+/*************************************job_wait*****************************************
+*
+* Wait until every command of a job ended (SIGCHLD must be blocked)
+*
+* ARGUMENT :
+*   - job : the job to wait for
+*
+* RETURN : the exit value of the last command of the job
+*
+*******************************************************************************************/
+int job_wait(struct job* job){
+
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+
+    //Sleep until the handler reaped the children
+    while(job->nb_running > 0)
+        sigsuspend(&mask);
+
+    return job->stages[job->nb_stages - 1].status;
+}
+
+
+/*************************************find_job*****************************************
+*
+* Find a background job from the way the user designates it (SIGCHLD must be blocked)
+*
+* ARGUMENT :
+*   - spec : "%N" for the job number N, a pid, or NULL for the most recent job
+*
+* RETURN : the job, NULL if there is no such job
+*
+*******************************************************************************************/
+struct job* find_job(const char* spec){
+
+    struct job* found = NULL;
+    int id = 0;
+    pid_t pid = 0;
+
+    if(spec != NULL){
+        if(spec[0] == '%')
+            id = atoi(spec + 1);
+        else
+            pid = atoi(spec);
+    }
+
+    for(int i = 0; i < jobs_capacity; i++){
+
+        struct job* job = jobs[i];
+        if(job == NULL || !job->background)
+            continue;
+
+        if(spec == NULL){
+            if(found == NULL || job->sequence > found->sequence)
+                found = job;
+        }
+        else if(id != 0 && job->id == id)
+            return job;
+        else if(pid != 0 && job->last_pid == pid)
+            return job;
+    }
+
+    return found;
+}
+
+
+/*************************************print_job*****************************************
+*
+* Print the state of a background job
+*
+* ARGUMENT :
+*   - job : the job
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void print_job(struct job* job){
+
+    int status = job->stages[job->nb_stages - 1].status;
+
+    if(job->nb_running > 0)
+        printf("[%d] Running\t%s\n", job->id, job->command);
+    else if(status == 0)
+        printf("[%d] Done\t%s\n", job->id, job->command);
+    else
+        printf("[%d] Exit %d\t%s\n", job->id, status, job->command);
+}
+
+
+/*************************************notify_jobs*****************************************
+*
+* Report the background jobs that ended and remove them from the table
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void notify_jobs(void){
+
+    block_sigchld(true);
+
+    for(int i = 0; i < jobs_capacity; i++){
+
+        struct job* job = jobs[i];
+        if(job != NULL && job->background && job->nb_running == 0){
+            print_job(job);
+            job_remove(job);
+        }
+    }
+
+    block_sigchld(false);
+}
+
+
+/*************************************builtin_jobs*****************************************
+*
+* The jobs built-in : list the background jobs. The ended ones are then forgotten.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : 0
+*
+*******************************************************************************************/
+int builtin_jobs(char** args){
+
+    (void) args;
+
+    block_sigchld(true);
+
+    for(int i = 0; i < jobs_capacity; i++){
+
+        struct job* job = jobs[i];
+        if(job == NULL || !job->background)
+            continue;
+
+        print_job(job);
+        if(job->nb_running == 0)
+            job_remove(job);
+    }
+
+    block_sigchld(false);
+    return 0;
+}
+
+
+/*************************************builtin_wait*****************************************
+*
+* The wait built-in :
+*   - wait : wait for every background job
+*   - wait %N|PID... : wait for the given jobs
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : the exit value of the last job waited for, 127 if it doesn't exist
+*
+*******************************************************************************************/
+int builtin_wait(char** args){
+
+    int ret = 0;
+
+    block_sigchld(true);
+
+    if(args[1] == NULL){
+
+        for(int i = 0; i < jobs_capacity; i++){
+            if(jobs[i] != NULL && jobs[i]->background){
+                job_wait(jobs[i]);
+                job_remove(jobs[i]);
+            }
+        }
+    }
+
+    for(int i = 1; args[i] != NULL; i++){
+
+        struct job* job = find_job(args[i]);
+        if(job == NULL){
+            fprintf(stderr, "wait: %s: no such job\n", args[i]);
+            ret = 127;
+            continue;
+        }
+
+        ret = job_wait(job);
+        job_remove(job);
+    }
+
+    block_sigchld(false);
+    return ret;
+}
+
+
+/*************************************builtin_fg*****************************************
+*
+* The fg built-in : bring a background job (the most recent one by default) back to the
+* foreground, i.e. wait for it
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : the exit value of the job, 1 if it doesn't exist
+*
+*******************************************************************************************/
+int builtin_fg(char** args){
+
+    block_sigchld(true);
+
+    struct job* job = find_job(args[1]);
+    if(job == NULL){
+        block_sigchld(false);
+        fprintf(stderr, "fg: no such job\n");
+        return 1;
+    }
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+
+    int ret = job_wait(job);
+    job_remove(job);
+
+    block_sigchld(false);
+    return ret;
+}
+
+
+/*************************************parallel_start*****************************************
+*
+* Start one command of parallel : every {} of the command is replaced by the argument (the
+* argument is added at the end if there is no {}). The output goes to a memory file so that
+* it can be printed in one piece once the command ended.
+*
+* ARGUMENT :
+*   - job : the job of parallel
+*   - k : the number of the command in the job
+*   - command : the command, ending with NULL
+*   - argument : the argument of this command
+*   - in_fd : the stdin of the command, -1 to keep the shell's
+*   - output : the memory file receiving the output, -1 if it couldn't be created
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void parallel_start(struct job* job, int k, char** command, const char* argument, int in_fd, int* output){
+
+    int nb_words = 0;
+    while(command[nb_words] != NULL)
+        nb_words++;
+
+    //The argument may be added at the end
+    char** argv = malloc((nb_words + 2) * sizeof(char*));
+    bool* allocated = malloc((nb_words + 1) * sizeof(bool));
+    if(argv == NULL || allocated == NULL){
+        perror("Command couldn't be allocated");
+        free(argv);
+        free(allocated);
+        *output = -1;
+        job->stages[k].status = 1;
+        job->stages[k].start_ns = 0;
+        return;
+    }
+
+    bool replaced = false;
+    int n = 0;
+
+    for(; command[n] != NULL; n++){
+
+        argv[n] = command[n];
+        allocated[n] = false;
+
+        char* brace = strstr(command[n], "{}");
+        if(brace == NULL)
+            continue;
+
+        //Count the {} to size the new word
+        int nb_braces = 0;
+        for(char* p = brace; p != NULL; p = strstr(p + 2, "{}"))
+            nb_braces++;
+
+        char* word = malloc(strlen(command[n]) + nb_braces * strlen(argument) + 1);
+        if(word == NULL)
+            continue;
+
+        char* out = word;
+        for(const char* in = command[n]; *in != 0; ){
+            if(in[0] == '{' && in[1] == '}'){
+                out = stpcpy(out, argument);
+                in += 2;
+            }
+            else
+                *out++ = *in++;
+        }
+        *out = 0;
+
+        argv[n] = word;
+        allocated[n] = true;
+        replaced = true;
+    }
+
+    if(!replaced){
+        argv[n] = (char*)argument;
+        allocated[n++] = false;
+    }
+    argv[n] = NULL;
+
+    *output = memfd_create("parallel", MFD_CLOEXEC);
+
+    struct job_stage* stage = &job->stages[k];
+    snprintf(stage->name, sizeof(stage->name), "%s", argv[0]);
+
+    struct fd_moves moves;
+    fd_moves_init(&moves, in_fd, *output);
+
+    long long start = now_ns();
+    pid_t pid = start_stage(argv, &moves);
+
+    if(pid != -1){
+        stage->pid = pid;
+        stage->start_ns = start;
+        stage->launch_ns = now_ns() - start;
+        job->nb_running++;
+    }
+    else{
+        stage->status = 1;
+        stage->start_ns = 0;
+    }
+
+    for(int i = 0; i < n; i++){
+        if(allocated[i])
+            free(argv[i]);
+    }
+    free(argv);
+    free(allocated);
+}
+
+
+/*************************************builtin_parallel*****************************************
+*
+* The parallel built-in : parallel [-j N] COMMAND ::: ARGS... runs COMMAND once per
+* argument (read one per line from stdin without :::), with at most N commands at the same
+* time (the number of CPUs by default). A new command starts as soon as one ends, in the
+* stage it leaves : the memory used doesn't depend on the number of arguments, the lines
+* of stdin are read as the commands start (the commands then read /dev/null). The output
+* of each command is printed in one piece when it ends, followed on stderr by its exit
+* value and duration, then by a summary.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the line entered by the user
+*
+* RETURN : the number of commands that failed (101 if more than 100), like GNU parallel
+*
+*******************************************************************************************/
+int builtin_parallel(char** args){
+
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int k = 1;
+
+    while(args[k] != NULL && args[k][0] == '-'){
+
+        if(!strcmp(args[k], "--")){
+            k++;
+            break;
+        }
+
+        const char* value = NULL;
+        if(!strcmp(args[k], "-j") && args[k + 1] != NULL)
+            value = args[++k];
+        else if(!strncmp(args[k], "-j", 2) && args[k][2] != 0)
+            value = args[k] + 2;
+
+        if(value == NULL || atol(value) <= 0){
+            fprintf(stderr, "parallel: usage: parallel [-j N] COMMAND [::: ARGS...]\n");
+            return 1;
+        }
+
+        max_jobs = atol(value);
+        k++;
+    }
+
+    char** command = &args[k];
+    int nb_words = 0;
+    while(command[nb_words] != NULL && strcmp(command[nb_words], ":::"))
+        nb_words++;
+
+    if(nb_words == 0){
+        fprintf(stderr, "parallel: missing command\n");
+        return 1;
+    }
+
+    //Arguments after :::, or the lines of stdin
+    char** arguments = NULL;
+    bool from_stdin = command[nb_words] == NULL;
+    int in_fd = -1;
+    FILE* input = NULL;
+
+    if(!from_stdin){
+        command[nb_words] = NULL;
+        arguments = &command[nb_words + 1];
+
+        long nb_arguments = 0;
+        while(arguments[nb_arguments] != NULL)
+            nb_arguments++;
+        if(nb_arguments == 0)
+            return 0;
+        if(max_jobs > nb_arguments)
+            max_jobs = nb_arguments;
+    }
+    else{
+
+        //Read through its own stream : the shell's stdin FILE may be reading a script, not
+        //the redirected file descriptor
+        int stdin_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        input = stdin_fd != -1 ? fdopen(stdin_fd, "r") : NULL;
+        if(input == NULL){
+            perror("parallel: stdin");
+            if(stdin_fd != -1)
+                close(stdin_fd);
+            return 1;
+        }
+
+        if((in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1){
+            perror("parallel: /dev/null");
+            fclose(input);
+            return 1;
+        }
+    }
+
+    if(max_jobs > 1024)
+        max_jobs = 1024;
+
+    int ret = 0;
+    struct parallel_slot* slots = malloc(max_jobs * sizeof(struct parallel_slot));
+    char* line = NULL;
+    size_t len = 0;
+
+    //The children must be in the job table before the handler can reap them
+    block_sigchld(true);
+    struct job* job = slots != NULL ? job_create(max_jobs, NULL, false) : NULL;
+
+    if(job != NULL){
+
+        sigset_t mask;
+        sigprocmask(SIG_SETMASK, NULL, &mask);
+        sigdelset(&mask, SIGCHLD);
+
+        for(int i = 0; i < max_jobs; i++)
+            slots[i].argument = NULL;
+
+        //The outputs are written directly to stdout
+        fflush(stdout);
+
+        long long start = now_ns();
+        long nb_started = 0, nb_failed = 0;
+        bool end = false;
+
+        while(true){
+
+            //Keep max_jobs commands running
+            for(int i = 0; i < max_jobs && !end; i++){
+
+                if(slots[i].argument != NULL)
+                    continue;
+
+                char* argument = NULL;
+                ssize_t length;
+
+                if(!from_stdin)
+                    argument = arguments[nb_started];
+                else{
+                    //Empty lines are skipped
+                    while((length = getline(&line, &len, input)) != -1){
+                        if(length > 0 && line[length - 1] == '\n')
+                            line[--length] = 0;
+                        if(length > 0 && (argument = strdup(line)) != NULL)
+                            break;
+                    }
+                }
+
+                if(argument == NULL){
+                    end = true;
+                    break;
+                }
+
+                slots[i].argument = argument;
+                slots[i].index = nb_started++;
+                parallel_start(job, i, command, argument, in_fd, &slots[i].output);
+            }
+
+            //Print the commands that ended, by number of argument
+            bool progress = false, busy = false;
+            while(true){
+
+                struct parallel_slot* slot = NULL;
+                for(int i = 0; i < max_jobs; i++){
+                    if(slots[i].argument != NULL && job->stages[i].pid == 0 &&
+                       (slot == NULL || slots[i].index < slot->index))
+                        slot = &slots[i];
+                }
+                if(slot == NULL)
+                    break;
+
+                progress = true;
+                struct job_stage* stage = &job->stages[slot - slots];
+
+                if(slot->output != -1){
+                    lseek(slot->output, 0, SEEK_SET);
+                    forward_fd(slot->output, STDOUT_FILENO);
+                    close(slot->output);
+                }
+
+                if(stage->status != 0)
+                    nb_failed++;
+
+                double ms = stage->start_ns ? (stage->end_ns - stage->start_ns) / 1e6 : 0;
+                fprintf(stderr, "parallel: %s: exit %d, %.3f ms\n", slot->argument, stage->status, ms);
+
+                if(from_stdin)
+                    free(slot->argument);
+                slot->argument = NULL;
+            }
+
+            for(int i = 0; i < max_jobs; i++)
+                busy |= slots[i].argument != NULL;
+
+            if(end && !busy)
+                break;
+
+            //Sleep until a command ends
+            if(!progress && job->nb_running > 0)
+                sigsuspend(&mask);
+        }
+
+        if(nb_started > 0)
+            fprintf(stderr, "parallel: %ld commands, %ld failed, %.3f ms\n", nb_started, nb_failed,
+                    (now_ns() - start) / 1e6);
+
+        job_remove(job);
+        ret = nb_failed > 100 ? 101 : nb_failed;
+    }
+    else{
+        perror("parallel: commands couldn't be allocated");
+        ret = 1;
+    }
+
+    block_sigchld(false);
+
+    free(slots);
+    free(line);
+    if(from_stdin){
+        fclose(input);
+        close(in_fd);
+    }
+
+    return ret;
+}
+
+
+/*************************************xargs_collect*****************************************
+*
+* Account a batch of xargs that ended, before its slot is reused (SIGCHLD must be blocked).
+* Like GNU xargs, no other batch starts once one exited with 255 or was killed.
+*
+* ARGUMENT :
+*   - stage : the slot of the batch
+*   - ret : the return value of xargs, 123 if the batch failed, 124 or 125 to stop
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void xargs_collect(struct job_stage* stage, int* ret){
+
+    if(stage->start_ns == 0 || stage->pid != 0)
+        return;
+
+    int code = stage->status == 255 ? 124 : stage->status > 128 ? 125 : stage->status != 0 ? 123 : 0;
+    if(code > *ret)
+        *ret = code;
+
+    stats_record(stage->name, stage->end_ns - stage->start_ns, stage->launch_ns, &stage->usage);
+    stage->start_ns = 0;
+}
+
+
+/*************************************xargs_start*****************************************
+*
+* Start a batch of xargs in a free slot of its job, after waiting for one if they are all
+* busy (SIGCHLD must be blocked). The arguments are copied by the start of the command :
+* their buffer can be filled again as soon as this returns.
+*
+* ARGUMENT :
+*   - job : the job of xargs, one stage per slot
+*   - argv : the command and its arguments
+*   - null_fd : /dev/null, the stdin of the command
+*   - ret : the return value of xargs (see xargs_collect), 127 if the command couldn't be
+*           started
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void xargs_start(struct job* job, char** argv, int null_fd, int* ret){
+
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+
+    while(job->nb_running == job->nb_stages)
+        sigsuspend(&mask);
+
+    struct job_stage* stage = job->stages;
+    while(stage->pid != 0)
+        stage++;
+
+    xargs_collect(stage, ret);
+    if(*ret > 123)
+        return;
+
+    //The command writes directly to stdout
+    fflush(stdout);
+
+    struct fd_moves moves;
+    fd_moves_init(&moves, null_fd, -1);
+    snprintf(stage->name, sizeof(stage->name), "%s", argv[0]);
+
+    long long start = now_ns();
+    pid_t pid = start_stage(argv, &moves);
+    if(pid == -1){
+        *ret = 127;
+        return;
+    }
+
+    stage->pid = pid;
+    stage->start_ns = start;
+    stage->launch_ns = now_ns() - start;
+    job->nb_running++;
+}
+
+
+/*************************************builtin_xargs*****************************************
+*
+* The xargs built-in : xargs [-0] [-n MAX] [-P N] [-s SIZE] [COMMAND [ARGS...]] runs
+* COMMAND ARGS (echo by default) with as many items read from stdin as the kernel accepts :
+* the words, arguments and environment must fit in ARG_MAX. The items are separated by
+* blanks and new lines (no quotes), or by '\0' with -0. A batch runs while the next one
+* is read, up to N batches at the same time with -P. The input is read as a stream, the
+* memory used doesn't depend on its length. Nothing runs if there is no item. Like GNU
+* xargs, the command reads /dev/null : stdin holds the items xargs hasn't read yet.
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the command
+*
+* RETURN : 0 if successful, 123 if a batch failed, 124 if one exited with 255, 125 if one
+*          was killed, 127 if the command couldn't be run, 1 in case of usage error
+*
+*******************************************************************************************/
+int builtin_xargs(char** args){
+
+    bool nul = false;
+    long max_items = LONG_MAX, max_jobs = 1, max_size = LONG_MAX;
+    int k = 1;
+
+    while(args[k] != NULL && args[k][0] == '-'){
+
+        if(!strcmp(args[k], "--")){
+            k++;
+            break;
+        }
+
+        if(!strcmp(args[k], "-0")){
+            nul = true;
+            k++;
+            continue;
+        }
+
+        char option = args[k][1];
+        const char* value = NULL;
+        if(option != 0 && args[k][2] == 0 && args[k + 1] != NULL)
+            value = args[++k];
+        else if(option != 0 && args[k][2] != 0)
+            value = args[k] + 2;
+
+        long number = value != NULL ? atol(value) : 0;
+        if(number <= 0 || (option != 'n' && option != 'P' && option != 's')){
+            fprintf(stderr, "xargs: usage: xargs [-0] [-n MAX] [-P N] [-s SIZE] [COMMAND [ARGS...]]\n");
+            return 1;
+        }
+
+        if(option == 'n')
+            max_items = number;
+        else if(option == 'P')
+            max_jobs = number > 1024 ? 1024 : number;
+        else
+            max_size = number;
+        k++;
+    }
+
+    //echo by default
+    char* echo[] = {"echo", NULL};
+    char** command = args[k] != NULL ? &args[k] : echo;
+
+    //Room left by the environment (with the headroom POSIX asks for) and the command
+    long budget = sysconf(_SC_ARG_MAX);
+    budget = budget > 0 ? budget : 131072;
+    for(char** env = environ; *env != NULL; env++)
+        budget -= strlen(*env) + 1 + sizeof(char*);
+    budget -= 2048;
+
+    //-s only counts the characters of the strings, like GNU xargs
+    int nb_words = 0;
+    for(; command[nb_words] != NULL; nb_words++){
+        budget -= strlen(command[nb_words]) + 1 + sizeof(char*);
+        max_size -= strlen(command[nb_words]) + 1;
+    }
+    budget -= sizeof(char*);
+
+    if(budget <= 0 || max_size <= 0){
+        fprintf(stderr, "xargs: the command leaves no room for the items\n");
+        return 1;
+    }
+
+    //One batch at a time : its strings, and the command followed by the items
+    char* strings = malloc(budget);
+    char** argv = malloc((nb_words + budget / (sizeof(char*) + 1) + 1) * sizeof(char*));
+    char* item = malloc(XARGS_ITEM_MAX);
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(null_fd == -1)
+        perror("xargs: /dev/null");
+
+    block_sigchld(true);
+    struct job* job = strings != NULL && argv != NULL && item != NULL && null_fd != -1 ?
+                      job_create(max_jobs, NULL, false) : NULL;
+
+    if(job == NULL){
+        block_sigchld(false);
+        if(null_fd != -1)
+            close(null_fd);
+        free(strings);
+        free(argv);
+        free(item);
+        return 1;
+    }
+
+    memcpy(argv, command, nb_words * sizeof(char*));
+
+    char in[65536];
+    size_t item_length = 0, used = 0, chars = 0;
+    long nb_items = 0;
+    bool too_long = false, end = false;
+    int ret = 0;
+
+    while(!end && ret <= 123){
+
+        ssize_t n = read(STDIN_FILENO, in, sizeof(in));
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            perror("xargs: stdin");
+        end = n <= 0;
+
+        //The end of the input ends the last item
+        for(ssize_t i = 0; i < (end ? 1 : n) && ret <= 123; i++){
+
+            char c = end ? (nul ? 0 : '\n') : in[i];
+            bool separator = nul ? c == 0 : (c == ' ' || c == '\t' || c == '\n');
+
+            if(!separator){
+                if(item_length < XARGS_ITEM_MAX - 1)
+                    item[item_length++] = c;
+                else
+                    too_long = true;
+                continue;
+            }
+
+            //Empty items are only kept with -0, and not at the end of the input
+            if(item_length == 0 && (!nul || end))
+                continue;
+
+            size_t cost = item_length + 1 + sizeof(char*);
+
+            if(too_long || (long) cost > budget || (long) item_length + 1 > max_size){
+                fprintf(stderr, "xargs: item too long, skipped\n");
+                ret = ret < 123 ? 123 : ret;
+            }
+            else{
+
+                //Full : this batch runs, the buffers are ready for the next one
+                if(nb_items > 0 && ((long) (used + cost) > budget || nb_items == max_items ||
+                                    (long) (chars + item_length + 1) > max_size)){
+                    argv[nb_words + nb_items] = NULL;
+                    xargs_start(job, argv, null_fd, &ret);
+                    nb_items = 0;
+                    used = 0;
+                    chars = 0;
+                }
+
+                memcpy(strings + used, item, item_length);
+                strings[used + item_length] = 0;
+                argv[nb_words + nb_items++] = strings + used;
+                used += cost;
+                chars += item_length + 1;
+            }
+
+            item_length = 0;
+            too_long = false;
+        }
+    }
+
+    if(nb_items > 0 && ret <= 123){
+        argv[nb_words + nb_items] = NULL;
+        xargs_start(job, argv, null_fd, &ret);
+    }
+
+    //Wait for the last batches
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+    while(job->nb_running > 0)
+        sigsuspend(&mask);
+
+    for(int i = 0; i < job->nb_stages; i++)
+        xargs_collect(&job->stages[i], &ret);
+
+    job_remove(job);
+    block_sigchld(false);
+
+    close(null_fd);
+    free(strings);
+    free(argv);
+    free(item);
+
+    return ret;
+}
+
+
+/*************************************join_args*****************************************
+*
+* Join arguments with whitespaces
+*
+* ARGUMENT :
+*   - args : an array of arguments ending with NULL
+*
+* RETURN : the joined string (to be freed), NULL if it couldn't be allocated
+*
+*******************************************************************************************/
+char* join_args(char** args){
+
+    size_t length = 1;
+    for(int i = 0; args[i] != NULL; i++)
+        length += strlen(args[i]) + 1;
+
+    char* command = malloc(length);
+    if(command == NULL)
+        return NULL;
+
+    char* end = command;
+    for(int i = 0; args[i] != NULL; i++){
+        if(i > 0)
+            *end++ = ' ';
+        size_t arg_length = strlen(args[i]);
+        memcpy(end, args[i], arg_length);
+        end += arg_length;
+    }
+    *end = 0;
+
+    return command;
+}
+
+
+/*************************************join_command*****************************************
+*
+* Rebuild the text of a command line (to remember the command line of a job)
+*
+* ARGUMENT :
+*   - cmd : the words of the line
+*
+* RETURN : the command line (to be freed), NULL if it couldn't be allocated
+*
+*******************************************************************************************/
+static char* join_command(struct command_line* cmd){
+
+    char* command = NULL;
+
+    for(int k = 0; k < cmd->nb_stages; k++){
+
+        char* stage = join_args(&cmd->args[cmd->stages[k]]);
+        if(stage == NULL){
+            free(command);
+            return NULL;
+        }
+
+        if(command == NULL){
+            command = stage;
+            continue;
+        }
+
+        char* joined = malloc(strlen(command) + strlen(stage) + 4);
+        if(joined != NULL)
+            sprintf(joined, "%s | %s", command, stage);
+        free(command);
+        free(stage);
+        command = joined;
+        if(command == NULL)
+            return NULL;
+    }
+
+    return command;
+}
+
+
+/*************************************run_pipeline*****************************************
+*
+* Run the commands of a line separated by "|", all at the same time, each one reading
+* the output of the previous one, as one job. The shell waits for all of them unless the
+* job runs in background.
+*
+* ARGUMENT :
+*   - cmd : the words of the line
+*   - prev_return : will contain the return value of the last command
+*   - prev_pid : will contain the pid of the last command of a background job
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void run_pipeline(struct command_line* cmd, int* prev_return, int* prev_pid){
+
+    int nb_stages = cmd->nb_stages;
+    bool background = cmd->background;
+    char*** stages = arena_alloc(nb_stages * sizeof(char**));
+    if(stages == NULL){
+        print_failure("1", prev_return);
+        return;
+    }
+
+    char* command = background ? join_command(cmd) : NULL;
+
+    for(int k = 0; k < nb_stages; k++)
+        stages[k] = &cmd->args[cmd->stages[k]];
+
+    //The children must be in the job table before the handler can reap them
+    block_sigchld(true);
+
+    struct job* job = job_create(nb_stages, command, background);
+    if(job == NULL){
+        block_sigchld(false);
+        free(command);
+        print_failure("1", prev_return);
+        return;
+    }
+
+    //The children write directly to the file descriptors, output what is buffered first
+    fflush(stdout);
+
+    int in_fd = -1;
+
+    for(int k = 0; k < nb_stages; k++){
+
+        int pipe_fds[2] = {-1, -1};
+
+        //The pipe is closed on exec, the children only keep it as stdin/stdout
+        if(k < nb_stages - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1){
+            perror("Pipe couldn't be created");
+            pipe_fds[0] = -1;
+            pipe_fds[1] = -1;
+        }
+
+        struct job_stage* stage = &job->stages[k];
+        snprintf(stage->name, sizeof(stage->name), "%s", stages[k][0]);
+
+        //The redirections come after the pipes, like in sh
+        struct fd_moves moves;
+        fd_moves_init(&moves, in_fd, pipe_fds[1]);
+
+        //A forked built-in doesn't exec : it must not keep the reading end of its own
+        //output, or the next command exiting never gives it SIGPIPE
+        if(pipe_fds[0] != -1){
+            moves.fd[moves.nb_moves] = pipe_fds[0];
+            moves.source[moves.nb_moves++] = -1;
+        }
+
+        long long start = now_ns();
+        pid_t pid = -1;
+        if(fd_moves_open(&moves, cmd, k)){
+            pid = start_stage(stages[k], &moves);
+            fd_moves_close(&moves);
+        }
+
+        if(pid != -1){
+            stage->pid = pid;
+            stage->start_ns = start;
+            stage->launch_ns = now_ns() - start;
+            job->nb_running++;
+        }
+        else
+            stage->status = 1;
+
+        //Only the children use the pipes
+        if(in_fd != -1)
+            close(in_fd);
+        if(pipe_fds[1] != -1)
+            close(pipe_fds[1]);
+
+        in_fd = pipe_fds[0];
+    }
+
+    job->last_pid = job->stages[nb_stages-1].pid;
+
+    //The last command couldn't be started
+    if(job->last_pid == 0){
+
+        //The other commands of a background job are still reaped, just not recorded
+        if(!background)
+            job_wait(job);
+        job_remove(job);
+        block_sigchld(false);
+        print_failure("1", prev_return);
+        return;
+    }
+
+    if(background){
+
+        *prev_pid = job->last_pid;
+        if(interactive)
+            fprintf(stderr, "[%d] %d\n", job->id, job->last_pid);
+
+        job_forget();
+        block_sigchld(false);
+        print_success(prev_return);
+        return;
+    }
+
+    //Wait for the whole pipeline
+    *prev_return = job_wait(job);
+
+    //The remembered binary disappeared, search $PATH again next time
+    for(int k = 0; k < nb_stages; k++){
+        if(job->stages[k].status == 127 && strchr(stages[k][0], '/') == NULL)
+            cmd_hash_check(stages[k][0]);
+    }
+
+    //time CMD : resources of the whole pipeline
+    if(cmd->timed){
+
+        long long start = job->stages[0].start_ns;
+        long long end = 0;
+        struct rusage total;
+        memset(&total, 0, sizeof(total));
+
+        for(int k = 0; k < nb_stages; k++){
+
+            struct job_stage* stage = &job->stages[k];
+            if(stage->start_ns == 0)
+                continue;
+
+            if(start == 0 || stage->start_ns < start)
+                start = stage->start_ns;
+            if(stage->end_ns > end)
+                end = stage->end_ns;
+
+            timeradd(&total.ru_utime, &stage->usage.ru_utime, &total.ru_utime);
+            timeradd(&total.ru_stime, &stage->usage.ru_stime, &total.ru_stime);
+            if(stage->usage.ru_maxrss > total.ru_maxrss)
+                total.ru_maxrss = stage->usage.ru_maxrss;
+        }
+
+        print_time(end - start, &total);
+    }
+
+    job_remove(job);
+    block_sigchld(false);
+
+    if(show_status)
+        printf("\n%d", *prev_return);
+}
+
+
+/*************************************program_emit_raw*****************************************
+*
+* Append a word of 4 bytes to the compiled script being built
+*
+* ARGUMENT :
+*   - word : the word
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool program_emit_raw(uint32_t word){
+
+    if(program_length == program_capacity){
+
+        size_t new_capacity = program_capacity ? program_capacity * 2 : 1024;
+        uint32_t* new_code = realloc(program_code, new_capacity * sizeof(uint32_t));
+        if(new_code == NULL){
+            perror("Script couldn't be compiled");
+            return false;
+        }
+
+        program_code = new_code;
+        program_capacity = new_capacity;
+    }
+
+    program_code[program_length++] = word;
+    return true;
+}
+
+
+/*************************************program_emit*****************************************
+*
+* Append an instruction to the compiled script being built
+*
+* ARGUMENT :
+*   - op : the opcode (OP_*)
+*   - operand : the operand, under 2^24
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool program_emit(unsigned op, unsigned operand){
+
+    if(operand >= 1 << 24){
+        fprintf(stderr, "Line too long to be compiled\n");
+        return false;
+    }
+
+    return program_emit_raw(op | operand << 8);
+}
+
+
+/*************************************program_emit_string*****************************************
+*
+* Append an instruction followed by a string to the compiled script being built. The
+* string is padded with at least one 0, it takes length / 4 + 1 words.
+*
+* ARGUMENT :
+*   - op : the opcode (OP_*)
+*   - str : the characters of the string
+*   - length : the number of characters, the length is the operand
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool program_emit_string(unsigned op, const char* str, size_t length){
+
+    //Characters following the last instruction's : appended to it
+    size_t previous = program_literal < program_length ? program_code[program_literal] >> 8 : 0;
+    if(op == OP_LITERAL && program_literal < program_length &&
+       (program_code[program_literal] & 0xff) == OP_LITERAL &&
+       program_literal + 1 + previous / 4 + 1 == program_length && previous + length < 1 << 24){
+
+        while(program_length < program_literal + 1 + (previous + length) / 4 + 1){
+            if(!program_emit_raw(0))
+                return false;
+        }
+
+        memcpy((char*) (program_code + program_literal + 1) + previous, str, length);
+        program_code[program_literal] = OP_LITERAL | (previous + length) << 8;
+        return true;
+    }
+
+    if(op == OP_LITERAL)
+        program_literal = program_length;
+
+    if(!program_emit(op, length))
+        return false;
+
+    for(size_t i = 0; i <= length; i += 4){
+        uint32_t word = 0;
+        memcpy(&word, str + i, length - i < 4 ? length - i : 4);
+        if(!program_emit_raw(word))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*************************************lex_grow*****************************************
+*
+* Make sure the lexer output buffer can receive more characters
+*
+* ARGUMENT :
+*   - needed : the number of characters that will be appended
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool lex_grow(size_t needed){
+
+    if(lex_length + needed <= lex_capacity)
+        return true;
+
+    if(lex_length + needed > get_arg_max()){
+        fprintf(stderr, "Line too long\n");
+        return false;
+    }
+
+    size_t new_capacity = lex_capacity ? lex_capacity : 1024;
+    while(new_capacity < lex_length + needed)
+        new_capacity *= 2;
+
+    char* new_buffer = realloc(lex_buffer, new_capacity);
+    if(new_buffer == NULL){
+        perror("Line couldn't be allocated");
+        return false;
+    }
+
+    lex_buffer = new_buffer;
+    lex_capacity = new_capacity;
+    return true;
+}
+
+
+/*************************************lex_append*****************************************
+*
+* Append characters to the word being built
+*
+* ARGUMENT :
+*   - str : the characters
+*   - length : the number of characters
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool lex_append(const char* str, size_t length){
+
+    if(!lex_grow(length))
+        return false;
+
+    memcpy(lex_buffer + lex_length, str, length);
+    lex_length += length;
+    return true;
+}
+
+
+/*************************************lex_push*****************************************
+*
+* Add the position of a word, or the end of a command (-1), to lex_offsets
+*
+* ARGUMENT :
+*   - offset : the position of the word in the buffer, -1 for the end of a command
+*   - nb_offsets : the number of positions already added
+*
+* RETURN : true if successful, false if the words don't fit in ARG_MAX or memory is missing
+*
+*******************************************************************************************/
+static bool lex_push(long offset, int nb_offsets){
+
+    //Like execve, the words and their pointers must fit in ARG_MAX
+    if((nb_offsets + 2) * sizeof(char*) + lex_length > get_arg_max() || nb_offsets == INT_MAX - 1){
+        fprintf(stderr, "Too many arguments\n");
+        return false;
+    }
+
+    if((size_t) nb_offsets == lex_offsets_capacity){
+
+        size_t new_capacity = lex_offsets_capacity ? lex_offsets_capacity * 2 : 256;
+        long* new_offsets = realloc(lex_offsets, new_capacity * sizeof(long));
+        if(new_offsets == NULL){
+            perror("Line couldn't be allocated");
+            return false;
+        }
+
+        lex_offsets = new_offsets;
+        lex_offsets_capacity = new_capacity;
+    }
+
+    lex_offsets[nb_offsets] = offset;
+    return true;
+}
+
+
+/*************************************glob_add_class*****************************************
+*
+* Add the characters of a class of ctype ("alpha", "digit"...) to the set of a '[...]'. An
+* unknown class adds nothing, like in bash.
+*
+* ARGUMENT :
+*   - name : the name of the class, not terminated
+*   - length : the length of the name
+*   - class : the set, one bit per character
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void glob_add_class(const char* name, size_t length, uint32_t* class){
+
+    static const struct{
+        const char* name;
+        int (*is)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+
+    for(size_t k = 0; k < sizeof(classes) / sizeof(classes[0]); k++){
+
+        if(strlen(classes[k].name) != length || memcmp(classes[k].name, name, length))
+            continue;
+
+        for(unsigned int c = 0; c < 256; c++){
+            if(classes[k].is(c))
+                class[c / 32] |= 1U << (c % 32);
+        }
+        return;
+    }
+}
+
+
+/*************************************glob_compile*****************************************
+*
+* Compile a component of a pattern (no '/'), in which '\' escapes the next character :
+* '*' (any characters), '?' (one character), '[...]' (one character of a set, "[!...]"
+* or "[^...]" for the others, with ranges "a-z" and classes "[:alpha:]"). A '[' without its
+* ']' is a character.
+*
+* ARGUMENT :
+*   - text : the component
+*   - pattern : will contain the compiled component, in the arena
+*
+* RETURN : true if the component has a wildcard, false if it is only characters (its
+*          unescaped text is then the prefix of the pattern)
+*
+*******************************************************************************************/
+static bool glob_compile(const char* text, struct glob_pattern* pattern){
+
+    size_t length = strlen(text);
+    pattern->tokens = arena_alloc((length + 1) * sizeof(struct glob_token));
+    char* literal = arena_alloc(length + 1);
+    pattern->nb_tokens = 0;
+    pattern->min_length = 0;
+    pattern->prefix = literal;
+    pattern->prefix_length = 0;
+    pattern->suffix = NULL;
+    pattern->suffix_length = 0;
+    pattern->dot = false;
+
+    if(pattern->tokens == NULL || literal == NULL)
+        return false;
+
+    bool wildcard = false;
+
+    for(size_t i = 0; i < length; i++){
+
+        struct glob_token* token = &pattern->tokens[pattern->nb_tokens];
+        token->type = GLOB_CHAR;
+        token->c = text[i];
+
+        if(text[i] == '\\' && i + 1 < length)
+            token->c = text[++i];
+
+        else if(text[i] == '*'){
+            //"**" is the same as "*"
+            if(pattern->nb_tokens > 0 && token[-1].type == GLOB_STAR)
+                continue;
+            token->type = GLOB_STAR;
+        }
+
+        else if(text[i] == '?')
+            token->type = GLOB_ANY;
+
+        else if(text[i] == '['){
+
+            size_t j = i + 1;
+            bool negate = j < length && (text[j] == '!' || text[j] == '^');
+            j += negate;
+
+            memset(token->class, 0, sizeof(token->class));
+
+            //A ']' first is in the set
+            for(size_t first = j; j < length && (text[j] != ']' || j == first); j++){
+
+                //[:name:]
+                const char* end = text[j] == '[' && text[j + 1] == ':' ? strstr(text + j + 2, ":]") : NULL;
+                if(end != NULL){
+                    glob_add_class(text + j + 2, end - (text + j + 2), token->class);
+                    j = end + 1 - text;
+                    continue;
+                }
+
+                unsigned char low = text[j];
+                if(low == '\\' && j + 1 < length)
+                    low = text[++j];
+
+                unsigned char high = low;
+                if(j + 2 < length && text[j + 1] == '-' && text[j + 2] != ']'){
+                    j += 2;
+                    high = text[j];
+                    if(high == '\\' && j + 1 < length)
+                        high = text[++j];
+                }
+
+                for(unsigned int c = low; c <= high; c++)
+                    token->class[c / 32] |= 1U << (c % 32);
+            }
+
+            //Without its ']', it is a character
+            if(j < length){
+                if(negate){
+                    for(int k = 0; k < 8; k++)
+                        token->class[k] = ~token->class[k];
+                }
+                token->type = GLOB_CLASS;
+                i = j;
+            }
+        }
+
+        if(token->type != GLOB_CHAR)
+            wildcard = true;
+        if(token->type != GLOB_STAR)
+            pattern->min_length++;
+
+        //The characters before the first wildcard are compared at once
+        if(!wildcard)
+            literal[pattern->prefix_length++] = token->c;
+
+        pattern->nb_tokens++;
+    }
+
+    literal[pattern->prefix_length] = 0;
+    pattern->dot = pattern->nb_tokens > 0 && pattern->tokens[0].type == GLOB_CHAR && pattern->tokens[0].c == '.';
+
+    //The characters after the last '*' are compared at once too (e.g. "*.c")
+    int last = pattern->nb_tokens - 1;
+    while(last >= 0 && pattern->tokens[last].type == GLOB_CHAR)
+        last--;
+
+    if(last >= 0 && pattern->tokens[last].type == GLOB_STAR && last < pattern->nb_tokens - 1){
+
+        char* suffix = arena_alloc(pattern->nb_tokens - last);
+        if(suffix != NULL){
+            for(int k = last + 1; k < pattern->nb_tokens; k++)
+                suffix[pattern->suffix_length++] = pattern->tokens[k].c;
+            pattern->suffix = suffix;
+        }
+    }
+
+    return wildcard;
+}
+
+
+/*************************************glob_match*****************************************
+*
+* Check if a file name matches a compiled component of a pattern. Like sh, a name starting
+* with '.' only matches a pattern starting with '.'.
+*
+* ARGUMENT :
+*   - pattern : the compiled component
+*   - name : the name
+*   - length : the length of the name
+*
+* RETURN : true if the name matches, false otherwise
+*
+*******************************************************************************************/
+static bool glob_match(const struct glob_pattern* pattern, const char* name, size_t length){
+
+    if(length < pattern->min_length || (name[0] == '.' && !pattern->dot))
+        return false;
+
+    //Most names are rejected by the fixed characters
+    if(memcmp(name, pattern->prefix, pattern->prefix_length) ||
+       (pattern->suffix_length > 0 && memcmp(name + length - pattern->suffix_length, pattern->suffix,
+                                             pattern->suffix_length)))
+        return false;
+
+    const struct glob_token* tokens = pattern->tokens;
+    int t = pattern->prefix_length;
+    size_t i = pattern->prefix_length;
+
+    //On a mismatch, the last '*' takes one more character
+    int star = -1;
+    size_t star_i = 0;
+
+    while(i < length){
+
+        if(t < pattern->nb_tokens && tokens[t].type == GLOB_STAR){
+            star = t++;
+            star_i = i;
+            continue;
+        }
+
+        if(t < pattern->nb_tokens){
+
+            unsigned char c = name[i];
+            bool match = tokens[t].type == GLOB_ANY ||
+                         (tokens[t].type == GLOB_CHAR && tokens[t].c == c) ||
+                         (tokens[t].type == GLOB_CLASS && (tokens[t].class[c / 32] >> (c % 32) & 1));
+            if(match){
+                t++;
+                i++;
+                continue;
+            }
+        }
+
+        if(star == -1)
+            return false;
+        t = star + 1;
+        i = ++star_i;
+    }
+
+    while(t < pattern->nb_tokens && tokens[t].type == GLOB_STAR)
+        t++;
+
+    return t == pattern->nb_tokens;
+}
+
+
+/*************************************glob_list*****************************************
+*
+* Get the entries of a directory (without "." and ".."), read with getdents64 in large
+* batches : the type of each entry comes with it, no stat is needed. The listing is kept
+* for the next globs on the same directory while the directory doesn't change, for at
+* most GLOB_CACHE_NS. A directory changed too recently to be sure that its time would
+* show another change isn't kept.
+*
+* ARGUMENT :
+*   - path : the path of the directory
+*
+* RETURN : the listing (valid until the next call), NULL if the directory can't be read
+*
+*******************************************************************************************/
+static struct glob_listing* glob_list(const char* path){
+
+    static char* batch = NULL;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        close(fd);
+        return NULL;
+    }
+
+    long long now = now_ns();
+    struct glob_listing* listing = NULL;
+
+    for(int i = 0; i < GLOB_CACHE && listing == NULL; i++){
+        if(glob_cache[i].time_ns != 0 && glob_cache[i].dev == st.st_dev && glob_cache[i].ino == st.st_ino)
+            listing = &glob_cache[i];
+    }
+
+    if(listing != NULL && now - listing->time_ns < GLOB_CACHE_NS &&
+       listing->mtime.tv_sec == st.st_mtim.tv_sec && listing->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+       listing->ctime.tv_sec == st.st_ctim.tv_sec && listing->ctime.tv_nsec == st.st_ctim.tv_nsec){
+        close(fd);
+        return listing;
+    }
+
+    //The buffers of the slot are reused
+    if(listing == NULL){
+        listing = &glob_cache[glob_cache_next];
+        glob_cache_next = (glob_cache_next + 1) % GLOB_CACHE;
+    }
+
+    listing->time_ns = 0;
+    listing->names_length = 0;
+    listing->nb_entries = 0;
+
+    if(batch == NULL && (batch = malloc(GLOB_BATCH)) == NULL){
+        close(fd);
+        return NULL;
+    }
+
+    ssize_t n;
+    bool missing = false;
+    while(!missing && (n = getdents64(fd, batch, GLOB_BATCH)) > 0){
+
+        for(ssize_t offset = 0; offset < n; ){
+
+            struct dirent64* entry = (struct dirent64*) (batch + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                continue;
+
+            size_t length = strlen(name);
+
+            if(listing->names_length + length + 1 > listing->names_capacity){
+                size_t new_capacity = listing->names_capacity ? listing->names_capacity * 2 : 65536;
+                while(new_capacity < listing->names_length + length + 1)
+                    new_capacity *= 2;
+                char* new_names = realloc(listing->names, new_capacity);
+                if(new_names == NULL){
+                    missing = true;
+                    break;
+                }
+                listing->names = new_names;
+                listing->names_capacity = new_capacity;
+            }
+
+            if(listing->nb_entries == listing->entries_capacity){
+                size_t new_capacity = listing->entries_capacity ? listing->entries_capacity * 2 : 1024;
+                struct glob_entry* new_entries = realloc(listing->entries, new_capacity * sizeof(struct glob_entry));
+                if(new_entries == NULL){
+                    missing = true;
+                    break;
+                }
+                listing->entries = new_entries;
+                listing->entries_capacity = new_capacity;
+            }
+
+            struct glob_entry* added = &listing->entries[listing->nb_entries++];
+            added->name = listing->names_length;
+            added->length = length;
+            added->type = entry->d_type;
+
+            memcpy(listing->names + listing->names_length, name, length + 1);
+            listing->names_length += length + 1;
+        }
+    }
+
+    close(fd);
+    if(missing || n < 0)
+        return NULL;
+
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    long long changed_ns = (real.tv_sec - st.st_mtim.tv_sec) * 1000000000LL + real.tv_nsec - st.st_mtim.tv_nsec;
+
+    //Kept only if a later change can't have the same time
+    if(changed_ns > GLOB_RACY_NS){
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        listing->mtime = st.st_mtim;
+        listing->ctime = st.st_ctim;
+        listing->time_ns = now;
+    }
+
+    return listing;
+}
+
+
+/*************************************glob_walk*****************************************
+*
+* Find the paths matching the components of a pattern from a given one, and add them to
+* glob_results
+*
+* ARGUMENT :
+*   - path : the path matched so far, followed by room for PATH_MAX characters
+*   - path_length : its length
+*   - patterns : the compiled components
+*   - wildcards : true for each component with a wildcard
+*   - nb_components : the number of components
+*   - k : the first component left to match
+*   - check : a component without wildcard was added, the path must be checked
+*
+* RETURN : true if successful, false if memory is missing
+*
+*******************************************************************************************/
+static bool glob_walk(char* path, size_t path_length, const struct glob_pattern* patterns,
+                      const bool* wildcards, int nb_components, int k, bool check){
+
+    if(k == nb_components){
+
+        struct stat st;
+        path[path_length] = 0;
+        if(check && lstat(path, &st) == -1)
+            return true;
+
+        if(glob_nb_results == glob_results_capacity){
+            size_t new_capacity = glob_results_capacity ? glob_results_capacity * 2 : 256;
+            char** new_results = realloc(glob_results, new_capacity * sizeof(char*));
+            if(new_results == NULL)
+                return false;
+            glob_results = new_results;
+            glob_results_capacity = new_capacity;
+        }
+
+        char* copy = arena_alloc(path_length + 1);
+        if(copy == NULL)
+            return false;
+        memcpy(copy, path, path_length + 1);
+        glob_results[glob_nb_results++] = copy;
+        return true;
+    }
+
+    bool last = k == nb_components - 1;
+
+    //Only characters : nothing to read
+    if(!wildcards[k]){
+
+        size_t length = patterns[k].prefix_length;
+        if(path_length + length + 1 >= PATH_MAX)
+            return true;
+
+        memcpy(path + path_length, patterns[k].prefix, length);
+        path_length += length;
+        if(!last)
+            path[path_length++] = '/';
+
+        return glob_walk(path, path_length, patterns, wildcards, nb_components, k + 1, true);
+    }
+
+    path[path_length] = 0;
+    struct glob_listing* listing = glob_list(path_length > 0 ? path : ".");
+    if(listing == NULL)
+        return true;
+
+    //The matches are copied first : the listing can be reused by the next components
+    size_t nb_matches = 0;
+    char** matches = NULL;
+
+    for(size_t i = 0; i < listing->nb_entries; i++){
+
+        struct glob_entry* entry = &listing->entries[i];
+        const char* name = listing->names + entry->name;
+
+        if(!glob_match(&patterns[k], name, entry->length) || path_length + entry->length + 1 >= PATH_MAX)
+            continue;
+
+        //Only directories lead to the next components
+        if(!last && entry->type != DT_DIR){
+
+            struct stat st;
+            memcpy(path + path_length, name, entry->length + 1);
+            if(entry->type != DT_LNK && entry->type != DT_UNKNOWN)
+                continue;
+            if(stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+                continue;
+        }
+
+        //Names from the arena, in a list doubled in the arena as needed
+        if((nb_matches & (nb_matches - 1)) == 0){
+            char** new_matches = arena_alloc((nb_matches ? nb_matches * 2 : 1) * sizeof(char*));
+            if(new_matches == NULL)
+                return false;
+            if(nb_matches > 0)
+                memcpy(new_matches, matches, nb_matches * sizeof(char*));
+            matches = new_matches;
+        }
+
+        char* copy = arena_alloc(entry->length + 1);
+        if(copy == NULL)
+            return false;
+        memcpy(copy, name, entry->length + 1);
+        matches[nb_matches++] = copy;
+    }
+
+    for(size_t i = 0; i < nb_matches; i++){
+
+        size_t length = strlen(matches[i]);
+        memcpy(path + path_length, matches[i], length);
+        if(!last)
+            path[path_length + length++] = '/';
+
+        if(!glob_walk(path, path_length + length, patterns, wildcards, nb_components, k + 1, false))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*************************************glob_compare*****************************************
+*
+* Compare two paths found by a glob (qsort)
+*
+* ARGUMENT :
+*   - a, b : the paths
+*
+* RETURN : like strcmp
+*
+*******************************************************************************************/
+static int glob_compare(const void* a, const void* b){
+
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+/*************************************lex_glob*****************************************
+*
+* Expand the word being built if it has an unquoted '*', '?' or '[...]' (see lex_globs) :
+* the word is replaced by the paths matching it, sorted unless the shell variable GLOBSORT
+* is "none". A word matching nothing is kept as is, like in sh. The characters that come
+* from quotes, escapes or variables are never wildcards.
+*
+* ARGUMENT :
+*   - word_start : the position of the word in the buffer (it ends at lex_length)
+*   - nb_offsets : the number of words in lex_offsets, updated
+*   - cmd : the line, its number of arguments is updated
+*
+* RETURN : 1 if the word was replaced, 0 if it must be kept, -1 in case of error
+*
+*******************************************************************************************/
+static int lex_glob(long word_start, int* nb_offsets, struct command_line* cmd){
+
+    size_t length = lex_length - word_start;
+    size_t nb_globs = lex_nb_globs;
+    lex_nb_globs = 0;
+
+    //The other special characters are escaped
+    char* text = arena_alloc(length * 2 + 1);
+    if(text == NULL)
+        return -1;
+
+    size_t text_length = 0;
+    size_t next = 0;
+    int nb_components = 1;
+
+    for(size_t i = 0; i < length; i++){
+
+        char c = lex_buffer[word_start + i];
+
+        if(next < nb_globs && lex_globs[next] == (long) (word_start + i))
+            next++;
+        else if(c == '*' || c == '?' || c == '[' || c == '\\')
+            text[text_length++] = '\\';
+
+        if(c == '/')
+            nb_components++;
+        text[text_length++] = c;
+    }
+    text[text_length] = 0;
+
+    struct glob_pattern* patterns = arena_alloc(nb_components * sizeof(struct glob_pattern));
+    bool* wildcards = arena_alloc(nb_components * sizeof(bool));
+    char* path = arena_alloc(PATH_MAX + 1);
+    if(patterns == NULL || wildcards == NULL || path == NULL)
+        return -1;
+
+    bool wildcard = false;
+    char* component = text;
+
+    for(int k = 0; k < nb_components; k++){
+
+        char* slash = strchrnul(component, '/');
+        *slash = 0;
+        wildcards[k] = glob_compile(component, &patterns[k]);
+        wildcard |= wildcards[k];
+        component = slash + 1;
+    }
+
+    if(!wildcard)
+        return 0;
+
+    glob_nb_results = 0;
+    if(!glob_walk(path, 0, patterns, wildcards, nb_components, 0, false))
+        return -1;
+    if(glob_nb_results == 0)
+        return 0;
+
+    const char* order = var_get("GLOBSORT");
+    if(order == NULL || strcmp(order, "none"))
+        qsort(glob_results, glob_nb_results, sizeof(char*), glob_compare);
+
+    lex_length = word_start;
+
+    for(size_t i = 0; i < glob_nb_results; i++){
+
+        long start = lex_length;
+        if(!lex_append(glob_results[i], strlen(glob_results[i]) + 1) || !lex_push(start, *nb_offsets))
+            return -1;
+        (*nb_offsets)++;
+        cmd->nb_args++;
+    }
+
+    return 1;
+}
+
+
+/*************************************lex_glob_char*****************************************
+*
+* Append an unquoted '*', '?' or '[' to the word being built, remembering that it is a
+* wildcard (see lex_glob)
+*
+* ARGUMENT :
+*   - c : the character
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool lex_glob_char(char c){
+
+    if(lex_nb_globs == lex_globs_capacity){
+
+        size_t new_capacity = lex_globs_capacity ? lex_globs_capacity * 2 : 64;
+        long* new_globs = realloc(lex_globs, new_capacity * sizeof(long));
+        if(new_globs == NULL){
+            perror("Line couldn't be allocated");
+            return false;
+        }
+
+        lex_globs = new_globs;
+        lex_globs_capacity = new_capacity;
+    }
+
+    lex_globs[lex_nb_globs++] = lex_length;
+
+    //Compiled : expanded each time the line runs
+    if(lex_compiling)
+        return program_emit(OP_GLOB, (unsigned char) c) && lex_append(&c, 1);
+
+    return lex_append(&c, 1);
+}
+
+
+/*************************************lex_literal*****************************************
+*
+* Append characters of the line to the word being built, and to the compiled script when
+* compiling (see program_compile)
+*
+* ARGUMENT :
+*   - str : the characters
+*   - length : the number of characters
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool lex_literal(const char* str, size_t length){
+
+    if(lex_compiling && !program_emit_string(OP_LITERAL, str, length))
+        return false;
+
+    return lex_append(str, length);
+}
+
+
+/*************************************lex_special*****************************************
+*
+* Append the value of $?, $! or $$ to the word being built
+*
+* ARGUMENT :
+*   - c : '?', '!' or '$'
+*   - prev_return : the previous return value of the foreground command
+*   - prev_pid : the previous pid of the background pipeline
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool lex_special(char c, int prev_return, int prev_pid){
+
+    char number[32];
+    int length = 0;
+
+    if(c == '?')
+        length = snprintf(number, sizeof(number), "%d", prev_return);
+    else if(c == '$')
+        length = snprintf(number, sizeof(number), "%d", (int) getpid());
+    else if(prev_pid != 0)
+        length = snprintf(number, sizeof(number), "%d", prev_pid);
+
+    return lex_append(number, length);
+}
+
+
+/*************************************lex_variable*****************************************
+*
+* Append the value of a variable to the word being built
+*
+* ARGUMENT :
+*   - start : the name of the variable
+*   - length : the length of the name
+*
+* RETURN : true if successful, false if the variable doesn't exist or memory is missing
+*
+*******************************************************************************************/
+static bool lex_variable(const char* start, size_t length){
+
+    char name[length + 1];
+    memcpy(name, start, length);
+    name[length] = 0;
+
+    //Check if this name exists in the database, then in the environment
+    char* value = var_get(name);
+    if(value == NULL)
+        value = getenv(name);
+    if(value == NULL){
+        fprintf(stderr, "%s: undefined variable\n", name);
+        return false;
+    }
+
+    return lex_append(value, strlen(value));
+}
+
+
+/*************************************lex_dollar*****************************************
+*
+* Expand the term starting at a '$' and append its value to the word being built :
+*   - $? : the exit value of the last command
+*   - $! : the pid of the last background job (empty if none)
+*   - $$ : the pid of the shell
+*   - $name, ${name} : a shell variable, or else an environment variable
+* A '$' followed by anything else is kept as is.
+*
+* ARGUMENT :
+*   - line : the line
+*   - i : the position of the '$', will contain the position of the last character used
+*   - prev_return : the previous return value of the foreground command
+*   - prev_pid : the previous pid of the background pipeline
+*
+* RETURN : 0 if successful, -1 if the variable doesn't exist or memory is missing
+*
+*******************************************************************************************/
+static int lex_dollar(const char* line, size_t* i, int prev_return, int prev_pid){
+
+    const char* start = line + *i + 1;
+
+    if(*start == '?' || *start == '!' || *start == '$'){
+
+        *i += 1;
+
+        //Compiled : expanded each time the line runs, a placeholder keeps the word
+        if(lex_compiling)
+            return program_emit(OP_SPECIAL, *start) && lex_append("$", 1) ? 0 : -1;
+
+        return lex_special(*start, prev_return, prev_pid) ? 0 : -1;
+    }
+
+    bool braces = (*start == '{');
+    if(braces)
+        start++;
+
+    size_t length = 0;
+    if(isalpha((unsigned char) start[0]) || start[0] == '_'){
+        while(isalnum((unsigned char) start[length]) || start[length] == '_')
+            length++;
+    }
+
+    //Not a variable name
+    if(length == 0 || (braces && start[length] != '}')){
+        if(braces){
+            fprintf(stderr, "Bad substitution\n");
+            return -1;
+        }
+        return lex_literal("$", 1) ? 0 : -1;
+    }
+
+    *i += length + (braces ? 2 : 0);
+
+    if(lex_compiling)
+        return program_emit_string(OP_VARIABLE, start, length) && lex_append("$", 1) ? 0 : -1;
+
+    return lex_variable(start, length) ? 0 : -1;
+}
+
+
+/*************************************lex_finish*****************************************
+*
+* Check the end of a line cut into words, then point the arguments and the files of the
+* redirections to the words
+*
+* ARGUMENT :
+*   - cmd : the words of the line
+*   - nb_offsets : the number of words in lex_offsets
+*   - redirection_offsets : the position of the file or here-string of each redirection
+*   - pending : the redirection still waiting for its file, -1 if none
+*
+* RETURN : 0 if successful, -1 in case of syntax error or if memory is missing
+*
+*******************************************************************************************/
+static int lex_finish(struct command_line* cmd, int nb_offsets, const long* redirection_offsets,
+                      int pending){
+
+    //Command missing after the last '|'
+    if(cmd->nb_stages > 1 && lex_offsets[nb_offsets-1] == -1){
+        fprintf(stderr, "Syntax error near unexpected token '|'\n");
+        return -1;
+    }
+
+    if(pending != -1){
+        fprintf(stderr, "Syntax error : file expected after the redirection\n");
+        return -1;
+    }
+
+    //A line made of redirections only
+    if(cmd->nb_redirections > 0 && cmd->nb_args == 0){
+        fprintf(stderr, "Syntax error : command expected\n");
+        return -1;
+    }
+
+    cmd->args = arena_alloc((nb_offsets + 1) * sizeof(char*));
+    cmd->stages = arena_alloc(cmd->nb_stages * sizeof(int));
+    if(cmd->args == NULL || cmd->stages == NULL)
+        return -1;
+
+    //The buffer doesn't move anymore, the words can be pointed to
+    cmd->stages[0] = 0;
+    for(int k = 0, stage = 1; k < nb_offsets; k++){
+        cmd->args[k] = lex_offsets[k] == -1 ? NULL : lex_buffer + lex_offsets[k];
+        if(lex_offsets[k] == -1)
+            cmd->stages[stage++] = k + 1;
+    }
+    cmd->args[nb_offsets] = NULL;
+
+    for(int k = 0; k < cmd->nb_redirections; k++){
+        if(cmd->redirections[k].type != REDIR_DUP)
+            cmd->redirections[k].word = lex_buffer + redirection_offsets[k];
+    }
+
+    return 0;
+}
+
+
+/*************************************lex_line*****************************************
+*
+* Cut a line into words in a single pass, handling at the same time :
+*   - quotes : '...' (literal) and "..." (with $ expansion and \" \\ \$ escapes)
+*   - backslash escapes outside of quotes
+*   - $ expansion (see lex_dollar), any number of times per word
+*   - the operators '|' (between commands) and '&' (at the end of the line)
+*   - comments, starting with a '#' at the beginning of a word
+* The words are stored in a buffer reused from one line to the next.
+*
+* ARGUMENT :
+*   - line : the line entered by the user
+*   - cmd : will contain the words of the line
+*   - prev_return : the previous return value of the foreground command
+*   - prev_pid : the previous pid of the background pipeline
+*
+* RETURN : 0 if successful, -1 in case of syntax error or undefined variable
+*
+*******************************************************************************************/
+int lex_line(const char* line, struct command_line* cmd, int prev_return, int prev_pid){
+
+    //Number of words in lex_offsets
+    int nb_offsets = 0;
+
+    bool in_word = false;
+    bool quoted = false; //The word contains quotes, keep it even if empty
+    bool identifier = false; //All the characters of the word so far form a variable name
+    bool digits = false; //All the characters of the word so far are digits (N> redirections)
+    long word_start = 0;
+
+    //Position of the file or here-string of each redirection, and the one waiting for it
+    long redirection_offsets[MAX_REDIRECTIONS];
+    int pending = -1;
+
+    //Compiling : position in the compiled script of the first instruction of the word
+    size_t word_code = 0;
+
+    lex_length = 0;
+    lex_nb_globs = 0;
+    arena_reset();
+    cmd->nb_args = 0;
+    cmd->nb_stages = 1;
+    cmd->background = false;
+    cmd->timed = false;
+    cmd->assignment = -1;
+    cmd->nb_redirections = 0;
+    cmd->builtin = -1;
+
+    for(size_t i = 0; ; i++){
+
+        char c = line[i];
+
+        //2> or 0< : the word read so far is the redirected file descriptor, not an argument
+        int redirected_fd = -1;
+        if(in_word && (c == '<' || c == '>') && digits && !quoted && lex_length > (size_t) word_start){
+            lex_append("", 1);
+            redirected_fd = atoi(lex_buffer + word_start);
+            lex_length = word_start;
+            in_word = false;
+
+            //The digits belong to the redirection instruction
+            if(lex_compiling)
+                program_length = word_code;
+        }
+
+        //End of the current word
+        if(in_word && (c == 0 || c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&' ||
+                       c == '<' || c == '>')){
+
+            in_word = false;
+
+            if(lex_compiling && !program_emit(OP_WORD, quoted))
+                return -1;
+
+            //An unquoted expansion to nothing doesn't give a word
+            if(lex_length == (size_t) word_start && !quoted){
+                lex_length = word_start;
+            }
+            else if(pending != -1){
+                if(!lex_append("", 1))
+                    return -1;
+                redirection_offsets[pending] = word_start;
+                pending = -1;
+            }
+            else{
+
+                //Wildcards are expanded when the line runs, an assignment is kept as is
+                int expanded = 0;
+                if(lex_nb_globs > 0 && !lex_compiling && !(nb_offsets == 0 && cmd->assignment != -1))
+                    expanded = lex_glob(word_start, &nb_offsets, cmd);
+                if(expanded == -1)
+                    return -1;
+
+                if(expanded == 0){
+                    if(!lex_append("", 1) || !lex_push(word_start, nb_offsets))
+                        return -1;
+                    if(lex_compiling && nb_offsets == 0)
+                        program_first_word = word_code;
+                    nb_offsets++;
+                    cmd->nb_args++;
+                }
+            }
+
+            lex_nb_globs = 0;
+        }
+
+        if(c == 0 || c == '\n')
+            break;
+
+        if(c == ' ' || c == '\t')
+            continue;
+
+        if(cmd->background){
+            fprintf(stderr, "Syntax error near unexpected token '&'\n");
+            return -1;
+        }
+
+        //Comment
+        if(!in_word && c == '#')
+            break;
+
+        //The file of a redirection must come before the end of the command
+        if(pending != -1 && (c == '|' || c == '&' || c == '<' || c == '>')){
+            fprintf(stderr, "Syntax error near unexpected token '%c'\n", c);
+            return -1;
+        }
+
+        if(c == '<' || c == '>'){
+
+            if(cmd->nb_redirections == MAX_REDIRECTIONS){
+                fprintf(stderr, "Too many redirections\n");
+                return -1;
+            }
+
+            struct redirection* redirection = &cmd->redirections[cmd->nb_redirections];
+            redirection->stage = cmd->nb_stages - 1;
+            redirection->fd = redirected_fd != -1 ? redirected_fd : (c == '<' ? STDIN_FILENO : STDOUT_FILENO);
+            redirection->word = NULL;
+            redirection->source = -1;
+
+            if(c == '<' && line[i+1] == '<' && line[i+2] == '<'){
+                redirection->type = REDIR_HERE;
+                redirection->fd = redirected_fd != -1 ? redirected_fd : STDIN_FILENO;
+                i += 2;
+            }
+            else if(c == '<' && line[i+1] == '<'){
+                fprintf(stderr, "Here-documents are not supported\n");
+                return -1;
+            }
+            else if(c == '>' && line[i+1] == '>'){
+                redirection->type = REDIR_APPEND;
+                i++;
+            }
+            else if(line[i+1] == '&'){
+
+                //N>&M copies M, N>&- closes N
+                redirection->type = REDIR_DUP;
+                i++;
+
+                if(line[i+1] == '-')
+                    i++;
+                else if(isdigit((unsigned char) line[i+1])){
+                    redirection->source = 0;
+                    while(isdigit((unsigned char) line[i+1]))
+                        redirection->source = redirection->source * 10 + (line[++i] - '0');
+                }
+                else{
+                    fprintf(stderr, "Syntax error near unexpected token '&'\n");
+                    return -1;
+                }
+
+                if(lex_compiling && (!program_emit(OP_REDIRECT, redirection->type | redirection->fd << 4) ||
+                                     !program_emit_raw(redirection->source)))
+                    return -1;
+
+                cmd->nb_redirections++;
+                continue;
+            }
+            else
+                redirection->type = c == '<' ? REDIR_IN : REDIR_OUT;
+
+            if(lex_compiling && (!program_emit(OP_REDIRECT, redirection->type | redirection->fd << 4) ||
+                                 !program_emit_raw(-1)))
+                return -1;
+
+            //The next word is the file
+            pending = cmd->nb_redirections++;
+            continue;
+        }
+
+        if(c == '|' || c == '&'){
+
+            //Empty command before the operator
+            if(nb_offsets == 0 || lex_offsets[nb_offsets-1] == -1){
+                fprintf(stderr, "Syntax error near unexpected token '%c'\n", c);
+                return -1;
+            }
+
+            if(lex_compiling && !program_emit(c == '&' ? OP_BACKGROUND : OP_PIPE, 0))
+                return -1;
+
+            if(c == '&'){
+                cmd->background = true;
+                continue;
+            }
+
+            if(!lex_push(-1, nb_offsets))
+                return -1;
+            nb_offsets++;
+            cmd->nb_stages++;
+            continue;
+        }
+
+        //Beginning of a new word
+        if(!in_word){
+            in_word = true;
+            quoted = false;
+            identifier = true;
+            digits = true;
+            word_start = lex_length;
+            word_code = program_length;
+        }
+
+        //Only plain digits can make a file descriptor number
+        if(!isdigit((unsigned char) c))
+            digits = false;
+
+        if(c == '\''){
+
+            const char* end = strchr(line + i + 1, '\'');
+            if(end == NULL){
+                fprintf(stderr, "Unterminated quoted string\n");
+                return -1;
+            }
+
+            if(!lex_literal(line + i + 1, end - (line + i + 1)))
+                return -1;
+            i = end - line;
+            quoted = true;
+            identifier = false;
+        }
+
+        else if(c == '"'){
+
+            quoted = true;
+            identifier = false;
+
+            for(i++; line[i] != '"'; i++){
+
+                if(line[i] == 0){
+                    fprintf(stderr, "Unterminated quoted string\n");
+                    return -1;
+                }
+
+                if(line[i] == '$'){
+                    if(lex_dollar(line, &i, prev_return, prev_pid) == -1)
+                        return -1;
+                    continue;
+                }
+
+                //Only \" \\ \$ are escapes between double quotes
+                if(line[i] == '\\' && (line[i+1] == '"' || line[i+1] == '\\' || line[i+1] == '$'))
+                    i++;
+
+                if(!lex_literal(line + i, 1))
+                    return -1;
+            }
+        }
+
+        else if(c == '\\'){
+
+            identifier = false;
+
+            //The next character is kept as is
+            if(line[i+1] != 0 && line[i+1] != '\n'){
+                i++;
+                if(!lex_literal(line + i, 1))
+                    return -1;
+            }
+        }
+
+        else if(c == '$'){
+
+            identifier = false;
+            if(lex_dollar(line, &i, prev_return, prev_pid) == -1)
+                return -1;
+        }
+
+        else{
+
+            //NAME=... as first word of the line : variable assignment
+            if(c == '=' && identifier && lex_length > (size_t) word_start &&
+               nb_offsets == 0 && pending == -1 && cmd->assignment == -1)
+                cmd->assignment = lex_length - word_start;
+
+            //Whether it is the first word is only known when the line runs
+            if(lex_compiling && c == '=' && identifier && lex_length > (size_t) word_start &&
+               !program_emit(OP_ASSIGNMENT, lex_length - word_start))
+                return -1;
+
+            if(!isalnum((unsigned char) c) && c != '_')
+                identifier = false;
+
+            if(c == '*' || c == '?' || c == '['){
+                if(!lex_glob_char(c))
+                    return -1;
+            }
+            else if(!lex_literal(&c, 1))
+                return -1;
+        }
+    }
+
+    return lex_finish(cmd, nb_offsets, redirection_offsets, pending);
+}
+
+
+/*************************************program_line*****************************************
+*
+* Rebuild the words of a compiled line, like lex_line would cut them : only the expansions
+* ($?, $!, $$, $name) and the words they can remove are left to do
+*
+* ARGUMENT :
+*   - code : the instructions of the line
+*   - length : the number of words of 4 bytes of the instructions
+*   - cmd : will contain the words of the line
+*   - prev_return : the previous return value of the foreground command
+*   - prev_pid : the previous pid of the background pipeline
+*
+* RETURN : 0 if successful, -1 in case of syntax error or undefined variable
+*
+*******************************************************************************************/
+static int program_line(const uint32_t* code, size_t length, struct command_line* cmd,
+                        int prev_return, int prev_pid){
+
+    int nb_offsets = 0;
+    long word_start = 0;
+    long redirection_offsets[MAX_REDIRECTIONS];
+    int pending = -1;
+
+    lex_length = 0;
+    lex_nb_globs = 0;
+    arena_reset();
+    cmd->nb_args = 0;
+    cmd->nb_stages = 1;
+    cmd->background = false;
+    cmd->timed = false;
+    cmd->assignment = -1;
+    cmd->nb_redirections = 0;
+    cmd->builtin = -1;
+
+    for(size_t k = 0; k < length; ){
+
+        unsigned op = code[k] & 0xff;
+        unsigned operand = code[k] >> 8;
+        const char* str = (const char*) (code + k + 1);
+        k++;
+
+        switch(op){
+
+            case OP_LITERAL:
+                if(!lex_append(str, operand))
+                    return -1;
+                k += operand / 4 + 1;
+                break;
+
+            case OP_VARIABLE:
+                if(!lex_variable(str, operand))
+                    return -1;
+                k += operand / 4 + 1;
+                break;
+
+            case OP_SPECIAL:
+                if(!lex_special(operand, prev_return, prev_pid))
+                    return -1;
+                break;
+
+            case OP_GLOB:
+                if(!lex_glob_char(operand))
+                    return -1;
+                break;
+
+            case OP_ASSIGNMENT:
+                if(nb_offsets == 0 && pending == -1 && cmd->assignment == -1)
+                    cmd->assignment = operand;
+                break;
+
+            case OP_WORD:
+
+                //An unquoted expansion to nothing doesn't give a word
+                if(lex_length == (size_t) word_start && !operand){
+                }
+                else if(pending != -1){
+                    if(!lex_append("", 1))
+                        return -1;
+                    redirection_offsets[pending] = word_start;
+                    pending = -1;
+                }
+                else{
+
+                    int expanded = 0;
+                    if(lex_nb_globs > 0 && !(nb_offsets == 0 && cmd->assignment != -1))
+                        expanded = lex_glob(word_start, &nb_offsets, cmd);
+                    if(expanded == -1)
+                        return -1;
+
+                    if(expanded == 0){
+                        if(!lex_append("", 1) || !lex_push(word_start, nb_offsets))
+                            return -1;
+                        nb_offsets++;
+                        cmd->nb_args++;
+                    }
+                }
+
+                lex_nb_globs = 0;
+                word_start = lex_length;
+                break;
+
+            case OP_REDIRECT:{
+
+                //The file of the previous redirection expanded to nothing
+                if(pending != -1){
+                    fprintf(stderr, "Syntax error near unexpected token '%c'\n",
+                            (operand & 15) == REDIR_IN || (operand & 15) == REDIR_HERE ? '<' : '>');
+                    return -1;
+                }
+
+                struct redirection* redirection = &cmd->redirections[cmd->nb_redirections];
+                redirection->stage = cmd->nb_stages - 1;
+                redirection->type = operand & 15;
+                redirection->fd = operand >> 4;
+                redirection->word = NULL;
+                redirection->source = (int) code[k++];
+
+                if(redirection->type == REDIR_DUP)
+                    cmd->nb_redirections++;
+                else
+                    pending = cmd->nb_redirections++;
+                break;
+            }
+
+            case OP_PIPE:
+            case OP_BACKGROUND:{
+
+                char c = op == OP_PIPE ? '|' : '&';
+
+                if(pending != -1 || nb_offsets == 0 || lex_offsets[nb_offsets-1] == -1){
+                    fprintf(stderr, "Syntax error near unexpected token '%c'\n", c);
+                    return -1;
+                }
+
+                if(c == '&'){
+                    cmd->background = true;
+                    break;
+                }
+
+                if(!lex_push(-1, nb_offsets))
+                    return -1;
+                nb_offsets++;
+                cmd->nb_stages++;
+                break;
+            }
+
+            case OP_BUILTIN:
+                cmd->builtin = operand;
+                break;
+
+            default:
+                fprintf(stderr, "Invalid compiled script\n");
+                return -1;
+        }
+    }
+
+    return lex_finish(cmd, nb_offsets, redirection_offsets, pending);
+}
+
+
+/*************************************program_builtin*****************************************
+*
+* Find the built-in of the first word of a compiled line, if the word has no expansion
+*
+* ARGUMENT :
+*   - cmd : the words of the line, as cut when compiling
+*
+* RETURN : the index of the built-in + 1, 0 if none, -1 if unknown until the line runs
+*
+*******************************************************************************************/
+static int program_builtin(struct command_line* cmd){
+
+    //The instructions of the first argument, up to its end
+    for(size_t k = program_first_word; k < program_length; ){
+
+        unsigned op = program_code[k] & 0xff;
+
+        if(op == OP_WORD)
+            break;
+        if(op != OP_LITERAL && op != OP_ASSIGNMENT)
+            return -1;
+
+        k += 1 + (op == OP_LITERAL ? (program_code[k] >> 8) / 4 + 1 : 0);
+    }
+
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++){
+        if(!strcmp(cmd->args[0], builtins[i].name))
+            return i + 1;
+    }
+
+    return 0;
+}
+
+
+/*************************************program_compile*****************************************
+*
+* Compile a script into a flat array of instructions (see OP_*), in program_code. The quotes,
+* escapes, operators, redirections and built-in names are resolved once, the expansions
+* are left to program_line. The lines lex_line rejects are kept as text to fail each time
+* they are run, as they would without compilation.
+*
+* ARGUMENT :
+*   - text : the script, ending with 0
+*   - size : the length of the script
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool program_compile(const char* text, size_t size){
+
+    struct command_line cmd;
+    bool ret = true;
+
+    program_length = 0;
+
+    //The errors of the rejected lines are printed when they are run, not now
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if(null_fd != -1){
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+
+    for(const char* line = text; line < text + size && ret; ){
+
+        const char* end = memchr(line, '\n', text + size - line);
+        end = end == NULL ? text + size : end;
+
+        //Same test as the loop of main
+        if(!strncmp(line, "exit", 4) && (line[4] == '\n' || line[4] == 0)){
+            ret = program_emit(OP_EXIT, 0);
+            break;
+        }
+
+        size_t line_start = program_length;
+        ret = program_emit(OP_LINE, 0);
+
+        lex_compiling = true;
+        int lexed = ret ? lex_line(line, &cmd, 0, 0) : -1;
+        lex_compiling = false;
+
+        if(lexed == 0 && cmd.nb_args > 0){
+
+            int builtin = program_builtin(&cmd);
+            if(builtin != -1)
+                ret = program_emit(OP_BUILTIN, builtin);
+
+            size_t line_length = program_length - line_start - 1;
+            if(ret && line_length < 1 << 24)
+                program_code[line_start] = OP_LINE | line_length << 8;
+            else
+                lexed = -1;
+        }
+        else if(lexed == 0)
+            program_length = line_start;
+
+        if(lexed == -1 && ret){
+            program_length = line_start;
+            ret = program_emit_string(OP_RAW, line, end - line);
+        }
+
+        line = end + 1;
+    }
+
+    if(saved_stderr != -1){
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+
+    return ret;
+}
+
+
+/*************************************program_run*****************************************
+*
+* Run a compiled script
+*
+* ARGUMENT :
+*   - code : the instructions
+*   - length : the number of words of 4 bytes of the instructions
+*   - prev_return : the previous return value, will contain the new one
+*   - prev_pid : the previous pid of the background pipeline, will contain the new one
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void program_run(const uint32_t* code, size_t length, int* prev_return, int* prev_pid){
+
+    struct command_line cmd;
+
+    for(size_t k = 0; k < length; ){
+
+        unsigned op = code[k] & 0xff;
+        unsigned operand = code[k] >> 8;
+        int ret;
+        k++;
+
+        if(op == OP_EXIT)
+            break;
+
+        if(op == OP_RAW){
+            ret = lex_line((const char*) (code + k), &cmd, *prev_return, *prev_pid);
+            k += operand / 4 + 1;
+        }
+        else if(op == OP_LINE && k + operand <= length){
+            ret = program_line(code + k, operand, &cmd, *prev_return, *prev_pid);
+            k += operand;
+        }
+        else{
+            fprintf(stderr, "Invalid compiled script\n");
+            print_failure("1", prev_return);
+            return;
+        }
+
+        if(ret == -1){
+            print_failure("1", prev_return);
+            continue;
+        }
+
+        //Empty line, blanks or comment only
+        if(cmd.nb_args == 0)
+            continue;
+
+        run_command_line(&cmd, prev_return, prev_pid);
+    }
+}
+
+
+/*************************************program_cache_path*****************************************
+*
+* Get the file caching the compiled form of a script : $XDG_CACHE_HOME/shell/HASH.shc, or
+* ~/.cache/shell/HASH.shc, HASH being the hash of the path of the script
+*
+* ARGUMENT :
+*   - script : the absolute path of the script
+*   - path : will contain the path of the cache file
+*   - size : the size of path
+*
+* RETURN : true if successful, false if there is no cache directory
+*
+*******************************************************************************************/
+static bool program_cache_path(const char* script, char* path, size_t size){
+
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    int length;
+
+    if(cache != NULL && cache[0] == '/')
+        length = snprintf(path, size, "%s", cache);
+    else if(home != NULL && home[0] == '/')
+        length = snprintf(path, size, "%s/.cache", home);
+    else
+        return false;
+
+    if(length < 0 || (size_t) length + 32 >= size)
+        return false;
+
+    mkdir(path, 0700);
+    strcat(path, "/shell");
+    if(mkdir(path, 0700) == -1 && errno != EEXIST)
+        return false;
+
+    snprintf(path + length + 6, size - length - 6, "/%016lx.shc", hash_string(script));
+    return true;
+}
+
+
+/*************************************program_builtins_hash*****************************************
+*
+* Hash the names of the built-ins, the compiled scripts refer to them by index
+*
+* ARGUMENT : /
+*
+* RETURN : the hash value
+*
+*******************************************************************************************/
+static unsigned long program_builtins_hash(void){
+
+    unsigned long hash = 0;
+
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+        hash = hash * 31 + hash_string(builtins[i].name);
+
+    return hash;
+}
+
+
+/*************************************program_save*****************************************
+*
+* Write the compiled form of a script to its cache file (through a temporary file renamed
+* over it, other shells may be reading it)
+*
+* ARGUMENT :
+*   - cache : the path of the cache file
+*   - header : the header of the cache file
+*   - script : the absolute path of the script
+*   - code : the instructions
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void program_save(const char* cache, const struct program_header* header,
+                         const char* script, const uint32_t* code){
+
+    char temp[PATH_MAX + 32];
+    snprintf(temp, sizeof(temp), "%s.%d", cache, (int) getpid());
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1)
+        return;
+
+    //Header, path padded to 4 bytes, instructions
+    uint32_t padding = 0;
+    struct iovec parts[4] = {
+        {(void*) header, sizeof(*header)},
+        {(void*) script, header->path_length},
+        {&padding, (4 - header->path_length % 4) % 4},
+        {(void*) code, header->code_length * sizeof(uint32_t)},
+    };
+
+    size_t total = 0;
+    for(int i = 0; i < 4; i++)
+        total += parts[i].iov_len;
+
+    bool written = writev(fd, parts, 4) == (ssize_t) total;
+    close(fd);
+
+    if(!written || rename(temp, cache) == -1)
+        unlink(temp);
+}
+
+
+/*************************************program_entry_compare*****************************************
+*
+* Compare two cache files, the most recently used first (qsort)
+*
+*******************************************************************************************/
+static int program_entry_compare(const void* a, const void* b){
+
+    long long first = ((const struct program_entry*) a)->mtime_ns;
+    long long second = ((const struct program_entry*) b)->mtime_ns;
+
+    return (first < second) - (first > second);
+}
+
+
+/*************************************program_prune*****************************************
+*
+* Remove from the cache directory the files of scripts that no longer exist, the temporary
+* files left by a shell killed while saving, then the least recently used files until they
+* hold at most PROGRAM_CACHE_MAX bytes
+*
+* ARGUMENT :
+*   - cache : the path of a cache file of the directory
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void program_prune(const char* cache){
+
+    char dir[PATH_MAX];
+    const char* slash = strrchr(cache, '/');
+    if(slash == NULL || (size_t) (slash - cache) >= sizeof(dir))
+        return;
+    snprintf(dir, sizeof(dir), "%.*s", (int) (slash - cache), cache);
+
+    DIR* stream = opendir(dir);
+    if(stream == NULL)
+        return;
+
+    struct program_entry* entries = NULL;
+    size_t nb_entries = 0;
+    size_t capacity = 0;
+    time_t now = time(NULL);
+
+    struct dirent* file;
+    while((file = readdir(stream)) != NULL){
+
+        const char* name = file->d_name;
+        size_t length = strlen(name);
+        struct stat st;
+
+        if(name[0] == '.' || fstatat(dirfd(stream), name, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+           !S_ISREG(st.st_mode))
+            continue;
+
+        //HASH.shc.PID
+        if(length < 4 || strcmp(name + length - 4, ".shc") || length >= sizeof(entries->name)){
+            if(now - st.st_mtime > PROGRAM_CACHE_TOUCH)
+                unlinkat(dirfd(stream), name, 0);
+            continue;
+        }
+
+        //The header gives the script
+        struct program_header header;
+        char script[PATH_MAX];
+        bool orphan = false;
+
+        int fd = openat(dirfd(stream), name, O_RDONLY | O_CLOEXEC);
+        if(fd != -1){
+            if(pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+               header.path_length < sizeof(script) &&
+               pread(fd, script, header.path_length, sizeof(header)) == (ssize_t) header.path_length){
+                script[header.path_length] = 0;
+                orphan = access(script, F_OK) == -1 && errno == ENOENT;
+            }
+            close(fd);
+        }
+
+        if(orphan){
+            unlinkat(dirfd(stream), name, 0);
+            continue;
+        }
+
+        if(nb_entries == capacity){
+            size_t new_capacity = capacity == 0 ? 64 : capacity * 2;
+            struct program_entry* new_entries = realloc(entries, new_capacity * sizeof(*entries));
+            if(new_entries == NULL)
+                break;
+            entries = new_entries;
+            capacity = new_capacity;
+        }
+
+        memcpy(entries[nb_entries].name, name, length + 1);
+        entries[nb_entries].mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        entries[nb_entries].size = st.st_size;
+        nb_entries++;
+    }
+
+    //Least recently used beyond the limit, the most recent one is kept whatever its size
+    qsort(entries, nb_entries, sizeof(*entries), program_entry_compare);
+
+    off_t total = 0;
+    for(size_t i = 0; i < nb_entries; i++){
+        total += entries[i].size;
+        if(i > 0 && total > PROGRAM_CACHE_MAX)
+            unlinkat(dirfd(stream), entries[i].name, 0);
+    }
+
+    free(entries);
+    closedir(stream);
+}
+
+
+/*************************************program_script*****************************************
+*
+* Run a script from its compiled form. The compiled form is kept in a cache file (see
+* program_cache_path) mapped in memory on the next runs, as long as the size and mtime of
+* the script, or else its content, are unchanged.
+*
+* ARGUMENT :
+*   - script : the path of the script
+*   - prev_return : the previous return value, will contain the new one
+*   - prev_pid : the previous pid of the background pipeline, will contain the new one
+*
+* RETURN : 0 if the script was run, -1 if it must be run line by line
+*
+*******************************************************************************************/
+int program_script(const char* script, int* prev_return, int* prev_pid){
+
+    char* real = realpath(script, NULL);
+    if(real == NULL)
+        return -1;
+
+    int fd = open(real, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)){
+        if(fd != -1)
+            close(fd);
+        free(real);
+        return -1;
+    }
+
+    struct program_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SHC1", 4);
+    header.version = PROGRAM_VERSION;
+    header.builtins_hash = program_builtins_hash();
+    header.mtime_sec = st.st_mtim.tv_sec;
+    header.mtime_nsec = st.st_mtim.tv_nsec;
+    header.size = st.st_size;
+    header.path_length = strlen(real);
+
+    char cache[PATH_MAX];
+    bool cached = program_cache_path(real, cache, sizeof(cache));
+
+    //Compiled form of a previous run
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+    const struct program_header* old = NULL;
+
+    int cache_fd = cached ? open(cache, O_RDONLY | O_CLOEXEC) : -1;
+    if(cache_fd != -1){
+
+        struct stat cache_st;
+        if(fstat(cache_fd, &cache_st) == 0 && (size_t) cache_st.st_size >= sizeof(header)){
+            map_size = cache_st.st_size;
+            map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+
+            //The mtime orders the files for program_prune, it isn't updated on every run
+            if(time(NULL) - cache_st.st_mtime > PROGRAM_CACHE_TOUCH)
+                futimens(cache_fd, NULL);
+        }
+        close(cache_fd);
+    }
+
+    if(map != MAP_FAILED){
+
+        old = map;
+        size_t path_words = (old->path_length + 3) / 4;
+
+        if(memcmp(old->magic, "SHC1", 4) || old->version != PROGRAM_VERSION ||
+           old->builtins_hash != header.builtins_hash || old->path_length != header.path_length ||
+           map_size != sizeof(header) + (path_words + (size_t) old->code_length) * 4 ||
+           memcmp((char*) map + sizeof(header), real, header.path_length))
+            old = NULL;
+    }
+
+    const uint32_t* code = NULL;
+    size_t code_length = 0;
+    if(old != NULL){
+        code = (const uint32_t*) ((char*) map + sizeof(header)) + (header.path_length + 3) / 4;
+        code_length = old->code_length;
+    }
+
+    //The script changed (or was touched) since it was compiled
+    if(old == NULL || old->mtime_sec != header.mtime_sec || old->mtime_nsec != header.mtime_nsec ||
+       old->size != header.size){
+
+        char* text = malloc(st.st_size + 1);
+        size_t length = 0;
+
+        while(text != NULL && length < (size_t) st.st_size){
+            ssize_t n = pread(fd, text + length, st.st_size - length, length);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            length += n;
+        }
+
+        if(text == NULL || length != (size_t) st.st_size){
+            free(text);
+            if(map != MAP_FAILED)
+                munmap(map, map_size);
+            close(fd);
+            free(real);
+            return -1;
+        }
+        text[length] = 0;
+
+        header.content_hash = hash_bytes(text, length);
+
+        //Only touched : the compiled form is still the right one
+        if(old == NULL || old->content_hash != header.content_hash){
+
+            if(!program_compile(text, length)){
+                free(text);
+                if(map != MAP_FAILED)
+                    munmap(map, map_size);
+                close(fd);
+                free(real);
+                return -1;
+            }
+
+            code = program_code;
+            code_length = program_length;
+        }
+
+        header.code_length = code_length;
+        if(cached){
+            program_save(cache, &header, real, code);
+            program_prune(cache);
+        }
+
+        free(text);
+    }
+
+    close(fd);
+    free(real);
+
+    program_run(code, code_length, prev_return, prev_pid);
+
+    if(map != MAP_FAILED)
+        munmap(map, map_size);
+    return 0;
+}
+
+
+/*************************************assign_variable*****************************************
+*
+* Store the variable of an assignment NAME=VALUE. For compatibility, the words following
+* the assignment are appended to the value, separated by whitespaces.
+*
+* ARGUMENT :
+*   - cmd : the words of the line, args[0] being an assignment
+*
+* RETURN : 0 if successful, -1 otherwise
+*
+*******************************************************************************************/
+int assign_variable(struct command_line* cmd){
+
+    char** args = cmd->args;
+
+    if(args[1] == NULL){
+        args[0][cmd->assignment] = 0;
+        return var_set(args[0], args[0] + cmd->assignment + 1) ? 0 : -1;
+    }
+
+    char* name = join_args(args);
+    if(name == NULL)
+        return -1;
+
+    name[cmd->assignment] = 0;
+    bool ret = var_set(name, name + cmd->assignment + 1);
+    free(name);
+
+    return ret ? 0 : -1;
+}
+
+
+/*************************************print_failure*****************************************
+*
+* Change the value of the previous return value to 1 when there is an error, then print 1.
+*
+* ARGUMENT :
+*   - prev_return : the previous return value
+*   - return_nb : a string corresponding to the error value
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void print_failure(char* return_nb, int* prev_return){
+    *prev_return = atoi(return_nb);
+    if(show_status)
+        printf("%s", return_nb);
+}
+
+
+/*************************************print_success*****************************************
+*
+* Change the value of the previous return value to 0 after a successful built-in, then
+* print 0.
+*
+* ARGUMENT :
+*   - prev_return : the previous return value
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void print_success(int* prev_return){
+    *prev_return = 0;
+    if(show_status)
+        printf("0");
+}
+
+
+
+
+/*************************************run_command_line*****************************************
+*
+* Run the commands of a line : variable assignment, built-in or pipeline
+*
+* ARGUMENT :
+*   - cmd : the words of the line
+*   - prev_return : the previous return value, will contain the new one
+*   - prev_pid : the previous pid of the background pipeline, will contain the new one
+*
+* RETURN : /
+*
+*******************************************************************************************/
+void run_command_line(struct command_line* cmd, int* prev_return, int* prev_pid){
+
+    //time CMD : report the resources used by CMD
+    if(!strcmp(cmd->args[0], "time") && !cmd->background){
+
+        if(cmd->args[1] == NULL){
+            fprintf(stderr, "time: missing command\n");
+            print_failure("1", prev_return);
+            return;
+        }
+
+        cmd->timed = true;
+        cmd->stages[0] = 1;
+    }
+
+    char** args = &cmd->args[cmd->stages[0]];
+
+    //Check if the user enters a variable
+    if(cmd->assignment != -1 && !cmd->timed && cmd->nb_stages == 1 && !cmd->background){
+
+        if(assign_variable(cmd) == -1)
+            print_failure("1", prev_return);
+        else
+            print_success(prev_return);
+        return;
+    }
+
+    //A built-in in a pipeline or in background runs in a son
+    const struct builtin* builtin = NULL;
+    if(cmd->nb_stages == 1 && !cmd->background){
+
+        //Compiled line : the name was already looked up
+        if(cmd->builtin != -1 && args == cmd->args){
+            builtin = cmd->builtin == 0 ? NULL : &builtins[cmd->builtin - 1];
+            if(builtin != NULL && builtin->supports != NULL && !builtin->supports(args))
+                builtin = NULL;
+        }
+        else
+            builtin = find_builtin(args);
+    }
+
+    //The command is a built-in command
+    if(builtin != NULL){
+
+        struct rusage usage_before, usage_after;
+        if(cmd->timed)
+            getrusage(RUSAGE_SELF, &usage_before);
+
+        struct fd_moves moves;
+        int saved[MAX_REDIRECTIONS + 2];
+        fd_moves_init(&moves, -1, -1);
+
+        if(!fd_moves_open(&moves, cmd, 0)){
+            print_failure("1", prev_return);
+            return;
+        }
+
+        //The shell's own file descriptors are put back after the built-in
+        if(moves.nb_moves > 0)
+            fd_moves_save(&moves, saved);
+
+        //An error left by what the shell printed before isn't the built-in's
+        clearerr(stdout);
+
+        long long start = now_ns();
+        int ret = builtin->function(args);
+        long long wall_ns = now_ns() - start;
+
+        //Written now when redirected, the shell's own output flushes it otherwise
+        ret = builtin_output(args[0], ret, moves.nb_moves > 0);
+
+        if(moves.nb_moves > 0){
+            fd_moves_restore(&moves, saved);
+            fd_moves_close(&moves);
+        }
+
+        stats_record(args[0], wall_ns, 0, NULL);
+
+        if(cmd->timed){
+            getrusage(RUSAGE_SELF, &usage_after);
+            timersub(&usage_after.ru_utime, &usage_before.ru_utime, &usage_after.ru_utime);
+            timersub(&usage_after.ru_stime, &usage_before.ru_stime, &usage_after.ru_stime);
+            print_time(wall_ns, &usage_after);
+        }
+
+        if(ret != 0){
+            char return_nb[16];
+            snprintf(return_nb, sizeof(return_nb), "%d", ret);
+            print_failure(return_nb, prev_return);
+        }
+        else
+            print_success(prev_return);
+        return;
+    }
+
+    run_pipeline(cmd, prev_return, prev_pid);
+}
+
+
+/*************************************history_parse*****************************************
+*
+* Read the header of a record of the history file : "#LLLLLLLL TEXT\n", LLLLLLLL being the
+* length of TEXT in hexadecimal
+*
+* ARGUMENT :
+*   - record : the start of the record
+*   - available : the number of bytes of the file from the start of the record
+*   - length : will contain the length of the text
+*
+* RETURN : 1 if the record is complete, 0 if it is still being written, -1 if it is corrupt
+*
+*******************************************************************************************/
+static int history_parse(const char* record, size_t available, size_t* length){
+
+    if(available < HISTORY_HEADER)
+        return 0;
+    if(record[0] != '#' || record[HISTORY_HEADER - 1] != ' ')
+        return -1;
+
+    *length = 0;
+    for(int i = 1; i < HISTORY_HEADER - 1; i++){
+
+        char c = record[i];
+        if(!isxdigit((unsigned char) c))
+            return -1;
+        *length = *length * 16 + (isdigit((unsigned char) c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+
+    if(HISTORY_HEADER + *length >= available)
+        return 0;
+
+    return record[HISTORY_HEADER + *length] == '\n' ? 1 : -1;
+}
+
+
+/*************************************history_scan*****************************************
+*
+* Cut the mapped history file into records, from a position up to the first incomplete
+* record. A corrupt record (torn by a crash) is skipped up to the next line.
+*
+* ARGUMENT :
+*   - position : the position to start from, will contain the position of the first byte
+*                not cut
+*   - offsets : the growable array receiving the offsets of the records
+*   - count : the number of offsets in the array
+*   - capacity : the capacity of the array
+*
+* RETURN : true if successful, false if memory is missing
+*
+*******************************************************************************************/
+static bool history_scan(size_t* position, uint64_t** offsets, size_t* count, size_t* capacity){
+
+    size_t pos = *position;
+    size_t length;
+
+    while(pos < history_mapped){
+
+        int state = history_parse(history_map + pos, history_mapped - pos, &length);
+        if(state == 0)
+            break;
+
+        if(state == -1){
+            const char* end = memchr(history_map + pos, '\n', history_mapped - pos);
+            if(end == NULL)
+                break;
+            pos = end - history_map + 1;
+            continue;
+        }
+
+        if(*count == *capacity){
+            size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+            uint64_t* new_offsets = realloc(*offsets, new_capacity * sizeof(uint64_t));
+            if(new_offsets == NULL){
+                *position = pos;
+                return false;
+            }
+            *offsets = new_offsets;
+            *capacity = new_capacity;
+        }
+
+        (*offsets)[(*count)++] = pos;
+        pos += HISTORY_HEADER + length + 1;
+    }
+
+    *position = pos;
+    return true;
+}
+
+
+/*************************************history_map_file*****************************************
+*
+* Map the history file again if it grew
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_map_file(void){
+
+    struct stat st;
+    if(history_fd == -1 || fstat(history_fd, &st) == -1 || (size_t) st.st_size <= history_mapped)
+        return;
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, history_fd, 0);
+    if(map == MAP_FAILED)
+        return;
+
+    if(history_map != NULL)
+        munmap(history_map, history_mapped);
+    history_map = map;
+    history_mapped = st.st_size;
+}
+
+
+/*************************************history_refresh*****************************************
+*
+* Cut the records the other shells (or this one) appended to the history file since the
+* last call
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_refresh(void){
+
+    history_map_file();
+    history_scan(&history_scanned, &history_tail, &history_nb_tail, &history_tail_capacity);
+}
+
+
+/*************************************history_count*****************************************
+*
+* Get the number of records of the history
+*
+* ARGUMENT : /
+*
+* RETURN : the number of records
+*
+*******************************************************************************************/
+static size_t history_count(void){
+
+    return (history_index != NULL ? history_index->nb_records : 0) + history_nb_tail;
+}
+
+
+/*************************************history_record*****************************************
+*
+* Get the text of a record of the history
+*
+* ARGUMENT :
+*   - number : the number of the record, from 0 for the oldest one
+*   - length : will contain the length of the text
+*
+* RETURN : the text, not ending with 0
+*
+*******************************************************************************************/
+static const char* history_record(size_t number, size_t* length){
+
+    size_t nb_indexed = history_index != NULL ? history_index->nb_records : 0;
+    uint64_t offset = number < nb_indexed ? history_indexed[number] : history_tail[number - nb_indexed];
+
+    history_parse(history_map + offset, history_mapped - offset, length);
+    return history_map + offset + HISTORY_HEADER;
+}
+
+
+/*************************************history_trigram_compare*****************************************
+*
+* Compare two trigrams of the index, for qsort and bsearch
+*
+* ARGUMENT :
+*   - a : the first trigram
+*   - b : the second trigram
+*
+* RETURN : <0, 0 or >0 like strcmp
+*
+*******************************************************************************************/
+static int history_trigram_compare(const void* a, const void* b){
+
+    uint32_t x = ((const struct history_trigram*) a)->trigram;
+    uint32_t y = ((const struct history_trigram*) b)->trigram;
+    return (x > y) - (x < y);
+}
+
+
+/*************************************history_index_load*****************************************
+*
+* Map the index of the history file (HISTFILE.idx) if it matches the file : the records
+* after the part it covers are cut by history_refresh
+*
+* ARGUMENT : /
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_index_load(void){
+
+    if(history_index_map != NULL){
+        munmap(history_index_map, history_index_size);
+        history_index_map = NULL;
+        history_index = NULL;
+    }
+
+    history_nb_tail = 0;
+    history_scanned = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.idx", history_path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd == -1)
+        return;
+    if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct history_index_header)){
+        close(fd);
+        return;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return;
+
+    const struct history_index_header* header = map;
+    size_t size = sizeof(*header) + header->nb_records * sizeof(uint64_t) +
+                  header->nb_trigrams * sizeof(struct history_trigram) + header->postings_size;
+
+    //The history file must still start with the part that was indexed
+    size_t tail = header->covered < 4096 ? header->covered : 4096;
+    if(memcmp(header->magic, "SHI1", 4) || size != (size_t) st.st_size ||
+       header->covered > history_mapped ||
+       hash_bytes(history_map + header->covered - tail, tail) != header->covered_hash){
+        munmap(map, st.st_size);
+        return;
+    }
+
+    history_index_map = map;
+    history_index_size = st.st_size;
+    history_index = header;
+    history_indexed = (const uint64_t*) (header + 1);
+    history_trigrams = (const struct history_trigram*) (history_indexed + header->nb_records);
+    history_postings = (const unsigned char*) (history_trigrams + header->nb_trigrams);
+    history_scanned = header->covered;
+}
+
+
+/*************************************history_index_build*****************************************
+*
+* Write the index of the whole history file : for each trigram, the numbers of the records
+* containing it, delta-encoded in varints. The (trigram, record) pairs are radix sorted,
+* by parts of HISTORY_INDEX_CHUNK pairs to bound the memory used.
+*
+* ARGUMENT : /
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool history_index_build(void){
+
+    uint64_t* offsets = NULL;
+    size_t nb_records = 0, records_capacity = 0;
+    size_t covered = 0;
+
+    if(!history_scan(&covered, &offsets, &nb_records, &records_capacity)){
+        free(offsets);
+        return false;
+    }
+
+    size_t total = 0;
+    for(size_t r = 0; r < nb_records; r++){
+        size_t length;
+        history_parse(history_map + offsets[r], history_mapped - offsets[r], &length);
+        total += length > 2 ? length - 2 : 0;
+    }
+
+    size_t nb_parts = total / HISTORY_INDEX_CHUNK + 1;
+    uint64_t* pairs = NULL;
+    uint64_t* sorted = NULL;
+    size_t pairs_capacity = 0;
+    struct history_trigram* trigrams = NULL;
+    size_t nb_trigrams = 0, trigrams_capacity = 0;
+    unsigned char* postings = NULL;
+    size_t postings_size = 0, postings_capacity = 0;
+    bool ret = false;
+
+    for(size_t part = 0; part < nb_parts; part++){
+
+        //Pairs of the trigrams of this part, by record number
+        size_t nb_pairs = 0;
+        for(size_t r = 0; r < nb_records; r++){
+
+            size_t length;
+            const unsigned char* text = (const unsigned char*) history_map + offsets[r] + HISTORY_HEADER;
+            history_parse(history_map + offsets[r], history_mapped - offsets[r], &length);
+
+            for(size_t j = 0; j + 2 < length; j++){
+
+                uint32_t trigram = text[j] << 16 | text[j+1] << 8 | text[j+2];
+                if(trigram % nb_parts != part)
+                    continue;
+
+                if(nb_pairs == pairs_capacity){
+                    size_t new_capacity = pairs_capacity ? pairs_capacity * 2 : 65536;
+                    uint64_t* new_pairs = realloc(pairs, new_capacity * sizeof(uint64_t));
+                    uint64_t* new_sorted = new_pairs ? realloc(sorted, new_capacity * sizeof(uint64_t)) : NULL;
+                    if(new_pairs != NULL)
+                        pairs = new_pairs;
+                    if(new_sorted == NULL)
+                        goto end;
+                    sorted = new_sorted;
+                    pairs_capacity = new_capacity;
+                }
+
+                pairs[nb_pairs++] = (uint64_t) trigram << 32 | r;
+            }
+        }
+
+        //Stable radix sort on the 24 bits of the trigram, 12 bits at a time
+        for(int shift = 32; shift < 56; shift += 12){
+
+            size_t counts[4097] = {0};
+            for(size_t k = 0; k < nb_pairs; k++)
+                counts[((pairs[k] >> shift) & 4095) + 1]++;
+            for(int b = 0; b < 4096; b++)
+                counts[b+1] += counts[b];
+            for(size_t k = 0; k < nb_pairs; k++)
+                sorted[counts[(pairs[k] >> shift) & 4095]++] = pairs[k];
+
+            uint64_t* swap = pairs;
+            pairs = sorted;
+            sorted = swap;
+        }
+
+        for(size_t k = 0; k < nb_pairs; ){
+
+            if(nb_trigrams == trigrams_capacity){
+                size_t new_capacity = trigrams_capacity ? trigrams_capacity * 2 : 4096;
+                struct history_trigram* new_trigrams = realloc(trigrams, new_capacity * sizeof(*trigrams));
+                if(new_trigrams == NULL)
+                    goto end;
+                trigrams = new_trigrams;
+                trigrams_capacity = new_capacity;
+            }
+
+            struct history_trigram* entry = &trigrams[nb_trigrams++];
+            entry->trigram = pairs[k] >> 32;
+            entry->count = 0;
+            entry->postings = postings_size;
+
+            //Gaps between the records, a record containing the trigram twice counts once
+            long long previous = -1;
+            for(; k < nb_pairs && pairs[k] >> 32 == entry->trigram; k++){
+
+                long long record = pairs[k] & 0xffffffff;
+                if(record == previous)
+                    continue;
+
+                if(postings_size + 10 > postings_capacity){
+                    size_t new_capacity = postings_capacity ? postings_capacity * 2 : 65536;
+                    unsigned char* new_postings = realloc(postings, new_capacity);
+                    if(new_postings == NULL)
+                        goto end;
+                    postings = new_postings;
+                    postings_capacity = new_capacity;
+                }
+
+                uint64_t gap = record - previous - 1;
+                while(gap >= 128){
+                    postings[postings_size++] = (gap & 127) | 128;
+                    gap >>= 7;
+                }
+                postings[postings_size++] = gap;
+
+                previous = record;
+                entry->count++;
+            }
+        }
+    }
+
+    qsort(trigrams, nb_trigrams, sizeof(*trigrams), history_trigram_compare);
+
+    struct history_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SHI1", 4);
+    header.nb_trigrams = nb_trigrams;
+    header.covered = covered;
+    size_t tail = covered < 4096 ? covered : 4096;
+    header.covered_hash = hash_bytes(history_map + covered - tail, tail);
+    header.nb_records = nb_records;
+    header.postings_size = postings_size;
+
+    char path[PATH_MAX], temp[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s.idx", history_path);
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1)
+        goto end;
+
+    struct iovec parts[4] = {
+        {&header, sizeof(header)},
+        {offsets, nb_records * sizeof(uint64_t)},
+        {trigrams, nb_trigrams * sizeof(*trigrams)},
+        {postings, postings_size},
+    };
+
+    //writev may stop early on large buffers
+    ret = true;
+    for(int i = 0; i < 4 && ret; i++){
+        for(size_t done = 0; done < parts[i].iov_len && ret; ){
+            ssize_t n = write(fd, (char*) parts[i].iov_base + done, parts[i].iov_len - done);
+            if(n < 0 && errno == EINTR)
+                continue;
+            ret = n > 0;
+            done += n > 0 ? n : 0;
+        }
+    }
+    close(fd);
+
+    if(!ret || rename(temp, path) == -1){
+        unlink(temp);
+        ret = false;
+    }
+
+end:
+    free(offsets);
+    free(pairs);
+    free(sorted);
+    free(trigrams);
+    free(postings);
+    return ret;
+}
+
+
+/*************************************history_open*****************************************
+*
+* Open the history file ($HISTFILE, or else ~/.shell_history) shared by the interactive
+* shells, with its index. The index is rebuilt once more than HISTORY_TAIL_MAX records
+* are after the part it covers.
+*
+* ARGUMENT : /
+*
+* RETURN : true if successful, false if there is no history file
+*
+*******************************************************************************************/
+static bool history_open(void){
+
+    if(history_fd != -1)
+        return true;
+
+    const char* file = getenv("HISTFILE");
+    const char* home = getenv("HOME");
+    char path[PATH_MAX];
+
+    if(file != NULL && file[0] != 0)
+        snprintf(path, sizeof(path), "%s", file);
+    else if(home != NULL && home[0] != 0)
+        snprintf(path, sizeof(path), "%s/.shell_history", home);
+    else
+        return false;
+
+    history_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if(history_fd == -1)
+        return false;
+
+    history_path = strdup(path);
+    if(history_path == NULL){
+        close(history_fd);
+        history_fd = -1;
+        return false;
+    }
+
+    history_map_file();
+    history_index_load();
+    history_refresh();
+
+    if(history_nb_tail > HISTORY_TAIL_MAX && history_index_build()){
+        history_index_load();
+        history_refresh();
+    }
+
+    return true;
+}
+
+
+/*************************************history_add*****************************************
+*
+* Append a line to the history file. The record is written at once to the end of the file
+* (O_APPEND) : the records of concurrent shells are never mixed.
+*
+* ARGUMENT :
+*   - line : the line, without its '\n'
+*   - length : the length of the line
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_add(const char* line, size_t length){
+
+    if(history_fd == -1 || length == 0 || length > 0xffffffff)
+        return;
+
+    char* record = malloc(HISTORY_HEADER + length + 1);
+    if(record == NULL)
+        return;
+
+    snprintf(record, HISTORY_HEADER + 1, "#%08zx ", length);
+    memcpy(record + HISTORY_HEADER, line, length);
+    record[HISTORY_HEADER + length] = '\n';
+
+    if(write(history_fd, record, HISTORY_HEADER + length + 1) == -1)
+        perror("History couldn't be saved");
+    free(record);
+}
+
+
+/*************************************history_candidates*****************************************
+*
+* Get the indexed records that may contain a text : the ones containing its rarest trigram
+*
+* ARGUMENT :
+*   - text : the text searched
+*   - length : the length of the text
+*   - records : will contain the numbers of the records in increasing order (to free)
+*
+* RETURN : the number of records, -1 if every indexed record must be checked
+*
+*******************************************************************************************/
+static long history_candidates(const char* text, size_t length, uint32_t** records){
+
+    *records = NULL;
+
+    if(length < 3 || history_index == NULL)
+        return -1;
+
+    const struct history_trigram* rarest = NULL;
+    for(size_t j = 0; j + 2 < length; j++){
+
+        struct history_trigram key;
+        key.trigram = (unsigned char) text[j] << 16 | (unsigned char) text[j+1] << 8 | (unsigned char) text[j+2];
+
+        const struct history_trigram* entry = bsearch(&key, history_trigrams, history_index->nb_trigrams,
+                                                      sizeof(key), history_trigram_compare);
+        if(entry == NULL)
+            return 0;
+        if(rarest == NULL || entry->count < rarest->count)
+            rarest = entry;
+    }
+
+    *records = malloc(rarest->count * sizeof(uint32_t) + 1);
+    if(*records == NULL)
+        return -1;
+
+    const unsigned char* posting = history_postings + rarest->postings;
+    long long previous = -1;
+    for(uint32_t k = 0; k < rarest->count; k++){
+
+        uint64_t gap = 0;
+        for(int shift = 0; ; shift += 7){
+            gap |= (uint64_t) (*posting & 127) << shift;
+            if(!(*posting++ & 128))
+                break;
+        }
+
+        previous += gap + 1;
+        (*records)[k] = previous;
+    }
+
+    return rarest->count;
+}
+
+
+/*************************************history_match*****************************************
+*
+* Check if a record of the history contains a text
+*
+* ARGUMENT :
+*   - number : the number of the record
+*   - text : the text searched
+*   - length : the length of the text
+*
+* RETURN : true if it does, false otherwise
+*
+*******************************************************************************************/
+static bool history_match(size_t number, const char* text, size_t length){
+
+    size_t record_length;
+    const char* record = history_record(number, &record_length);
+    return memmem(record, record_length, text, length) != NULL;
+}
+
+
+/*************************************history_search*****************************************
+*
+* Find the most recent record containing a text, before a given record. The records not
+* indexed yet are scanned, then the indexed candidates (see history_candidates).
+*
+* ARGUMENT :
+*   - text : the text searched
+*   - length : the length of the text
+*   - before : the number of the record the search starts before
+*
+* RETURN : the number of the record, -1 if none
+*
+*******************************************************************************************/
+static long history_search(const char* text, size_t length, size_t before){
+
+    size_t nb_indexed = history_index != NULL ? history_index->nb_records : 0;
+
+    if(length == 0)
+        return -1;
+
+    for(size_t r = before; r > nb_indexed; r--){
+        if(history_match(r - 1, text, length))
+            return r - 1;
+    }
+
+    if(before > nb_indexed)
+        before = nb_indexed;
+
+    uint32_t* records;
+    long nb_records = history_candidates(text, length, &records);
+    long found = -1;
+
+    for(size_t k = nb_records == -1 ? before : (size_t) nb_records; k > 0 && found == -1; k--){
+
+        size_t r = nb_records == -1 ? k - 1 : records[k-1];
+        if(r < before && history_match(r, text, length))
+            found = r;
+    }
+
+    free(records);
+    return found;
+}
+
+
+/*************************************history_draw*****************************************
+*
+* Draw the line being edited again, or the reverse search
+*
+* ARGUMENT :
+*   - line : the line
+*   - length : the length of the line
+*   - query : the text searched, NULL if not searching
+*   - query_length : the length of the text searched
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_draw(const char* line, size_t length, const char* query, size_t query_length){
+
+    if(query != NULL)
+        printf("\r(reverse-i-search)`%.*s': %.*s\x1b[K", (int) query_length, query, (int) length, line);
+    else
+        printf("\r> %.*s\x1b[K", (int) length, line);
+    fflush(stdout);
+}
+
+
+/*************************************history_reserve*****************************************
+*
+* Make sure the buffer of the line being edited can hold a line, its '\n' and its 0
+*
+* ARGUMENT :
+*   - line : the buffer, may be moved
+*   - capacity : the size of the buffer
+*   - length : the length of the line
+*
+* RETURN : true if successful, false if the line would be longer than ARG_MAX
+*
+*******************************************************************************************/
+static bool history_reserve(char** line, size_t* capacity, size_t length){
+
+    if(length + 2 <= *capacity)
+        return true;
+    if(length > get_arg_max())
+        return false;
+
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while(new_capacity < length + 2)
+        new_capacity *= 2;
+
+    char* new_line = realloc(*line, new_capacity);
+    if(new_line == NULL)
+        return false;
+
+    *line = new_line;
+    *capacity = new_capacity;
+    return true;
+}
+
+
+/*************************************completion_add*****************************************
+*
+* Add a candidate to a completion
+*
+* ARGUMENT :
+*   - list : the candidates
+*   - name : the candidate
+*   - length : its length
+*   - directory : a '/' is added to it
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void completion_add(struct completion* list, const char* name, size_t length, bool directory){
+
+    if(list->count == list->capacity){
+
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+        char** new_names = realloc(list->names, new_capacity * sizeof(char*));
+        if(new_names == NULL)
+            return;
+
+        list->names = new_names;
+        list->capacity = new_capacity;
+    }
+
+    char* copy = arena_alloc(length + 2);
+    if(copy == NULL)
+        return;
+
+    memcpy(copy, name, length);
+    if(directory)
+        copy[length++] = '/';
+    copy[length] = 0;
+
+    list->names[list->count++] = copy;
+}
+
+
+/*************************************completion_trie*****************************************
+*
+* Add the executables of a subtree of the tree of $PATH to a completion, in order
+*
+* ARGUMENT :
+*   - list : the candidates
+*   - node : the root of the subtree
+*   - name : the name of the node, followed by room for NAME_MAX characters
+*   - length : the length of the name
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void completion_trie(struct completion* list, int node, char* name, size_t length){
+
+    if(trie_nodes[node].dirs != 0)
+        completion_add(list, name, length, false);
+
+    if(length >= NAME_MAX)
+        return;
+
+    for(int child = trie_nodes[node].child; child != -1; child = trie_nodes[child].sibling){
+        name[length] = trie_nodes[child].c;
+        completion_trie(list, child, name, length + 1);
+    }
+}
+
+
+/*************************************completion_files*****************************************
+*
+* Add the files of a directory starting like the word being completed. Hidden files are
+* only candidates if the word starts with a '.'.
+*
+* ARGUMENT :
+*   - list : the candidates
+*   - word : the word (a path), the part after its last '/' is completed
+*   - length : the length of the word
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void completion_files(struct completion* list, const char* word, size_t length){
+
+    const char* slash = memrchr(word, '/', length);
+    const char* base = slash != NULL ? slash + 1 : word;
+    size_t base_length = word + length - base;
+
+    char dir[PATH_MAX];
+    if(slash == NULL)
+        strcpy(dir, ".");
+    else if(slash == word)
+        strcpy(dir, "/");
+    else if((size_t) (slash - word) < sizeof(dir))
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - word), word);
+    else
+        return;
+
+    DIR* stream = opendir(dir);
+    if(stream == NULL)
+        return;
+
+    struct dirent* file;
+    while((file = readdir(stream)) != NULL){
+
+        const char* name = file->d_name;
+        if(strncmp(name, base, base_length) || (name[0] == '.' && (base_length == 0 || base[0] != '.')) ||
+           !strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+
+        bool directory = file->d_type == DT_DIR;
+        if(file->d_type == DT_LNK || file->d_type == DT_UNKNOWN){
+            struct stat st;
+            directory = fstatat(dirfd(stream), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        completion_add(list, name, strlen(name), directory);
+    }
+
+    closedir(stream);
+}
+
+
+/*************************************completion_compare*****************************************
+*
+* Compare two candidates (qsort)
+*
+* ARGUMENT :
+*   - a, b : the candidates
+*
+* RETURN : like strcmp
+*
+*******************************************************************************************/
+static int completion_compare(const void* a, const void* b){
+
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+/*************************************history_complete*****************************************
+*
+* Complete the last word of the line being edited (Tab). The first word of a command is
+* completed with the built-ins and the executables of $PATH (from the tree, no directory
+* is read), the other words and the paths with the files. The word is extended as far as
+* the candidates agree, they are listed if it can't be.
+*
+* ARGUMENT :
+*   - line_buffer : the buffer of the line, may be moved
+*   - capacity : the size of the buffer
+*   - length : the length of the line, updated
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void history_complete(char** line_buffer, size_t* capacity, size_t* length){
+
+    char* line = *line_buffer;
+    size_t start = *length;
+    while(start > 0 && strchr(" \t|;&<>", line[start - 1]) == NULL)
+        start--;
+
+    const char* word = line + start;
+    size_t word_length = *length - start;
+
+    //The first word of a command
+    size_t before = start;
+    while(before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t'))
+        before--;
+    bool command = (before == 0 || strchr("|;&", line[before - 1]) != NULL) &&
+                   memchr(word, '/', word_length) == NULL;
+
+    struct completion list = {NULL, 0, 0};
+    size_t base_length = word_length;
+
+    if(command){
+
+        for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++){
+            if(!strncmp(builtins[i].name, word, word_length))
+                completion_add(&list, builtins[i].name, strlen(builtins[i].name), false);
+        }
+
+        path_trie_build();
+        int node = trie_path_env != NULL && word_length < NAME_MAX ? path_trie_find(word, word_length) : -1;
+        if(node != -1){
+            char name[NAME_MAX + 1];
+            memcpy(name, word, word_length);
+            completion_trie(&list, node, name, word_length);
+        }
+    }
+    else{
+        completion_files(&list, word, word_length);
+        const char* slash = memrchr(word, '/', word_length);
+        if(slash != NULL)
+            base_length = word + word_length - (slash + 1);
+    }
+
+    //Sorted without the doubles (a built-in also in $PATH, the same name in two directories)
+    size_t count = 0;
+    if(list.count > 0){
+
+        qsort(list.names, list.count, sizeof(char*), completion_compare);
+        for(size_t i = 0; i < list.count; i++){
+            if(count == 0 || strcmp(list.names[i], list.names[count - 1]))
+                list.names[count++] = list.names[i];
+        }
+    }
+
+    //The first and the last candidates differ the earliest
+    size_t common = 0;
+    if(count > 0){
+        const char* first = list.names[0];
+        const char* last = list.names[count - 1];
+        while(first[common] != 0 && first[common] == last[common])
+            common++;
+    }
+
+    //The word is extended (a single candidate is completed, with a ' ' after a file)
+    if(common > base_length || count == 1){
+
+        const char* added = list.names[0] + base_length;
+        size_t added_length = common - base_length;
+        bool space = count == 1 && list.names[0][common - 1] != '/';
+
+        if(history_reserve(line_buffer, capacity, *length + added_length + space)){
+            line = *line_buffer;
+            memcpy(line + *length, added, added_length);
+            *length += added_length;
+            if(space)
+                line[(*length)++] = ' ';
+        }
+    }
+    else if(count > 1){
+
+        struct winsize window;
+        size_t columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_col > 0 ? window.ws_col : 80;
+        size_t shown = count < COMPLETION_SHOWN ? count : COMPLETION_SHOWN;
+
+        size_t width = 0;
+        for(size_t i = 0; i < shown; i++){
+            size_t name_length = strlen(list.names[i]);
+            width = name_length > width ? name_length : width;
+        }
+        width += 2;
+
+        //Several columns, read line by line
+        size_t per_line = columns / width > 0 ? columns / width : 1;
+        size_t nb_lines = (shown + per_line - 1) / per_line;
+
+        printf("\r\n");
+        for(size_t row = 0; row < nb_lines; row++){
+            for(size_t i = row; i < shown; i += nb_lines)
+                printf("%-*s", (int) width, list.names[i]);
+            printf("\r\n");
+        }
+        if(count > shown)
+            printf("(%zu more)\r\n", count - shown);
+    }
+    else if(count == 0)
+        printf("\a");
+
+    free(list.names);
+    history_draw(line, *length, NULL, 0);
+}
+
+
+/*************************************history_read_line*****************************************
+*
+* Read a line from the terminal, with the history :
+*   - Up, Down : previous and next lines of the history
+*   - Ctrl-R : reverse incremental search, Ctrl-R again for an older match, Enter to run the
+*              match, Ctrl-G to give up, any other key to edit it
+*   - Tab : completion of the commands and the files (see history_complete)
+*   - Backspace, Ctrl-U (clear), Ctrl-C (new line), Ctrl-D (end, on an empty line)
+* The line is appended to the history file.
+*
+* ARGUMENT :
+*   - line_buffer : the buffer of the line, grown as needed, will contain the line ending
+*                   with '\n' like getline
+*   - capacity : the size of the buffer
+*
+* RETURN : true if successful, false at the end of the input
+*
+*******************************************************************************************/
+static bool history_read_line(char** line_buffer, size_t* capacity){
+
+    struct termios saved, raw;
+    if(tcgetattr(STDIN_FILENO, &saved) == -1)
+        return getline(line_buffer, capacity, stdin) != -1;
+
+    if(!history_reserve(line_buffer, capacity, 0))
+        return false;
+    char* line = *line_buffer;
+
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    history_refresh();
+
+    size_t length = 0;
+    size_t browsed = history_count(); //Record shown by Up/Down, history_count() for the line typed
+    char* typed = NULL; //Line typed before browsing
+    size_t typed_length = 0;
+
+    bool searching = false;
+    char query[256];
+    size_t query_length = 0;
+    long match = -1;
+
+    bool ret = true;
+
+    while(true){
+
+        char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0){
+            ret = false;
+            break;
+        }
+
+        if(searching){
+
+            size_t match_length = 0;
+            const char* text = "";
+
+            if(c == 18 || (unsigned char) c >= 32 || c == 8){
+
+                //Ctrl-R : older match, otherwise the query changes
+                size_t before = history_count();
+                if(c == 18)
+                    before = match != -1 ? (size_t) match : before;
+                else if(c == 127 || c == 8)
+                    query_length -= query_length > 0;
+                else if(query_length < sizeof(query))
+                    query[query_length++] = c;
+
+                long found = history_search(query, query_length, before);
+                if(found != -1 || c != 18)
+                    match = found;
+
+                if(match != -1)
+                    text = history_record(match, &match_length);
+                history_draw(text, match_length, query, query_length);
+                continue;
+            }
+
+            searching = false;
+
+            //Ctrl-G, Ctrl-C : back to the line typed
+            if(c == 7 || c == 3){
+                history_draw(line, length, NULL, 0);
+                continue;
+            }
+
+            if(match != -1){
+                text = history_record(match, &match_length);
+                if(history_reserve(line_buffer, capacity, match_length)){
+                    line = *line_buffer;
+                    length = match_length;
+                    memcpy(line, text, length);
+                }
+            }
+
+            if(c != '\r' && c != '\n'){
+                history_draw(line, length, NULL, 0);
+                if(c != 27)
+                    continue;
+            }
+        }
+
+        if(c == '\r' || c == '\n')
+            break;
+
+        //Ctrl-D
+        if(c == 4){
+            if(length == 0){
+                ret = false;
+                break;
+            }
+            continue;
+        }
+
+        //Ctrl-C
+        if(c == 3){
+            printf("^C\r\n");
+            length = 0;
+            browsed = history_count();
+            history_draw(line, length, NULL, 0);
+            continue;
+        }
+
+        //Ctrl-U
+        if(c == 21){
+            length = 0;
+            history_draw(line, length, NULL, 0);
+            continue;
+        }
+
+        if(c == 18){
+            searching = true;
+            query_length = 0;
+            match = -1;
+            history_draw("", 0, query, query_length);
+            continue;
+        }
+
+        if(c == 127 || c == 8){
+            length -= length > 0;
+            history_draw(line, length, NULL, 0);
+            continue;
+        }
+
+        //Escape sequences : only the arrows Up and Down are used
+        if(c == 27){
+
+            char sequence[2];
+            if(read(STDIN_FILENO, &sequence[0], 1) != 1 || sequence[0] != '[' ||
+               read(STDIN_FILENO, &sequence[1], 1) != 1)
+                continue;
+
+            size_t target = browsed;
+            if(sequence[1] == 'A' && browsed > 0)
+                target = browsed - 1;
+            else if(sequence[1] == 'B' && browsed < history_count())
+                target = browsed + 1;
+            if(target == browsed)
+                continue;
+
+            if(browsed == history_count()){
+                char* copy = realloc(typed, length + 1);
+                if(copy == NULL)
+                    continue;
+                typed = copy;
+                memcpy(typed, line, length);
+                typed_length = length;
+            }
+
+            const char* text = typed;
+            size_t text_length = typed_length;
+            if(target < history_count())
+                text = history_record(target, &text_length);
+
+            if(!history_reserve(line_buffer, capacity, text_length))
+                continue;
+            line = *line_buffer;
+            length = text_length;
+            memcpy(line, text, length);
+            browsed = target;
+            history_draw(line, length, NULL, 0);
+            continue;
+        }
+
+        if(c == '\t'){
+            history_complete(line_buffer, capacity, &length);
+            line = *line_buffer;
+            continue;
+        }
+
+        if((unsigned char) c >= 32 && history_reserve(line_buffer, capacity, length + 1)){
+            line = *line_buffer;
+            line[length++] = c;
+            history_draw(line, length, NULL, 0);
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    printf("\n");
+    free(typed);
+
+    if(!ret)
+        return false;
+
+    //Blank lines are not kept
+    for(size_t i = 0; i < length; i++){
+        if(line[i] != ' ' && line[i] != '\t'){
+            history_add(line, length);
+            break;
+        }
+    }
+
+    line[length] = '\n';
+    line[length + 1] = 0;
+    return true;
+}
+
+
+/*************************************builtin_history*****************************************
+*
+* List the history shared by the interactive shells :
+*   - history [N] : the last N lines (all by default)
+*   - history -s TEXT : the lines containing TEXT (searched through the index)
+*
+* ARGUMENT :
+*   - args : an array containing all the args of the command
+*
+* RETURN : 0 if successful, 1 otherwise
+*
+*******************************************************************************************/
+int builtin_history(char** args){
+
+    if(!history_open()){
+        fprintf(stderr, "history: no history file (set HISTFILE or HOME)\n");
+        return 1;
+    }
+
+    history_refresh();
+    size_t count = history_count();
+    size_t length;
+
+    if(args[1] != NULL && !strcmp(args[1], "-s")){
+
+        if(args[2] == NULL || args[3] != NULL){
+            fprintf(stderr, "Usage: history -s TEXT\n");
+            return 1;
+        }
+
+        size_t text_length = strlen(args[2]);
+        size_t nb_indexed = history_index != NULL ? history_index->nb_records : 0;
+        uint32_t* records;
+        long nb_records = history_candidates(args[2], text_length, &records);
+
+        //Indexed candidates, then the records after the index
+        for(size_t k = 0; k < (nb_records == -1 ? nb_indexed : (size_t) nb_records); k++){
+
+            size_t r = nb_records == -1 ? k : records[k];
+            if(history_match(r, args[2], text_length)){
+                const char* text = history_record(r, &length);
+                printf("%5zu  %.*s\n", r + 1, (int) length, text);
+            }
+        }
+        free(records);
+
+        for(size_t r = nb_indexed; r < count; r++){
+            if(history_match(r, args[2], text_length)){
+                const char* text = history_record(r, &length);
+                printf("%5zu  %.*s\n", r + 1, (int) length, text);
+            }
+        }
+
+        return 0;
+    }
+
+    size_t first = 0;
+    if(args[1] != NULL){
+
+        char* end;
+        long n = strtol(args[1], &end, 10);
+        if(*end != 0 || n < 0 || args[2] != NULL){
+            fprintf(stderr, "Usage: history [N] | history -s TEXT\n");
+            return 1;
+        }
+        first = (size_t) n < count ? count - n : 0;
+    }
+
+    for(size_t r = first; r < count; r++){
+        const char* text = history_record(r, &length);
+        printf("%5zu  %.*s\n", r + 1, (int) length, text);
+    }
+
+    return 0;
+}
+
+
+/*************************************session_swap*****************************************
+*
+* Exchange the variable table of the shell with the one of a session : called once before
+* running a command of the session, once after to put the previous table back
+*
+* ARGUMENT :
+*   - session : the session
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_swap(struct session* session){
+
+    struct variable* table = var_table;
+    size_t capacity = var_capacity;
+    size_t count = var_count;
+
+    var_table = session->var_table;
+    var_capacity = session->var_capacity;
+    var_count = session->var_count;
+
+    session->var_table = table;
+    session->var_capacity = capacity;
+    session->var_count = count;
+}
+
+
+/*************************************session_send*****************************************
+*
+* Queue a frame for the client of a session (sent by session_flush)
+*
+* ARGUMENT :
+*   - session : the session
+*   - type : the type of the frame
+*   - data : the payload
+*   - length : the length of the payload
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_send(struct session* session, char type, const void* data, uint32_t length){
+
+    //Nobody to send it to
+    if(session->gone)
+        return;
+
+    size_t needed = session->out_length + FRAME_HEADER + length;
+    if(needed > session->out_capacity){
+
+        size_t new_capacity = session->out_capacity ? session->out_capacity : 4096;
+        while(new_capacity < needed)
+            new_capacity *= 2;
+
+        char* new_out = realloc(session->out, new_capacity);
+        if(new_out == NULL){
+            session->gone = true;
+            return;
+        }
+        session->out = new_out;
+        session->out_capacity = new_capacity;
+    }
+
+    char* frame = session->out + session->out_length;
+    frame[0] = type;
+    memcpy(frame + 1, &length, 4);
+    memcpy(frame + FRAME_HEADER, data, length);
+    session->out_length = needed;
+}
+
+
+/*************************************session_flush*****************************************
+*
+* Send as much of the queued frames as the socket accepts without blocking
+*
+* ARGUMENT :
+*   - session : the session
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_flush(struct session* session){
+
+    while(session->out_sent < session->out_length && !session->gone){
+
+        ssize_t n = send(session->fd, session->out + session->out_sent,
+                         session->out_length - session->out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n > 0)
+            session->out_sent += n;
+        else if(n == -1 && errno == EINTR)
+            continue;
+        else if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+            session->gone = true;
+    }
+
+    session->out_sent = 0;
+    session->out_length = 0;
+}
+
+
+/*************************************session_watch*****************************************
+*
+* Update what epoll watches for a file descriptor of a session, only when it changes. A
+* file descriptor watched for nothing is taken out of epoll, which would report EPOLLHUP
+* anyway.
+*
+* ARGUMENT :
+*   - fd : the file descriptor
+*   - watched : what is watched now, updated
+*   - events : what must be watched
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_watch(int fd, unsigned int* watched, unsigned int events){
+
+    if(fd == -1 || *watched == events)
+        return;
+
+    struct epoll_event event = {.events = events, .data.fd = fd};
+
+    if(events == 0)
+        epoll_ctl(server_epoll, EPOLL_CTL_DEL, fd, NULL);
+    else
+        epoll_ctl(server_epoll, *watched == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+    *watched = events;
+}
+
+
+/*************************************session_track*****************************************
+*
+* Add a file descriptor of a session to epoll and to the table giving the session of a
+* file descriptor
+*
+* ARGUMENT :
+*   - session : the session
+*   - fd : the file descriptor
+*
+* RETURN : true if successful, false otherwise
+*
+*******************************************************************************************/
+static bool session_track(struct session* session, int fd){
+
+    if(fd >= server_fds_capacity){
+
+        int new_capacity = server_fds_capacity ? server_fds_capacity : 64;
+        while(new_capacity <= fd)
+            new_capacity *= 2;
+
+        struct session** new_fds = realloc(server_fds, new_capacity * sizeof(struct session*));
+        if(new_fds == NULL)
+            return false;
+
+        for(int i = server_fds_capacity; i < new_capacity; i++)
+            new_fds[i] = NULL;
+        server_fds = new_fds;
+        server_fds_capacity = new_capacity;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+    if(epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &event) == -1){
+        perror("epoll_ctl");
+        return false;
+    }
+
+    server_fds[fd] = session;
+    return true;
+}
+
+
+/*************************************session_untrack*****************************************
+*
+* Remove a file descriptor of a session from epoll and close it
+*
+* ARGUMENT :
+*   - fd : the file descriptor, set to -1
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_untrack(int* fd){
+
+    if(*fd == -1)
+        return;
+
+    epoll_ctl(server_epoll, EPOLL_CTL_DEL, *fd, NULL);
+    server_fds[*fd] = NULL;
+    close(*fd);
+    *fd = -1;
+}
+
+
+/*************************************session_output*****************************************
+*
+* Forward what a running command wrote on stdout or stderr to the client
+*
+* ARGUMENT :
+*   - session : the session
+*   - fd : the pipe of stdout or of stderr, set to -1 at end of file
+*   - type : FRAME_STDOUT or FRAME_STDERR
+*
+* RETURN : true if everything in the pipe was read, false if the client must catch up first
+*
+*******************************************************************************************/
+static bool session_output(struct session* session, int* fd, char type){
+
+    while(session->out_length < SESSION_OUT_MAX){
 
-                        perror("Couldn't retrieve the IP address");
-                        print_failure("1", &prev_return);
-                        close(socket_desc);
-                        continue;
-                    }
+        ssize_t n = read(*fd, server_frame, FRAME_MAX);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
 
-                    //Extract the address
-                    struct sockaddr_in* IP_address = (struct sockaddr_in*) &my_ifreq.ifr_addr;
-                    printf("%s",inet_ntoa(IP_address->sin_addr));
+        if(n <= 0){
+            session_untrack(fd);
+            return true;
+        }
 
-                    // Get the mask, if successful, mask is in my_ifreq.ifr_netmask
-                    if(ioctl(socket_desc, SIOCGIFNETMASK, &my_ifreq) == -1){
+        session_send(session, type, server_frame, n);
+    }
 
-                        perror("Couldn't retrieve the mask");
-                        print_failure("1", &prev_return);
-                        close(socket_desc);
-                        continue;
-                    }
+    return false;
+}
 
-                    //Cast and extract the mask
-                    struct sockaddr_in* mask = (struct sockaddr_in*) &my_ifreq.ifr_addr;
-                    printf(".%s\n",inet_ntoa(mask->sin_addr));
-                    close(socket_desc);
 
-                    printf("0");
-                    continue;
+/*************************************session_stray*****************************************
+*
+* Keep forwarding a pipe of a line that ended : a background command started by the line
+* still has it
+*
+* ARGUMENT :
+*   - session : the session
+*   - fd : the pipe, set to -1
+*   - type : FRAME_STDOUT or FRAME_STDERR
+*   - watched : what epoll watches for it
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_stray(struct session* session, int* fd, char type, unsigned int watched){
+
+    if(*fd == -1)
+        return;
+
+    if(session->nb_strays == session->strays_capacity){
+
+        int new_capacity = session->strays_capacity ? session->strays_capacity * 2 : 4;
+        struct session_stray* new_strays = realloc(session->strays, new_capacity * sizeof(struct session_stray));
+
+        //Closed instead : the command gets SIGPIPE if it writes
+        if(new_strays == NULL){
+            session_untrack(fd);
+            return;
+        }
+        session->strays = new_strays;
+        session->strays_capacity = new_capacity;
+    }
+
+    session->strays[session->nb_strays++] = (struct session_stray){*fd, type, watched};
+    *fd = -1;
+}
+
+
+/*************************************session_cd*****************************************
+*
+* Run cd in the working directory of a session and remember the new directory
+*
+* ARGUMENT :
+*   - session : the session
+*   - args : the words of the command
+*
+* RETURN : the exit value of cd
+*
+*******************************************************************************************/
+static int session_cd(struct session* session, char** args){
+
+    int server_cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    fchdir(session->cwd_fd);
+
+    int ret = builtin_cd(args);
+
+    if(ret == 0){
+        int new_cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if(new_cwd != -1){
+            close(session->cwd_fd);
+            session->cwd_fd = new_cwd;
+        }
+    }
+
+    if(server_cwd != -1){
+        fchdir(server_cwd);
+        close(server_cwd);
+    }
+
+    return ret;
+}
+
+
+/*************************************session_run*****************************************
+*
+* Run a command line of a session. Assignments, unset and cd change the state of the
+* session and run in the server. The other lines run in a son, like a script line, with
+* stdout and stderr sent to pipes watched by the server. The line ends when the son exits :
+* its background commands may keep the pipes open much longer.
+*
+* ARGUMENT :
+*   - session : the session
+*   - line : the command line
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_run(struct session* session, const char* line){
+
+    struct command_line cmd;
+    int ret = session->prev_return;
+
+    session_swap(session);
+
+    if(lex_line(line, &cmd, session->prev_return, session->prev_pid) == -1)
+        ret = 1;
+
+    else if(cmd.nb_args == 0){
+        //Nothing to run, $? doesn't change
+    }
+
+    else if(cmd.nb_stages == 1 && !cmd.background && cmd.assignment != -1)
+        ret = assign_variable(&cmd) == -1 ? 1 : 0;
+
+    else if(cmd.nb_stages == 1 && !cmd.background && !strcmp(cmd.args[0], "unset"))
+        ret = builtin_unset(cmd.args);
+
+    else if(cmd.nb_stages == 1 && !cmd.background && !strcmp(cmd.args[0], "cd"))
+        ret = session_cd(session, cmd.args);
+
+    else{
+
+        int out_pipe[2], err_pipe[2];
+        struct job* job = NULL;
+
+        if(pipe2(out_pipe, O_CLOEXEC) == -1){
+            perror("Pipe couldn't be created");
+        }
+        else if(pipe2(err_pipe, O_CLOEXEC) == -1){
+            perror("Pipe couldn't be created");
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+        }
+        else
+            job = job_create(1, NULL, false);
+
+        pid_t pid = -1;
+        if(job != NULL){
+            fflush(stdout);
+            fflush(stderr);
+            pid = fork();
+        }
+
+        //This is the son : run the line like the batch mode does, in its own process group
+        //so that the line can be stopped as a whole (see session_hangup)
+        if(pid == 0){
 
+            setpgid(0, 0);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            dup2(err_pipe[1], STDERR_FILENO);
+            int null_fd = open("/dev/null", O_RDONLY);
+            if(null_fd != -1)
+                dup2(null_fd, STDIN_FILENO);
+            fchdir(session->cwd_fd);
+            block_sigchld(false);
+
+            int prev_pid = session->prev_pid;
+            run_command_line(&cmd, &ret, &prev_pid);
+
+            fflush(stdout);
+            fflush(stderr);
+            _exit(ret & 0xff);
+        }
+
+        if(job != NULL){
+            close(out_pipe[1]);
+            close(err_pipe[1]);
+        }
 
+        if(pid == -1){
+            if(job != NULL){
+                perror("Process creation failed");
+                job_remove(job);
+                close(out_pipe[0]);
+                close(err_pipe[0]);
             }
+            ret = 1;
+        }
+        else{
+            setpgid(pid, pid);
+
+            struct job_stage* stage = &job->stages[0];
+            snprintf(stage->name, sizeof(stage->name), "%s", cmd.args[cmd.stages[0]]);
+            stage->pid = pid;
+            stage->start_ns = now_ns();
+            job->nb_running = 1;
+
+            session->job = job;
+            session->stdout_fd = out_pipe[0];
+            session->stderr_fd = err_pipe[0];
+            fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+            session_track(session, out_pipe[0]);
+            session_track(session, err_pipe[0]);
+            session->stdout_watched = session->stderr_watched = EPOLLIN;
+
+            session_swap(session);
+            return;
+        }
+    }
 
-        
-            //Set the ip of the interface DEV to IP/MASK
-            else if ((args[1]!=NULL)&&
-                (args[2]!=NULL)&&
-                (!strcmp(args[1], "ip"))&&
-                (!strcmp(args[2], "addr"))&&
-                (args[3]!= NULL)&&
-                (args[4]!=NULL)&&
-                (args[5]!=NULL)){
+    session_swap(session);
 
+    session->prev_return = ret;
+    session_send(session, FRAME_EXIT, &ret, sizeof(ret));
+}
 
-                //Interface name and length
-                char* name = args[3]; 
-                size_t length_if_name= strlen(name); 
 
-                char* address = args[4];
-                char* mask = args[5];
+/*************************************session_hangup*****************************************
+*
+* Stop the line of a session whose client left : its process group gets SIGHUP, then
+* SIGKILL if some of it is still there SESSION_KILL_NS later. Its output has nowhere to go,
+* the pipes are closed. The session is kept until the group is empty.
+*
+* ARGUMENT :
+*   - session : the session
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_hangup(struct session* session){
+
+    session_untrack(&session->stdout_fd);
+    session_untrack(&session->stderr_fd);
+    for(int i = 0; i < session->nb_strays; i++)
+        session_untrack(&session->strays[i].fd);
+
+    //The son leads the group, the commands it started are in it
+    if(session->hangup_group == 0 && session->hangup_ns == 0 && session->job != NULL &&
+       session->job->nb_running > 0){
+        session->hangup_group = session->job->stages[0].pid;
+        session->hangup_ns = now_ns();
+        kill(-session->hangup_group, SIGHUP);
+        kill(-session->hangup_group, SIGCONT);
+    }
 
-                // Create a socket in UDP mode
-                int socket_desc = socket(AF_INET, SOCK_DGRAM, 0);
- 
-                //If socket couldn't be created
-                if (socket_desc == -1){
-                    perror("Socket couldn't be created\n");
-                    print_failure("1", &prev_return);
-                    continue;
-                }
+    //Commands ignoring SIGHUP may outlive the son
+    else if(session->hangup_group != 0){
+        if(kill(-session->hangup_group, 0) == -1 && errno == ESRCH)
+            session->hangup_group = 0;
+        else if(now_ns() - session->hangup_ns >= SESSION_KILL_NS)
+            kill(-session->hangup_group, SIGKILL);
+    }
+}
 
-                //Creating an interface structure
-                struct ifreq my_ifreq; 
-                my_ifreq.ifr_addr.sa_family = AF_INET;
 
+/*************************************session_progress*****************************************
+*
+* Move a session forward : end the running command once it exited and its output has been
+* read, run the next command line received, send the queued frames and update what epoll
+* watches. The pipes still open when a line ends are forwarded as long as its background
+* commands keep them.
+*
+* ARGUMENT :
+*   - session : the session
+*
+* RETURN : false if the session is over and has been freed, true otherwise
+*
+*******************************************************************************************/
+static bool session_progress(struct session* session){
 
-                //Check that the ifr_name is big enough
-                if (length_if_name < IFNAMSIZ){ 
-                    //Set the name of the interface you want to look at
-                    memcpy(my_ifreq.ifr_name,name,length_if_name);
-                    //End the name with terminating char
-                    my_ifreq.ifr_name[length_if_name]=0;
+    if(session->gone)
+        session_hangup(session);
 
-                }
-                else{
-                    perror("The interface name is too long");
-                    print_failure("1", &prev_return);
-                    close(socket_desc);
-                    continue;
-                }
-                //Creating an address structure;
-                struct sockaddr_in* address_struct = (struct sockaddr_in*)&my_ifreq.ifr_addr;
+    while(true){
 
-                // Converting from string to address structure
-                inet_pton(AF_INET, address, &address_struct->sin_addr);
+        //The running command ended and everything it wrote has been forwarded
+        if(session->job != NULL){
 
-                //Setting the new IP address
-                if(ioctl(socket_desc, SIOCSIFADDR, &my_ifreq) == -1){
+            if(session->job->nb_running > 0)
+                break;
 
-                    perror("Couldn't set the address. NOTE: must be in super used mode");
-                    print_failure("1", &prev_return);
-                    close(socket_desc);
-                    continue;
-                }
+            //The son exited : all it wrote is in the pipes
+            bool drained = true;
+            if(session->stdout_fd != -1)
+                drained = session_output(session, &session->stdout_fd, FRAME_STDOUT);
+            if(drained && session->stderr_fd != -1)
+                drained = session_output(session, &session->stderr_fd, FRAME_STDERR);
+            if(!drained)
+                break;
 
-                //Creating a mask structure;
-                struct sockaddr_in* mask_struct = (struct sockaddr_in*)&my_ifreq.ifr_netmask;
+            session_stray(session, &session->stdout_fd, FRAME_STDOUT, session->stdout_watched);
+            session_stray(session, &session->stderr_fd, FRAME_STDERR, session->stderr_watched);
 
-                // Converting from string to mask structure
-                inet_pton(AF_INET, mask,  &mask_struct->sin_addr);
+            int ret = session->job->stages[0].status;
+            job_remove(session->job);
+            session->job = NULL;
+            session->prev_return = ret;
+            session_send(session, FRAME_EXIT, &ret, sizeof(ret));
+        }
 
-                //Setting the mask
-                if(ioctl(socket_desc, SIOCSIFNETMASK, &my_ifreq) == -1){
+        //Next complete frame
+        if(session->closing || session->in_length < FRAME_HEADER)
+            break;
 
-                    perror("Couldn't set the mask. NOTE: must be in super used mode");
-                    print_failure("1", &prev_return);
-                    close(socket_desc);
-                    continue;
-                }
+        uint32_t length;
+        memcpy(&length, session->in + 1, 4);
 
+        if(session->in[0] != FRAME_COMMAND || length > FRAME_MAX){
+            fprintf(stderr, "Session %d : invalid frame\n", session->fd);
+            session->closing = true;
+            break;
+        }
 
-                ioctl(socket_desc, SIOCGIFFLAGS, &my_ifreq); //Load flags
-                my_ifreq.ifr_flags |= IFF_UP | IFF_RUNNING; //Change flags
-                ioctl(socket_desc, SIOCSIFFLAGS, &my_ifreq); //Save flags
-                close(socket_desc);
+        if(session->in_length < FRAME_HEADER + length)
+            break;
 
-                printf("0");
-                continue;
+        memcpy(server_frame, session->in + FRAME_HEADER, length);
+        server_frame[length] = 0;
+        session->in_length -= FRAME_HEADER + length;
+        memmove(session->in, session->in + FRAME_HEADER + length, session->in_length);
+
+        //Acknowledged like a line, the client knows the connection ends on purpose
+        if(!strcmp(server_frame, "exit") || !strcmp(server_frame, "exit\n")){
+            session->closing = true;
+            session_send(session, FRAME_EXIT, &session->prev_return, sizeof(int));
+        }
+        else
+            session_run(session, server_frame);
+    }
+
+    session_flush(session);
 
+    //Over : the client left or said exit, and nothing is left to do for it
+    if((session->closing || session->gone) && session->job == NULL && session->hangup_group == 0 &&
+       (session->gone || session->out_length == 0)){
+
+        session_untrack(&session->fd);
+        close(session->cwd_fd);
+
+        for(int i = 0; i < session->nb_strays; i++)
+            session_untrack(&session->strays[i].fd);
+        free(session->strays);
+
+        for(size_t i = 0; i < session->var_capacity; i++){
+            free(session->var_table[i].name);
+            free(session->var_table[i].value);
+        }
+        free(session->var_table);
+
+        for(int i = 0; i < nb_sessions; i++){
+            if(sessions[i] == session){
+                sessions[i] = sessions[--nb_sessions];
+                break;
             }
+        }
 
-            //In all other cases, error
-            else{
-                print_failure("1", &prev_return);
+        free(session->in);
+        free(session->out);
+        free(session);
+        return false;
+    }
+
+    //Read the output of the command only while the client keeps up with it
+    unsigned int output_events = session->out_length < SESSION_OUT_MAX ? EPOLLIN : 0;
+    session_watch(session->stdout_fd, &session->stdout_watched, output_events);
+    session_watch(session->stderr_fd, &session->stderr_watched, output_events);
+
+    //The pipes closed by the background commands are forgotten
+    for(int i = 0; i < session->nb_strays; ){
+        if(session->strays[i].fd == -1)
+            session->strays[i] = session->strays[--session->nb_strays];
+        else{
+            session_watch(session->strays[i].fd, &session->strays[i].watched, output_events);
+            i++;
+        }
+    }
+    session_watch(session->fd, &session->fd_watched,
+                  (session->closing ? 0 : EPOLLIN) | (session->out_length > 0 ? EPOLLOUT : 0));
+
+    return true;
+}
+
+
+/*************************************session_input*****************************************
+*
+* Read what the client of a session sent
+*
+* ARGUMENT :
+*   - session : the session
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_input(struct session* session){
+
+    while(true){
+
+        if(session->in_capacity - session->in_length < 4096){
+
+            size_t new_capacity = session->in_capacity ? session->in_capacity * 2 : 8192;
+            char* new_in = realloc(session->in, new_capacity);
+            if(new_in == NULL){
+                session->closing = true;
+                return;
+            }
+            session->in = new_in;
+            session->in_capacity = new_capacity;
+        }
+
+        ssize_t n = recv(session->fd, session->in + session->in_length,
+                         session->in_capacity - session->in_length, MSG_DONTWAIT);
+        if(n > 0){
+            session->in_length += n;
+            continue;
+        }
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        //The client closed the connection : finish its command lines, nobody reads the result
+        session->closing = true;
+        session->gone = true;
+        return;
+    }
+}
+
+
+/*************************************session_accept*****************************************
+*
+* Accept the waiting clients, each one gets a session with its own variables, $?, $! and
+* working directory
+*
+* ARGUMENT :
+*   - listen_fd : the listening socket
+*
+* RETURN : /
+*
+*******************************************************************************************/
+static void session_accept(int listen_fd){
+
+    while(true){
+
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1){
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Connection couldn't be accepted");
+            return;
+        }
+
+        if(nb_sessions == sessions_capacity){
+            int new_capacity = sessions_capacity ? sessions_capacity * 2 : 16;
+            struct session** new_sessions = realloc(sessions, new_capacity * sizeof(struct session*));
+            if(new_sessions == NULL){
+                close(fd);
                 continue;
             }
+            sessions = new_sessions;
+            sessions_capacity = new_capacity;
+        }
 
-        }  
+        struct session* session = calloc(1, sizeof(struct session));
+        if(session == NULL){
+            close(fd);
+            continue;
+        }
 
-        //The command isn't a built-in command
-        pid = fork();
+        session->fd = fd;
+        session->cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        session->stdout_fd = -1;
+        session->stderr_fd = -1;
+        session->fd_watched = EPOLLIN;
 
-        //Error
-        if(pid < 0){
-            perror("Process creation failed");
-            exit(EXIT_FAILURE);
+        if(!session_track(session, fd)){
+            close(session->cwd_fd);
+            close(fd);
+            free(session);
+            continue;
         }
 
-        //This is the son
-        if(pid == 0){
+        sessions[nb_sessions++] = session;
+    }
+}
 
-            //Absolute path of command
-            if(args[0][0] == '/'){
-                if(execv(args[0],args) == -1){
-                    perror("Instruction failed");
-                }
-            }
 
-            //Relative path -- Need to check the $PATH environment variable
-            else{
-                char* paths[256];
-                int j = 1;            
+/*************************************server_run*****************************************
+*
+* The server mode : accept clients on a Unix socket and run the command lines they send,
+* several clients at a time. SIGCHLD stays blocked except while waiting in epoll_pwait, so
+* the handler never runs while the server uses the job table.
+*
+* Every frame is a 1 byte type, a 4 byte length (host order) and the payload :
+*   - C (client) : a command line
+*   - O, E (server) : output of the command on stdout, on stderr
+*   - X (server) : the exit value of the command line (int), once all its output was sent
+*
+* ARGUMENT :
+*   - path : the path of the socket, replaced only if it is a socket no server listens on
+*
+* RETURN : 1 if the server couldn't start, doesn't return otherwise
+*
+*******************************************************************************************/
+int server_run(const char* path){
 
-                int nb_paths = get_paths(paths);
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Socket path too long : %s\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
 
-                /*In the case of commands like mkdir/rmdir, if the first argument is a directory with whitespaces ("a b", 'a b', a\ b),
-                  we need to change this directory in something understandable for the shell*/
-                if(nb_args > 2){
-                    if(args[1][0] == '\"' || args[1][0] == '\'' || args[1][strlen(args[1])-1] == '\\')
-                        remove_delimiters(args,IS_COMMAND);
-                }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listen_fd == -1){
+        perror("Socket couldn't be created");
+        return 1;
+    }
 
-                //If executable, don't need to add path
-                if(args[0][0] == '.'){
-                    if(execv(args[0],args) == -1){
-                        perror("Instruction failed");
-                    }
-                    break;    
-                    
-                }
-                else{           
-                    //Taking a path from paths[] and concatenating with the command
-                    for(j = 0; j < nb_paths; j++){
-                        char path[256] = "";
-                        strcat(path,paths[j]);
-                        strcat(path,"/");
-                        strcat(path,args[0]);
-                    
-                        //Check if path contains the command to execute
-                        if(access(path,X_OK) == 0){
-
-                            if(execv(path,args) == -1){
-                                perror("Instruction failed");
-                            }
-                            
-                            break;
-                        }
+    //Only a stale socket is replaced : not a file, nor the socket of a server still running
+    struct stat path_stat;
+    if(lstat(path, &path_stat) == 0){
 
-                    }
-                    printf("Command does not exist\n");
+        int probe = S_ISSOCK(path_stat.st_mode) ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+        bool stale = probe != -1 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == -1 &&
+                     errno == ECONNREFUSED;
+        if(probe != -1)
+            close(probe);
+
+        if(!stale){
+            fprintf(stderr, "Socket couldn't be bound: %s\n", strerror(S_ISSOCK(path_stat.st_mode) ? EADDRINUSE : EEXIST));
+            close(listen_fd);
+            return 1;
+        }
+        unlink(path);
+    }
+
+    if(bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listen_fd, 128) == -1){
+        perror("Socket couldn't be bound");
+        close(listen_fd);
+        return 1;
+    }
+
+    server_epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = listen_fd};
+    if(server_epoll == -1 || epoll_ctl(server_epoll, EPOLL_CTL_ADD, listen_fd, &event) == -1){
+        perror("epoll couldn't be created");
+        close(listen_fd);
+        return 1;
+    }
+
+    block_sigchld(true);
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+
+    struct epoll_event events[64];
+
+    while(true){
+
+        //A line sent SIGHUP must be checked again to be killed
+        int timeout = -1;
+        for(int i = 0; i < nb_sessions; i++){
+            if(sessions[i]->hangup_group != 0)
+                timeout = SESSION_KILL_NS / 4000000;
+        }
+
+        int nb_events = epoll_pwait(server_epoll, events, 64, timeout, &mask);
+        if(nb_events == -1 && errno != EINTR){
+            perror("epoll_pwait");
+            return 1;
+        }
+
+        for(int i = 0; i < nb_events; i++){
+
+            int fd = events[i].data.fd;
+
+            if(fd == listen_fd){
+                session_accept(listen_fd);
+                continue;
+            }
+
+            struct session* session = fd < server_fds_capacity ? server_fds[fd] : NULL;
+            if(session == NULL)
+                continue;
+
+            if(fd == session->fd){
+                if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    session_input(session);
+                if(events[i].events & EPOLLOUT)
+                    session_flush(session);
+            }
+            else if(fd == session->stdout_fd)
+                session_output(session, &session->stdout_fd, FRAME_STDOUT);
+            else if(fd == session->stderr_fd)
+                session_output(session, &session->stderr_fd, FRAME_STDERR);
+            else{
+                for(int k = 0; k < session->nb_strays; k++){
+                    if(session->strays[k].fd == fd)
+                        session_output(session, &session->strays[k].fd, session->strays[k].type);
                 }
             }
-            
-            exit(EXIT_FAILURE);
         }
 
-        //This is the father
+        //A child may have ended (EINTR) : look at every session
+        for(int i = 0; i < nb_sessions; ){
+            if(session_progress(sessions[i]))
+                i++;
+        }
+    }
+}
+
+
+/******************************************main**********************************************/
+int main(int argc, char** argv){
+
+    bool stop = false;
+    int prev_return = 0;
+    int prev_pid = 0;
+
+    //The line grows with the input, lex_line limits it to ARG_MAX
+    char* line = NULL;
+    size_t line_capacity = 0;
+    struct command_line cmd;
+    
+    /*Batch modes :
+        shell [-s] -c COMMANDS : run the lines of COMMANDS
+        shell [-s] SCRIPT : run the lines of the file SCRIPT
+      No prompt is printed, stdout is fully buffered and the exit codes are only printed with -s*/
+    FILE* input = stdin;
+    const char* script = NULL;
+    int opt = 1;
+
+    /*Server mode :
+        shell --server PATH : run the command lines sent by the clients of the socket PATH,
+        the exit codes are sent in the frames*/
+    const char* server_path = NULL;
+
+    if(argc == 3 && !strcmp(argv[1], "--server")){
+        server_path = argv[2];
+        interactive = false;
+        show_status = false;
+    }
+    else if(opt < argc && !strcmp(argv[opt], "-s"))
+        opt++;
+
+    if(opt < argc && server_path == NULL){
+
+        if(!strcmp(argv[opt], "-c") && opt + 2 == argc)
+            input = fmemopen(argv[opt+1], strlen(argv[opt+1]), "r");
+        else if(argv[opt][0] != '-' && opt + 1 == argc){
+            script = argv[opt];
+            input = fopen(script, "r");
+        }
         else{
-            prev_pid = waitpid(-1, &status,0);
-            prev_return = WEXITSTATUS(status);
-            printf("\n%d",prev_return);
+            fprintf(stderr, "Usage: %s [-s] [-c COMMANDS | SCRIPT] | --server PATH\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if(input == NULL){
+            perror("Script couldn't be opened");
+            return EXIT_FAILURE;
+        }
+
+        interactive = false;
+        show_status = (opt == 2);
+        setvbuf(stdout, NULL, _IOFBF, 65536);
+    }
+
+    //Reap the children as soon as they end
+    struct sigaction sigchld_action;
+    memset(&sigchld_action, 0, sizeof(sigchld_action));
+    sigchld_action.sa_handler = sigchld_handler;
+    sigchld_action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sigchld_action.sa_mask);
+    sigaction(SIGCHLD, &sigchld_action, NULL);
+
+    if(server_path != NULL)
+        return server_run(server_path);
+
+    //On a terminal, the lines are edited with the history
+    bool line_editing = interactive && isatty(STDIN_FILENO);
+    if(line_editing)
+        history_open();
+
+    //Script : run its compiled form, cached from one run to the next
+    if(script != NULL && program_script(script, &prev_return, &prev_pid) == 0){
+        fclose(input);
+        return prev_return;
+    }
+
+    while(!stop){
+
+        //Prompt
+        if(interactive){
+            notify_jobs();
+            printf("> ");
+            fflush(stdout);
+        }
+
+        //User wants to quit (using Ctrl+D or exit())
+        if(!(line_editing ? history_read_line(&line, &line_capacity) : getline(&line, &line_capacity, input) != -1) ||
+           (!strncmp(line,"exit",4) && (line[4] == '\n' || line[4] == 0))){
+            stop = true;
+            break;
+        }
+
+        //User enters a line, cut it into words and replace $!, $? or $variable
+        if(lex_line(line, &cmd, prev_return, prev_pid) == -1){
+            print_failure("1", &prev_return);
+            continue;
         }
 
+        //Empty line, blanks or comment only
+        if(cmd.nb_args == 0)
+            continue;
+
+        run_command_line(&cmd, &prev_return, &prev_pid);
+    }
+
+    free(line);
+
+    if(!interactive){
+        fclose(input);
+        return prev_return;
     }
 
     return 0;